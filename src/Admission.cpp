@@ -0,0 +1,63 @@
+#include "Admission.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+    constexpr double LAG_EWMA_ALPHA = 0.2;
+
+    // A level is left only once load falls below this fraction of its entry threshold.
+    constexpr double RELEASE_SCALE = 0.5;
+
+    bool exceeds(double value, double threshold, double scale) {
+        return threshold > 0 && value >= threshold * scale;
+    }
+}
+
+const char* shed_level_name(ShedLevel level) {
+    switch (level) {
+        case ShedLevel::None:    return "normal";
+        case ShedLevel::Logins:  return "shedding new logins";
+        case ShedLevel::Lobbies: return "shedding new logins and lobbies";
+    }
+    return "unknown";
+}
+
+AdmissionController::AdmissionController(const AdmissionOptions& options)
+    : options(options) {}
+
+ShedLevel AdmissionController::level_for(double lag_us, size_t sessions, double scale) const {
+    const double login_lag_us = static_cast<double>(options.login_lag.count()) * 1000.0;
+    const double lobby_lag_us = static_cast<double>(options.lobby_lag.count()) * 1000.0;
+    const double count = static_cast<double>(sessions);
+
+    if (exceeds(lag_us, lobby_lag_us, scale) ||
+        exceeds(count, static_cast<double>(options.lobby_sessions), scale)) {
+        return ShedLevel::Lobbies;
+    }
+    if (exceeds(lag_us, login_lag_us, scale) ||
+        exceeds(count, static_cast<double>(options.login_sessions), scale)) {
+        return ShedLevel::Logins;
+    }
+    return ShedLevel::None;
+}
+
+void AdmissionController::observe(std::chrono::microseconds lag, size_t sessions) {
+    lag_ewma_us += LAG_EWMA_ALPHA * (static_cast<double>(lag.count()) - lag_ewma_us);
+
+    const ShedLevel previous = level();
+    const ShedLevel rising = level_for(lag_ewma_us, sessions, 1.0);
+    const ShedLevel holding = std::min(previous, level_for(lag_ewma_us, sessions, RELEASE_SCALE));
+    const ShedLevel next = std::max(rising, holding);
+
+    if (next != previous) {
+        current.store(next, std::memory_order_relaxed);
+        std::cerr << "[SYS] Admission: " << shed_level_name(next)
+                  << " (loop lag " << static_cast<long>(lag_ewma_us / 1000.0) << " ms, "
+                  << sessions << " sessions)\n";
+    }
+}
+
+bool AdmissionController::accept_connection(size_t sessions) const {
+    return options.max_connections == 0 || sessions < options.max_connections;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+
+// How much new work the server currently turns away. Levels are cumulative.
+enum class ShedLevel {
+    None,
+    Logins,    // new LOGINs get a busy error (reconnects into a running match still pass)
+    Lobbies    // additionally CREATE_LOBBY / JOIN_LOBBY get a busy error
+};
+
+const char* shed_level_name(ShedLevel level);
+
+// Thresholds; a zero value disables that check.
+struct AdmissionOptions {
+    std::chrono::milliseconds login_lag{25};
+    std::chrono::milliseconds lobby_lag{100};
+    size_t login_sessions{0};
+    size_t lobby_sessions{0};
+    size_t max_connections{0};   // beyond this, accepted sockets are refused outright
+};
+
+// Watches event-loop lag and connection count and decides which requests to shed.
+// observe() is called by the I/O thread only; level() may be read from any thread.
+// In-game requests are never shed.
+class AdmissionController {
+public:
+    explicit AdmissionController(const AdmissionOptions& options);
+
+    // lag: time spent dispatching one loop iteration (worst of I/O thread and game workers).
+    void observe(std::chrono::microseconds lag, size_t sessions);
+
+    bool accept_connection(size_t sessions) const;
+
+    std::chrono::microseconds lag() const { return std::chrono::microseconds(static_cast<int64_t>(lag_ewma_us)); }
+    ShedLevel level() const { return current.load(std::memory_order_relaxed); }
+    bool sheds_logins() const { return level() >= ShedLevel::Logins; }
+    bool sheds_lobbies() const { return level() >= ShedLevel::Lobbies; }
+
+private:
+    AdmissionOptions options;
+    double lag_ewma_us{0.0};
+    std::atomic<ShedLevel> current{ShedLevel::None};
+
+    ShedLevel level_for(double lag_us, size_t sessions, double scale) const;
+};
@@ -0,0 +1,153 @@
+#include "AllocStats.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+
+#ifdef UPS_ALLOC_STATS
+
+namespace {
+    constexpr size_t SUBSYSTEMS = static_cast<size_t>(AllocSubsystem::Count);
+    constexpr size_t REQUEST_TYPES = static_cast<size_t>(RequestType::INVALID);
+
+    struct Counter {
+        std::atomic<uint64_t> allocs{0};
+        std::atomic<uint64_t> bytes{0};
+
+        void add(uint64_t a, uint64_t b) {
+            allocs.fetch_add(a, std::memory_order_relaxed);
+            bytes.fetch_add(b, std::memory_order_relaxed);
+        }
+    };
+
+    Counter total;
+    Counter per_subsystem[SUBSYSTEMS];
+    Counter per_request[REQUEST_TYPES];
+    std::atomic<uint64_t> requests_seen[REQUEST_TYPES];
+
+    // Plain thread-locals: operator new must not allocate or run constructors.
+    thread_local uint64_t thread_allocs = 0;
+    thread_local uint64_t thread_bytes = 0;
+    thread_local AllocScope* innermost = nullptr;
+
+    void* counted_alloc(size_t size) {
+        thread_allocs++;
+        thread_bytes += size;
+        total.add(1, size);
+
+        void* p = std::malloc(size ? size : 1);
+        if (!p) throw std::bad_alloc();
+        return p;
+    }
+
+    const char* subsystem_name(AllocSubsystem s) {
+        switch (s) {
+            case AllocSubsystem::Transport: return "transport";
+            case AllocSubsystem::Framing:   return "framing";
+            case AllocSubsystem::Parse:     return "parse";
+            case AllocSubsystem::Session:   return "session";
+            case AllocSubsystem::Output:    return "output";
+            case AllocSubsystem::Heartbeat: return "heartbeat";
+            case AllocSubsystem::Timers:    return "timers";
+            case AllocSubsystem::Count:     break;
+        }
+        return "unknown";
+    }
+}
+
+void* operator new(size_t size) { return counted_alloc(size); }
+void* operator new[](size_t size) { return counted_alloc(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try { return counted_alloc(size); } catch (...) { return nullptr; }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try { return counted_alloc(size); } catch (...) { return nullptr; }
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+// Scopes nest: entering an inner scope settles the outer one so nothing is counted twice.
+AllocScope::AllocScope(AllocSubsystem subsystem, RequestType type)
+    : subsystem(subsystem), type(type), outer(innermost) {
+    if (outer) {
+        outer->flush();
+        if (type == RequestType::INVALID) this->type = outer->type;
+    }
+    innermost = this;
+    restart();
+}
+
+AllocScope::~AllocScope() {
+    flush();
+    innermost = outer;
+    if (outer) outer->restart();
+}
+
+void AllocScope::restart() {
+    start_allocs = thread_allocs;
+    start_bytes = thread_bytes;
+}
+
+void AllocScope::flush() {
+    const uint64_t allocs = thread_allocs - start_allocs;
+    const uint64_t bytes = thread_bytes - start_bytes;
+    if (allocs > 0) {
+        per_subsystem[static_cast<size_t>(subsystem)].add(allocs, bytes);
+        if (type != RequestType::INVALID) per_request[static_cast<size_t>(type)].add(allocs, bytes);
+    }
+    restart();
+}
+
+void alloc_stats_count_request(RequestType type) {
+    if (type == RequestType::INVALID) return;
+    requests_seen[static_cast<size_t>(type)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void alloc_stats_report(std::ostream& os, const char* prefix) {
+    const uint64_t all_allocs = total.allocs.load(std::memory_order_relaxed);
+    const uint64_t all_bytes = total.bytes.load(std::memory_order_relaxed);
+
+    uint64_t scoped_allocs = 0;
+    uint64_t scoped_bytes = 0;
+    for (size_t i = 0; i < SUBSYSTEMS; i++) {
+        const uint64_t a = per_subsystem[i].allocs.load(std::memory_order_relaxed);
+        const uint64_t b = per_subsystem[i].bytes.load(std::memory_order_relaxed);
+        scoped_allocs += a;
+        scoped_bytes += b;
+        os << prefix << "alloc subsystem=" << subsystem_name(static_cast<AllocSubsystem>(i))
+           << " allocs=" << a << " bytes=" << b << "\n";
+    }
+    os << prefix << "alloc subsystem=other allocs=" << (all_allocs - scoped_allocs)
+       << " bytes=" << (all_bytes - scoped_bytes) << "\n";
+
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    os << std::fixed << std::setprecision(2);
+    for (size_t i = 0; i < REQUEST_TYPES; i++) {
+        const uint64_t n = requests_seen[i].load(std::memory_order_relaxed);
+        if (n == 0) continue;
+        const double a = static_cast<double>(per_request[i].allocs.load(std::memory_order_relaxed));
+        const double b = static_cast<double>(per_request[i].bytes.load(std::memory_order_relaxed));
+        os << prefix << "alloc request=" << request_type_name(static_cast<RequestType>(i))
+           << " count=" << n
+           << " allocs/req=" << a / static_cast<double>(n)
+           << " bytes/req=" << b / static_cast<double>(n) << "\n";
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
+
+#else
+
+void alloc_stats_report(std::ostream& os, const char* prefix) {
+    os << prefix << "alloc accounting not built in (configure with -DUPS_ALLOC_STATS=ON)\n";
+}
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Protocol.hpp"
+
+#include <cstdint>
+#include <ostream>
+
+// Heap allocation accounting, compiled in with -DUPS_ALLOC_STATS=ON. The global
+// operator new is replaced to count calls and bytes; AllocScope attributes them to
+// the innermost active subsystem and, when known, to the request being served.
+// A scope without a request type inherits its enclosing scope's. Without the option
+// every scope compiles away.
+enum class AllocSubsystem {
+    Transport,   // reactor, fd/session maps, cross-thread hand-off
+    Framing,     // splitting the byte stream into lines
+    Parse,       // parse_request_line
+    Session,     // handle_request, including building responses
+    Output,      // send_line and the sink
+    Heartbeat,
+    Timers,      // reconnect deadlines
+    Count
+};
+
+#ifdef UPS_ALLOC_STATS
+
+class AllocScope {
+public:
+    explicit AllocScope(AllocSubsystem subsystem, RequestType type = RequestType::INVALID);
+    ~AllocScope();
+
+    AllocScope(const AllocScope&) = delete;
+    AllocScope& operator=(const AllocScope&) = delete;
+
+    // Attributes this scope (from its start) to a request type learned late, e.g. after parsing.
+    void set_request(RequestType t) { type = t; }
+
+private:
+    AllocSubsystem subsystem;
+    RequestType type;
+    AllocScope* outer;
+    uint64_t start_allocs;
+    uint64_t start_bytes;
+
+    void flush();
+    void restart();
+};
+
+inline constexpr bool alloc_stats_enabled() { return true; }
+void alloc_stats_count_request(RequestType type);
+
+#else
+
+class AllocScope {
+public:
+    explicit AllocScope(AllocSubsystem, RequestType = RequestType::INVALID) {}
+    void set_request(RequestType) {}
+};
+
+inline constexpr bool alloc_stats_enabled() { return false; }
+inline void alloc_stats_count_request(RequestType) {}
+
+#endif
+
+// Writes one line per subsystem and per request type seen, each starting with prefix.
+void alloc_stats_report(std::ostream& os, const char* prefix);
@@ -0,0 +1,261 @@
+#include "Bench.hpp"
+#include "AllocStats.hpp"
+#include "Clock.hpp"
+#include "Matchmaking.hpp"
+#include "ProcStats.hpp"
+#include "SessionEngine.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+    class CountingSink : public SessionSink {
+    public:
+        size_t messages{0};
+        size_t bytes{0};
+        size_t closed{0};
+
+        void deliver(SessionId, const std::string& data) override {
+            messages++;
+            bytes += data.size();
+        }
+        void close(SessionId) override { closed++; }
+    };
+
+    std::string request(const std::string& payload) {
+        return std::string(PROTOCOL_MAGIC) + "|" + payload + "|\n";
+    }
+}
+
+namespace {
+    // Runs first, on a fresh engine, so memory freed by other phases cannot hide the cost.
+    void measure_idle_memory(size_t count) {
+        CountingSink sink;
+        HeartbeatOptions heartbeat;
+        heartbeat.enabled = false;
+        SessionEngine engine(sink, heartbeat);
+
+        const size_t rss_before = resident_set_bytes();
+        for (size_t i = 0; i < count; i++) {
+            const SessionId sid = i + 1;
+            engine.open_session(sid);
+            const std::string login = request("REQ_LOGIN|idle" + std::to_string(i));
+            engine.on_data(sid, login.data(), login.size());
+        }
+        const size_t rss_after = resident_set_bytes();
+
+        const size_t grown = rss_after > rss_before ? rss_after - rss_before : 0;
+        std::cout << "[BENCH] idle: " << count << " logged-in sessions, "
+                  << grown / count << " resident bytes per session ("
+                  << engine.pending_line_buffers() << " line buffers held)\n";
+    }
+}
+
+namespace {
+    // Remembers the last PING each session got so the soak can answer it.
+    class PingSink : public SessionSink {
+    public:
+        std::unordered_map<SessionId, std::string> pings;   // sid -> nonce
+        size_t pings_sent{0};
+        size_t closed{0};
+
+        void deliver(SessionId sid, const std::string& data) override {
+            static const std::string ping = std::string(PROTOCOL_MAGIC) + "|RES_PING|";
+            if (data.compare(0, ping.size(), ping) != 0) return;
+            pings[sid] = data.substr(ping.size(), data.find('|', ping.size()) - ping.size());
+            pings_sent++;
+        }
+        void close(SessionId) override { closed++; }
+    };
+
+    // An hour of ping-mode heartbeats on a ManualClock, ticking every poll interval. Sessions
+    // play in pairs; every fourth one falls silent at a point spread over the hour, so its
+    // heartbeat times out, its opponent is told, and the reconnect grace runs out.
+    void run_heartbeat_soak(size_t count) {
+        using namespace std::chrono;
+
+        ManualClock clock;
+        PingSink sink;
+        SessionEngine engine(sink);
+        engine.set_clock(&clock);
+
+        const RuntimeConfig config;
+        const auto step = milliseconds(config.poll_timeout_ms);
+        const auto span = hours(1);
+
+        const size_t pairs = count / 2;
+        std::vector<Clock::time_point> silent_at(2 * pairs, Clock::time_point::max());
+        const size_t silent = (2 * pairs) / 4;
+        for (size_t i = 0; i < silent; i++) {
+            silent_at[i * 4] = clock.now() + span * static_cast<int64_t>(i) / static_cast<int64_t>(silent);
+        }
+
+        for (size_t i = 0; i < pairs; i++) {
+            const SessionId a = 2 * i + 1;
+            const SessionId b = 2 * i + 2;
+            engine.open_session(a);
+            engine.open_session(b);
+            const std::string login_a = request("REQ_LOGIN|soak_a" + std::to_string(i));
+            const std::string login_b = request("REQ_LOGIN|soak_b" + std::to_string(i));
+            const std::string create = request("REQ_CREATE_LOBBY|soak" + std::to_string(i));
+            const std::string join = request("REQ_JOIN_LOBBY|soak" + std::to_string(i));
+            engine.on_data(a, login_a.data(), login_a.size());
+            engine.on_data(b, login_b.data(), login_b.size());
+            engine.on_data(a, create.data(), create.size());
+            engine.on_data(b, join.data(), join.size());
+        }
+
+        size_t ticks = 0;
+        size_t pongs = 0;
+        const auto end = clock.now() + span;
+        const auto wall_start = steady_clock::now();
+        while (clock.now() < end) {
+            clock.advance(step);
+            engine.tick();
+            ticks++;
+
+            for (const auto& kv : sink.pings) {
+                if (clock.now() >= silent_at[kv.first - 1]) continue;
+                const std::string pong = request("REQ_PONG|" + kv.second);
+                engine.on_data(kv.first, pong.data(), pong.size());
+                pongs++;
+            }
+            sink.pings.clear();
+        }
+        const double wall_s = duration<double>(steady_clock::now() - wall_start).count();
+
+        std::cout << "[BENCH] soak: " << 2 * pairs << " sessions, " << duration_cast<seconds>(span).count()
+                  << "s virtual in " << wall_s * 1000.0 << " ms wall (" << ticks << " ticks, "
+                  << (ticks ? wall_s * 1e6 / static_cast<double>(ticks) : 0.0) << " us/tick)\n"
+                  << "[BENCH] soak: " << sink.pings_sent << " pings, " << pongs << " pongs, "
+                  << sink.closed << " sessions closed, " << engine.session_count() << " left\n";
+    }
+}
+
+namespace {
+    // Players with normally distributed ratings (1200 +- 300) join the matchmaking queue at
+    // a steady rate over a virtual minute, with a poll every server loop interval. Reports
+    // the queue's cost and the waits and rating gaps it produced, to tune its bands against.
+    void run_queue_bench(size_t count) {
+        using namespace std::chrono;
+
+        ManualClock clock;
+        Matchmaker matchmaker;
+        std::mt19937 rng(42);
+        std::normal_distribution<double> rating_dist(RatingTable::INITIAL_RATING, 300.0);
+
+        const RuntimeConfig config;
+        const auto step = milliseconds(config.poll_timeout_ms);
+        const auto span = minutes(1);
+        const auto arrivals_per_step = std::max<size_t>(1, count * static_cast<size_t>(step.count()) /
+                                                               static_cast<size_t>(milliseconds(span).count()));
+
+        std::vector<Pairing> pairings;
+        size_t joined = 0;
+        size_t pairs = 0;
+        size_t deepest = 0;
+        nanoseconds enqueue_time{0};
+        nanoseconds poll_time{0};
+        size_t polls = 0;
+
+        while (joined < count || matchmaker.size() >= 2) {
+            for (size_t i = 0; i < arrivals_per_step && joined < count; i++) {
+                const int rating = static_cast<int>(rating_dist(rng));
+                const auto start = steady_clock::now();
+                matchmaker.enqueue(static_cast<int>(++joined), rating, clock.now(), pairings);
+                enqueue_time += steady_clock::now() - start;
+            }
+            deepest = std::max(deepest, matchmaker.size());
+
+            clock.advance(step);
+            const auto start = steady_clock::now();
+            matchmaker.poll(clock.now(), pairings);
+            poll_time += steady_clock::now() - start;
+            polls++;
+
+            pairs += pairings.size();
+            pairings.clear();
+        }
+
+        std::cout << "[BENCH] queue: " << count << " players, " << pairs << " pairings, "
+                  << matchmaker.size() << " left, deepest queue " << deepest << "\n"
+                  << "[BENCH] queue: " << static_cast<double>(enqueue_time.count()) / static_cast<double>(count)
+                  << " ns/enqueue, " << static_cast<double>(poll_time.count()) / static_cast<double>(polls)
+                  << " ns/poll over " << polls << " polls\n";
+        Matchmaker::stats().report(std::cout, "[BENCH] ");
+    }
+}
+
+int run_engine_benchmark(const BenchOptions& opts) {
+    using namespace std::chrono;
+
+    measure_idle_memory(opts.idle);
+    if (opts.soak > 0) run_heartbeat_soak(opts.soak);
+    if (opts.queue > 0) run_queue_bench(opts.queue);
+
+    CountingSink sink;
+    HeartbeatOptions heartbeat;
+    heartbeat.enabled = false;
+    SessionEngine engine(sink, heartbeat);
+
+    const std::string move_a = request("REQ_MOVE|R");
+    const std::string move_b = request("REQ_MOVE|S");
+    const std::string state = request("REQ_STATE");
+    const std::string rematch = request("REQ_REMATCH");
+
+    size_t requests = 0;
+    auto feed = [&](SessionId sid, const std::string& data) {
+        engine.on_data(sid, data.data(), data.size());
+        requests++;
+    };
+
+    const auto setup_start = steady_clock::now();
+    for (size_t i = 0; i < opts.pairs; i++) {
+        const SessionId a = 2 * i + 1;
+        const SessionId b = 2 * i + 2;
+        engine.open_session(a);
+        engine.open_session(b);
+        feed(a, request("REQ_LOGIN|a" + std::to_string(i)));
+        feed(b, request("REQ_LOGIN|b" + std::to_string(i)));
+        feed(a, request("REQ_CREATE_LOBBY|bench" + std::to_string(i)));
+        feed(b, request("REQ_JOIN_LOBBY|bench" + std::to_string(i)));
+    }
+    const auto setup_end = steady_clock::now();
+
+    const size_t setup_requests = requests;
+    const size_t setup_messages = sink.messages;
+
+    for (size_t m = 0; m < opts.matches; m++) {
+        for (int round = 0; round < 3; round++) {
+            for (size_t i = 0; i < opts.pairs; i++) {
+                feed(2 * i + 1, move_a);
+                feed(2 * i + 2, move_b);
+                feed(2 * i + 1, state);
+            }
+        }
+        for (size_t i = 0; i < opts.pairs; i++) {
+            feed(2 * i + 1, rematch);
+            feed(2 * i + 2, rematch);
+        }
+    }
+    const auto end = steady_clock::now();
+
+    const double setup_s = duration<double>(setup_end - setup_start).count();
+    const double run_s = duration<double>(end - setup_end).count();
+    const size_t run_requests = requests - setup_requests;
+
+    std::cout << "[BENCH] sessions=" << engine.session_count()
+              << " pairs=" << opts.pairs << " matches=" << opts.matches << "\n"
+              << "[BENCH] setup: " << setup_requests << " requests in " << setup_s * 1000.0 << " ms\n"
+              << "[BENCH] play:  " << run_requests << " requests in " << run_s * 1000.0 << " ms ("
+              << (run_s > 0 ? static_cast<double>(run_requests) / run_s : 0.0) << " req/s, "
+              << (run_requests ? run_s * 1e9 / static_cast<double>(run_requests) : 0.0) << " ns/req)\n"
+              << "[BENCH] responses: " << (sink.messages - setup_messages) << " messages, "
+              << sink.bytes << " bytes total\n";
+    if (alloc_stats_enabled()) alloc_stats_report(std::cout, "[BENCH] ");
+    return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+struct BenchOptions {
+    size_t pairs{100};
+    size_t matches{100};
+    size_t idle{10000};   // logged-in, lobby-less sessions used to measure memory per idle session
+    size_t soak{0};       // sessions in the virtual-time heartbeat soak (0 = skip)
+    size_t queue{0};      // players through the matchmaking queue (0 = skip)
+};
+
+// Drives SessionEngine in-process (no sockets) and reports request throughput.
+int run_engine_benchmark(const BenchOptions& opts);
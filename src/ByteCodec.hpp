@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+// Native-endian binary fields for files and handoffs read back by the same build.
+
+template <typename T>
+inline void put(std::string& out, T value) {
+    static_assert(std::is_trivially_copyable<T>::value, "raw field");
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Short strings (names, tokens) carry a 16-bit length; blobs a 32-bit one.
+inline void put_string(std::string& out, const std::string& s) {
+    const uint16_t len = static_cast<uint16_t>(std::min<size_t>(s.size(), UINT16_MAX));
+    put(out, len);
+    out.append(s.data(), len);
+}
+
+inline void put_blob(std::string& out, const std::string& s) {
+    put(out, static_cast<uint32_t>(s.size()));
+    out += s;
+}
+
+// Bounds-checked cursor over a byte range; any overrun clears ok and yields empty values.
+struct ByteReader {
+    const char* p;
+    const char* end;
+    bool ok{true};
+
+    template <typename T>
+    T get() {
+        T value{};
+        if (static_cast<size_t>(end - p) < sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+
+    std::string get_string() { return take(get<uint16_t>()); }
+    std::string get_blob() { return take(get<uint32_t>()); }
+
+    std::string take(size_t len) {
+        if (!ok || static_cast<size_t>(end - p) < len) {
+            ok = false;
+            return {};
+        }
+        std::string s(p, len);
+        p += len;
+        return s;
+    }
+};
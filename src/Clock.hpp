@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+
+// Time source for the engine's timers: heartbeats, reconnect grace, liveness buckets and
+// snapshot cadence. A server runs on the steady clock; benchmarks, soak tests and replays
+// drive a ManualClock, so an hour of timeouts runs in seconds and always fires in the same
+// order. Wall-clock timestamps (history, snapshots on disk) are not affected.
+class Clock {
+public:
+    using time_point = std::chrono::steady_clock::time_point;
+
+    virtual ~Clock() = default;
+    virtual time_point now() const = 0;
+};
+
+class SteadyClock : public Clock {
+public:
+    time_point now() const override { return std::chrono::steady_clock::now(); }
+
+    static const SteadyClock& instance() {
+        static const SteadyClock clock;
+        return clock;
+    }
+};
+
+// Only moves when told to. Starts at an arbitrary fixed point so runs are reproducible.
+class ManualClock : public Clock {
+public:
+    time_point now() const override { return current; }
+
+    void advance(std::chrono::steady_clock::duration by) { current += by; }
+
+private:
+    time_point current{std::chrono::hours(1)};
+};
@@ -0,0 +1,152 @@
+#include "Cluster.hpp"
+#include "Tournament.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+
+namespace {
+    // Points per node; enough that each node's share of the ring stays within a few percent.
+    constexpr int VIRTUAL_NODES = 128;
+
+    // FNV-1a, then a splitmix64 finalizer so near-identical keys spread over the whole ring.
+    // Fixed here rather than std::hash so every build places keys the same way.
+    uint64_t ring_hash(const std::string& key) {
+        uint64_t h = 1469598103934665603ull;
+        for (unsigned char c : key) {
+            h ^= c;
+            h *= 1099511628211ull;
+        }
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        return h;
+    }
+
+    bool parse_node(const std::string& s, ClusterNode& out, std::string& error) {
+        const size_t colon = s.rfind(':');
+        if (colon == std::string::npos || colon == 0) {
+            error = "expected host:port, got '" + s + "'";
+            return false;
+        }
+        out.host = s.substr(0, colon);
+
+        in_addr addr{};
+        if (inet_pton(AF_INET, out.host.c_str(), &addr) <= 0) {
+            error = "not an IPv4 address: " + out.host;
+            return false;
+        }
+
+        const char* begin = s.data() + colon + 1;
+        const char* end = s.data() + s.size();
+        const auto res = std::from_chars(begin, end, out.port);
+        if (res.ec != std::errc() || res.ptr != end || out.port < 1 || out.port > 65535) {
+            error = "bad port in '" + s + "'";
+            return false;
+        }
+        return true;
+    }
+}
+
+bool ClusterMap::parse(const std::string& list, const std::string& self, ClusterMap& out, std::string& error) {
+    out = ClusterMap{};
+
+    size_t at = 0;
+    while (at <= list.size()) {
+        size_t comma = list.find(',', at);
+        if (comma == std::string::npos) comma = list.size();
+        ClusterNode node;
+        if (!parse_node(list.substr(at, comma - at), node, error)) return false;
+        for (const auto& n : out.nodes) {
+            if (n.address() == node.address()) {
+                error = "node listed twice: " + node.address();
+                return false;
+            }
+        }
+        out.nodes.push_back(node);
+        at = comma + 1;
+    }
+
+    ClusterNode me;
+    if (!parse_node(self, me, error)) return false;
+    auto it = std::find_if(out.nodes.begin(), out.nodes.end(),
+                           [&](const ClusterNode& n) { return n.address() == me.address(); });
+    if (it == out.nodes.end()) {
+        error = me.address() + " is not in the node list";
+        return false;
+    }
+    out.self_index = static_cast<int>(it - out.nodes.begin());
+
+    // Points derive from the address alone, so every process builds the same ring.
+    for (size_t i = 0; i < out.nodes.size(); i++) {
+        for (int v = 0; v < VIRTUAL_NODES; v++) {
+            out.ring.emplace_back(ring_hash(out.nodes[i].address() + "#" + std::to_string(v)), static_cast<int>(i));
+        }
+    }
+    std::sort(out.ring.begin(), out.ring.end());
+    return true;
+}
+
+int ClusterMap::owner_of(const std::string& key) const {
+    if (ring.empty()) return self_index;
+    auto it = std::lower_bound(ring.begin(), ring.end(), std::make_pair(ring_hash(key), 0));
+    if (it == ring.end()) it = ring.begin();
+    return it->second;
+}
+
+// Compares every byte so the time taken does not reveal how much of a guess was right.
+bool ClusterMap::admits(const std::string& offered) const {
+    if (secret.empty() || offered.size() != secret.size()) return false;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < secret.size(); i++) {
+        diff |= static_cast<unsigned char>(offered[i] ^ secret[i]);
+    }
+    return diff == 0;
+}
+
+int ClusterMap::owner_of_lobby(const std::string& lobbyName) const {
+    return owner_of("lobby:" + TournamentManager::tournamentOfLobbyName(lobbyName));
+}
+
+int ClusterMap::home_of_user(const std::string& username) const {
+    return owner_of("user:" + username);
+}
+
+int connect_node(const ClusterNode& node, std::chrono::milliseconds timeout) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(node.port));
+    if (inet_pton(AF_INET, node.host.c_str(), &addr.sin_addr) <= 0) return -1;
+
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+
+    // Non-blocking only while connecting, so an unreachable node cannot stall the loop;
+    // afterwards the socket behaves like an accepted one.
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        if (errno != EINPROGRESS) {
+            ::close(fd);
+            return -1;
+        }
+        pollfd p{fd, POLLOUT, 0};
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (::poll(&p, 1, static_cast<int>(timeout.count())) != 1 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            ::close(fd);
+            return -1;
+        }
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    return fd;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct ClusterNode {
+    std::string host;   // IPv4 address clients and peers connect to
+    int port{0};
+
+    std::string address() const { return host + ":" + std::to_string(port); }
+};
+
+// Static cluster membership. Every process is started with the same node list and places
+// lobby names and usernames on one consistent-hash ring, so all nodes agree on owners
+// without exchanging anything, and a membership change moves only about 1/n of the keys.
+class ClusterMap {
+public:
+    // list: "host:port,host:port,..."; self must be one of its entries.
+    static bool parse(const std::string& list, const std::string& self, ClusterMap& out, std::string& error);
+
+    size_t size() const { return nodes.size(); }
+    int self() const { return self_index; }
+    const ClusterNode& node(int index) const { return nodes[static_cast<size_t>(index)]; }
+
+    // Node hosting a lobby; bracket lobbies ("<tournament>#r1m1") go with their tournament.
+    int owner_of_lobby(const std::string& lobbyName) const;
+
+    // Node keeping the cluster-wide claim on a username.
+    int home_of_user(const std::string& username) const;
+
+    // Peers prove membership with this in PEER_HELLO; they arrive on the public client port.
+    void set_secret(const std::string& value) { secret = value; }
+    const std::string& shared_secret() const { return secret; }
+    bool admits(const std::string& offered) const;
+
+private:
+    std::vector<ClusterNode> nodes;
+    int self_index{0};
+    std::string secret;
+    std::vector<std::pair<uint64_t, int>> ring;   // (point, node), sorted by point
+
+    int owner_of(const std::string& key) const;
+};
+
+// Connects to a node, giving up after timeout. Returns the connected socket or -1.
+int connect_node(const ClusterNode& node, std::chrono::milliseconds timeout);
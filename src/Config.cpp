@@ -0,0 +1,99 @@
+#include "Config.hpp"
+
+#include <charconv>
+#include <fstream>
+
+namespace {
+    std::string trim(const std::string& s) {
+        const size_t begin = s.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) return {};
+        const size_t end = s.find_last_not_of(" \t\r");
+        return s.substr(begin, end - begin + 1);
+    }
+
+    bool parse_positive(const std::string& s, long long& out) {
+        const auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+        return res.ec == std::errc() && res.ptr == s.data() + s.size() && out > 0;
+    }
+
+    bool apply(RuntimeConfig& c, const std::string& key, const std::string& value, std::string& error) {
+        if (key == "default_rules") {
+            const RuleSet* rules = find_ruleset(value);
+            if (!rules) {
+                error = "unknown rules '" + value + "'";
+                return false;
+            }
+            c.default_rules = rules;
+            return true;
+        }
+
+        long long v = 0;
+        if (!parse_positive(value, v)) {
+            error = key + " must be a positive number";
+            return false;
+        }
+        if (key == "ping_interval_ms") c.ping_interval = std::chrono::milliseconds(v);
+        else if (key == "pong_timeout_ms") c.pong_timeout = std::chrono::milliseconds(v);
+        else if (key == "reconnect_grace_s") c.reconnect_grace = std::chrono::seconds(v);
+        else if (key == "move_deadline_s") c.move_deadline = std::chrono::seconds(v);
+        else if (key == "forfeit_after") c.forfeit_after = static_cast<int>(v);
+        else if (key == "poll_timeout_ms") c.poll_timeout_ms = static_cast<int>(v);
+        else if (key == "listen_backlog") c.listen_backlog = static_cast<int>(v);
+        else if (key == "recv_buffer_bytes") c.recv_buffer_bytes = static_cast<size_t>(v);
+        else {
+            error = "unknown key '" + key + "'";
+            return false;
+        }
+        return true;
+    }
+}
+
+bool load_config(const std::string& path, const RuntimeConfig& base, RuntimeConfig& out, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    RuntimeConfig c = base;
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++) {
+        const size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        line = trim(line);
+        if (line.empty()) continue;
+
+        const size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            error = "line " + std::to_string(number) + ": expected key = value";
+            return false;
+        }
+        if (!apply(c, trim(line.substr(0, eq)), trim(line.substr(eq + 1)), error)) {
+            error = "line " + std::to_string(number) + ": " + error;
+            return false;
+        }
+    }
+
+    if (c.pong_timeout <= c.ping_interval) {
+        error = "pong_timeout_ms must exceed ping_interval_ms";
+        return false;
+    }
+    if (c.poll_timeout_ms > 60000 || c.recv_buffer_bytes > 16 * 1024 * 1024 || c.forfeit_after > 255) {
+        error = "poll_timeout_ms, recv_buffer_bytes or forfeit_after out of range";
+        return false;
+    }
+    out = c;
+    return true;
+}
+
+void report_config(std::ostream& os, const RuntimeConfig& c) {
+    os << "ping_interval_ms=" << c.ping_interval.count()
+       << " pong_timeout_ms=" << c.pong_timeout.count()
+       << " reconnect_grace_s=" << c.reconnect_grace.count()
+       << " move_deadline_s=" << c.move_deadline.count()
+       << " forfeit_after=" << c.forfeit_after
+       << " poll_timeout_ms=" << c.poll_timeout_ms
+       << " listen_backlog=" << c.listen_backlog
+       << " recv_buffer_bytes=" << c.recv_buffer_bytes
+       << " default_rules=" << c.default_rules->name;
+}
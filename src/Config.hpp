@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Rules.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+// Tunables that may change while the server runs. Loaded from a config file at start and
+// again on SIGHUP; every engine and the transport take a whole RuntimeConfig at once, so
+// a reload never leaves a mix of old and new values.
+struct RuntimeConfig {
+    std::chrono::milliseconds ping_interval{2000};   // PING cadence in ping liveness mode
+    std::chrono::milliseconds pong_timeout{5000};    // silence before a session is dropped
+    std::chrono::seconds reconnect_grace{15};        // how long a seat waits for its player
+    std::chrono::seconds move_deadline{0};           // per round, 0 = rounds never time out
+    int forfeit_after{3};                            // missed deadlines in a row that lose the match
+    int poll_timeout_ms{500};                        // longest reactor wait between ticks
+    int listen_backlog{16};
+    size_t recv_buffer_bytes{4096};                  // per read (epoll backend)
+    const RuleSet* default_rules{&DEFAULT_RULES};    // CREATE_LOBBY without a rules name
+};
+
+// Reads "key = value" lines ('#' starts a comment) over the values in base. Any unknown key
+// or bad value fails the whole file, leaving out untouched.
+bool load_config(const std::string& path, const RuntimeConfig& base, RuntimeConfig& out, std::string& error);
+
+// One line with every effective value, in config-file key names.
+void report_config(std::ostream& os, const RuntimeConfig& config);
@@ -1,12 +1,29 @@
 #include "Game.hpp"
 #include "GameTypes.hpp"
+#include "Probes.hpp"
+
+void Game::setIdSpace(int first, int stride) {
+    nextUserId = first;
+    nextLobbyId = first;
+    nextVersion = static_cast<uint64_t>(first);
+    idStride = stride;
+}
 
 int Game::addPlayer(const std::string& username) {
-    int id = nextUserId++;
+    int id = nextUserId;
+    nextUserId += idStride;
     players[id] = Player{id, username};
     return id;
 }
 
+void Game::adoptPlayer(const Player& player) {
+    players[player.userId] = player;
+}
+
+bool Game::hasPlayer(int userId) const {
+    return players.find(userId) != players.end();
+}
+
 void Game::removePlayer(int userId) {
     auto lobbyOpt = getLobbyOf(userId);
     if (lobbyOpt.has_value()) {
@@ -15,15 +32,21 @@ void Game::removePlayer(int userId) {
     players.erase(userId);
 }
 
-std::optional<int> Game::createLobby(int userId, const std::string& lobbyName) {
+std::optional<int> Game::createLobby(int userId, const std::string& lobbyName, const RuleSet& rules) {
     auto lobbyOpt = getLobbyOf(userId);
     if (lobbyOpt.has_value()) return std::nullopt;
 
-    Lobby lobby;
-    lobby.lobbyId = nextLobbyId++;
+    const int lobbyId = nextLobbyId;
+    nextLobbyId += idStride;
+    Lobby& lobby = lobbies[lobbyId];
+    lobby.lobbyId = lobbyId;
     lobby.name = lobbyName;
+    lobby.rules = &rules;
     lobby.players.push_back(players.at(userId));
-    lobbies[lobby.lobbyId] = lobby;
+    playerLobby[userId] = lobby.lobbyId;
+    lobbyByName[lobbyName] = lobby.lobbyId;
+    touchLobby(lobby);
+    UPS_PROBE(lobby__create, lobbyId, lobby.name.c_str());
     return lobby.lobbyId;
 }
 
@@ -31,50 +54,63 @@ bool Game::joinLobby(int userId, const std::string& lobbyName) {
     auto lobbyOpt = getLobbyOf(userId);
     if (lobbyOpt.has_value()) return false;
 
-    for (auto& kv : lobbies) {
-        Lobby& lobby = kv.second;
-        if (lobby.name == lobbyName) {
-            if (lobby.players.size() >= 2) return false;
-            lobby.players.push_back(players.at(userId));
-            return true;
-        }
-    }
-    return false;
+    auto found = findLobby(lobbyName);
+    if (!found.has_value()) return false;
+    Lobby& lobby = *found.value();
+    if (lobby.players.size() >= 2) return false;
+    lobby.players.push_back(players.at(userId));
+    playerLobby[userId] = lobby.lobbyId;
+    touchLobby(lobby);
+    return true;
 }
 
 void Game::leaveLobby(int userId) {
-    for (auto it = lobbies.begin(); it != lobbies.end(); ++it) {
-        Lobby& lobby = it->second;
-        for (size_t i = 0; i < lobby.players.size(); i++) {
-            if (lobby.players[i].userId == userId) {
-                lobby.players.erase(lobby.players.begin() + static_cast<long>(i));
-                if (lobby.players.empty()) {
-                    lobbies.erase(it);
-                } else {
-                    lobby.inGame = false;
-                    lobby.matchJustEnded = false;
-                    lobby.p1Move = MoveType::NONE;
-                    lobby.p2Move = MoveType::NONE;
-                    lobby.p1Wins = 0;
-                    lobby.p2Wins = 0;
-                    lobby.roundsPlayed = 0;
-                    lobby.p1Rematch = false;
-                    lobby.p2Rematch = false;
-                }
-                return;
+    auto where = playerLobby.find(userId);
+    if (where == playerLobby.end()) return;
+    auto it = lobbies.find(where->second);
+    playerLobby.erase(where);
+    if (it == lobbies.end()) return;
+
+    Lobby& lobby = it->second;
+    touchLobby(lobby);
+    for (size_t i = 0; i < lobby.players.size(); i++) {
+        if (lobby.players[i].userId == userId) {
+            lobby.players.erase(lobby.players.begin() + static_cast<long>(i));
+            if (lobby.players.empty()) {
+                auto named = lobbyByName.find(lobby.name);
+                if (named != lobbyByName.end() && named->second == lobby.lobbyId) lobbyByName.erase(named);
+                UPS_PROBE(lobby__destroy, lobby.lobbyId);
+                lobbies.erase(it);
+            } else {
+                lobby.inGame = false;
+                lobby.matchJustEnded = false;
+                lobby.p1Move = MoveType::NONE;
+                lobby.p2Move = MoveType::NONE;
+                lobby.p1Wins = 0;
+                lobby.p2Wins = 0;
+                lobby.roundsPlayed = 0;
+                lobby.p1Rematch = false;
+                lobby.p2Rematch = false;
             }
+            return;
         }
     }
 }
 
 std::optional<Lobby*> Game::getLobbyOf(int userId) {
-    for (auto& kv : lobbies) {
-        Lobby& lobby = kv.second;
-        for (auto& p : lobby.players) {
-            if (p.userId == userId) return &lobby;
-        }
-    }
-    return std::nullopt;
+    auto where = playerLobby.find(userId);
+    if (where == playerLobby.end()) return std::nullopt;
+    auto it = lobbies.find(where->second);
+    if (it == lobbies.end()) return std::nullopt;
+    return &it->second;
+}
+
+std::optional<Lobby*> Game::findLobby(const std::string& lobbyName) {
+    auto named = lobbyByName.find(lobbyName);
+    if (named == lobbyByName.end()) return std::nullopt;
+    auto it = lobbies.find(named->second);
+    if (it == lobbies.end()) return std::nullopt;
+    return &it->second;
 }
 
 bool Game::canStartGame(Lobby* lobby) const {
@@ -83,6 +119,7 @@ bool Game::canStartGame(Lobby* lobby) const {
 
 void Game::startGame(Lobby* lobby) {
     if (!lobby) return;
+    touchLobby(*lobby);
     lobby->inGame = true;
     lobby->matchJustEnded = false;
     lobby->p1Move = MoveType::NONE;
@@ -94,17 +131,9 @@ void Game::startGame(Lobby* lobby) {
     lobby->p2Rematch = false;
 }
 
-int Game::evaluate_round(MoveType p1, MoveType p2) const {
-    if (p1 == p2) return 0;
-    if (p1 == MoveType::ROCK && p2 == MoveType::SCISSORS) return 1;
-    if (p1 == MoveType::PAPER && p2 == MoveType::ROCK) return 1;
-    if (p1 == MoveType::SCISSORS && p2 == MoveType::PAPER) return 1;
-    return 2;
-}
-
 bool Game::checkMatchEnd(Lobby* lobby, int& outWinnerUserId) const {
     if (!lobby) return false;
-    if (lobby->roundsPlayed == 3) {
+    if (lobby->rules->matchOver(lobby->roundsPlayed, lobby->p1Wins, lobby->p2Wins)) {
         if (lobby->p1Wins > lobby->p2Wins) outWinnerUserId = lobby->players[0].userId;
         else if (lobby->p2Wins > lobby->p1Wins) outWinnerUserId = lobby->players[1].userId;
         else outWinnerUserId = 0;
@@ -133,6 +162,7 @@ bool Game::submitMove(int userId, MoveType move,
     Lobby* lobby = lobbyOpt.value();
     if (!lobby || !lobby->inGame) return false;
     if (lobby->players.size() != 2) return false;
+    if (!lobby->rules->allows(move)) return false;
 
     const int p1Id = lobby->players[0].userId;
     const int p2Id = lobby->players[1].userId;
@@ -146,42 +176,97 @@ bool Game::submitMove(int userId, MoveType move,
     } else {
         return false;
     }
+    // Only a stored move changes the lobby; a refused one must not cost subscribers a delta.
+    touchLobby(*lobby);
 
     if (lobby->p1Move != MoveType::NONE && lobby->p2Move != MoveType::NONE) {
-        int winner = evaluate_round(lobby->p1Move, lobby->p2Move);
-
-        if (winner == 1) lobby->p1Wins++;
-        else if (winner == 2) lobby->p2Wins++;
-
-        lobby->roundsPlayed++;
-
-        if (winner == 1) outRoundWinnerUserId = p1Id;
-        else if (winner == 2) outRoundWinnerUserId = p2Id;
-        else outRoundWinnerUserId = 0;
-
-        outP1Move = lobby->p1Move;
-        outP2Move = lobby->p2Move;
-
-        lobby->p1Move = MoveType::NONE;
-        lobby->p2Move = MoveType::NONE;
-
-        int matchWinner = 0;
-        if (checkMatchEnd(lobby, matchWinner)) {
-            outMatchEnded = true;
-            outMatchWinnerUserId = matchWinner;
-            outP1Wins = lobby->p1Wins;
-            outP2Wins = lobby->p2Wins;
-            lobby->inGame = false;
-            lobby->matchJustEnded = true;
-        } else {
-            outP1Wins = lobby->p1Wins;
-            outP2Wins = lobby->p2Wins;
-        }
+        resolveRound(lobby, lobby->rules->evaluate(lobby->p1Move, lobby->p2Move), outRoundWinnerUserId,
+                     outP1Move, outP2Move, outMatchEnded, outMatchWinnerUserId, outP1Wins, outP2Wins);
     }
 
     return true;
 }
 
+bool Game::forfeitRound(Lobby* lobby,
+                        int& outRoundWinnerUserId,
+                        MoveType& outP1Move,
+                        MoveType& outP2Move,
+                        bool& outMatchEnded,
+                        int& outMatchWinnerUserId,
+                        int& outP1Wins,
+                        int& outP2Wins) {
+    outRoundWinnerUserId = 0;
+    outMatchEnded = false;
+    outMatchWinnerUserId = 0;
+    if (!lobby || !lobby->inGame || lobby->players.size() != 2) return false;
+    touchLobby(*lobby);
+
+    int winner = 0;
+    if (lobby->p1Move != MoveType::NONE && lobby->p2Move == MoveType::NONE) winner = 1;
+    else if (lobby->p2Move != MoveType::NONE && lobby->p1Move == MoveType::NONE) winner = 2;
+    resolveRound(lobby, winner, outRoundWinnerUserId, outP1Move, outP2Move,
+                 outMatchEnded, outMatchWinnerUserId, outP1Wins, outP2Wins);
+    return true;
+}
+
+bool Game::forfeitMatch(Lobby* lobby, int loserUserId, int& outWinnerUserId) {
+    if (!lobby || !lobby->inGame || lobby->players.size() != 2) return false;
+    touchLobby(*lobby);
+
+    outWinnerUserId = 0;
+    for (const auto& p : lobby->players) {
+        if (p.userId != loserUserId) outWinnerUserId = p.userId;
+    }
+    UPS_PROBE(match__resolved, lobby->lobbyId, lobby->p1Wins, lobby->p2Wins);
+    lobby->p1Move = MoveType::NONE;
+    lobby->p2Move = MoveType::NONE;
+    lobby->inGame = false;
+    lobby->matchJustEnded = true;
+    return true;
+}
+
+void Game::resolveRound(Lobby* lobby, int winner,
+                        int& outRoundWinnerUserId,
+                        MoveType& outP1Move,
+                        MoveType& outP2Move,
+                        bool& outMatchEnded,
+                        int& outMatchWinnerUserId,
+                        int& outP1Wins,
+                        int& outP2Wins) {
+    const int p1Id = lobby->players[0].userId;
+    const int p2Id = lobby->players[1].userId;
+
+    if (winner == 1) lobby->p1Wins++;
+    else if (winner == 2) lobby->p2Wins++;
+
+    lobby->roundsPlayed++;
+    UPS_PROBE(round__resolved, lobby->lobbyId, lobby->roundsPlayed, winner);
+
+    if (winner == 1) outRoundWinnerUserId = p1Id;
+    else if (winner == 2) outRoundWinnerUserId = p2Id;
+    else outRoundWinnerUserId = 0;
+
+    outP1Move = lobby->p1Move;
+    outP2Move = lobby->p2Move;
+
+    lobby->p1Move = MoveType::NONE;
+    lobby->p2Move = MoveType::NONE;
+
+    int matchWinner = 0;
+    if (checkMatchEnd(lobby, matchWinner)) {
+        UPS_PROBE(match__resolved, lobby->lobbyId, lobby->p1Wins, lobby->p2Wins);
+        outMatchEnded = true;
+        outMatchWinnerUserId = matchWinner;
+        outP1Wins = lobby->p1Wins;
+        outP2Wins = lobby->p2Wins;
+        lobby->inGame = false;
+        lobby->matchJustEnded = true;
+    } else {
+        outP1Wins = lobby->p1Wins;
+        outP2Wins = lobby->p2Wins;
+    }
+}
+
 bool Game::requestRematch(int userId, Lobby* lobby) {
     if (!lobby) return false;
     if (lobby->players.size() != 2) return false;
@@ -191,10 +276,16 @@ bool Game::requestRematch(int userId, Lobby* lobby) {
     const int p1Id = lobby->players[0].userId;
     const int p2Id = lobby->players[1].userId;
 
-    if (userId == p1Id) lobby->p1Rematch = true;
-    else if (userId == p2Id) lobby->p2Rematch = true;
+    bool* flag = nullptr;
+    if (userId == p1Id) flag = &lobby->p1Rematch;
+    else if (userId == p2Id) flag = &lobby->p2Rematch;
     else return false;
 
+    if (!*flag) {
+        *flag = true;
+        touchLobby(*lobby);
+    }
+
     return true;
 }
 
@@ -208,3 +299,61 @@ bool Game::canStartRematch(Lobby* lobby) const {
 void Game::startRematch(Lobby* lobby) {
     startGame(lobby);
 }
+
+// Versions are drawn like ids, so no two lobbies on any engine ever share one and a
+// client that moved to another lobby cannot mistake it for the one it knew.
+void Game::touchLobby(Lobby& lobby) {
+    lobby.version = nextVersion;
+    nextVersion += static_cast<uint64_t>(idStride);
+    if (tracking) changedLobbies.insert(lobby.lobbyId);
+    if (trackingBumps) bumpedLobbies.insert(lobby.lobbyId);
+}
+
+void Game::trackBumps(bool enabled) {
+    trackingBumps = enabled;
+    if (!enabled) bumpedLobbies.clear();
+}
+
+std::vector<int> Game::takeChangedLobbies() {
+    std::vector<int> ids(changedLobbies.begin(), changedLobbies.end());
+    changedLobbies.clear();
+    return ids;
+}
+
+std::vector<int> Game::takeBumpedLobbies() {
+    std::vector<int> ids(bumpedLobbies.begin(), bumpedLobbies.end());
+    bumpedLobbies.clear();
+    return ids;
+}
+
+std::optional<Lobby*> Game::findLobbyById(int lobbyId) {
+    auto it = lobbies.find(lobbyId);
+    if (it == lobbies.end()) return std::nullopt;
+    return &it->second;
+}
+
+bool Game::restoreLobby(const Lobby& lobby) {
+    if (lobby.players.empty() || lobbies.count(lobby.lobbyId) || lobbyByName.count(lobby.name)) return false;
+    for (const auto& p : lobby.players) {
+        if (players.count(p.userId)) return false;
+    }
+
+    for (const auto& p : lobby.players) {
+        players[p.userId] = p;
+        playerLobby[p.userId] = lobby.lobbyId;
+    }
+    Lobby& restored = lobbies[lobby.lobbyId];
+    restored = lobby;
+    lobbyByName[lobby.name] = lobby.lobbyId;
+    // Clients may still hold versions from before the restart; never hand those out again.
+    const uint64_t stride = static_cast<uint64_t>(idStride);
+    if (nextVersion <= lobby.version) nextVersion += ((lobby.version - nextVersion) / stride + 1) * stride;
+    touchLobby(restored);
+    return true;
+}
+
+void Game::reserveIds(int maxUserId, int maxLobbyId) {
+    // Stay on this engine's stride so ids remain disjoint from other engines.
+    if (nextUserId <= maxUserId) nextUserId += ((maxUserId - nextUserId) / idStride + 1) * idStride;
+    if (nextLobbyId <= maxLobbyId) nextLobbyId += ((maxLobbyId - nextLobbyId) / idStride + 1) * idStride;
+}
@@ -1,8 +1,11 @@
 #pragma once
 
 #include "GameTypes.hpp"
+#include "Rules.hpp"
 
+#include <cstdint>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <optional>
 
@@ -15,6 +18,7 @@ struct Lobby {
     int lobbyId;
     std::string name;
     std::vector<Player> players; // size 0..2
+    const RuleSet* rules{&DEFAULT_RULES};
 
     bool inGame{false};
     bool matchJustEnded{false};
@@ -28,18 +32,27 @@ struct Lobby {
 
     bool p1Rematch{false};
     bool p2Rematch{false};
+
+    uint64_t version{0};   // fresh on every change and unique across lobbies, see Game::touchLobby
 };
 
 class Game {
 public:
+    void setIdSpace(int first, int stride);
+
     int addPlayer(const std::string& username);
+    void adoptPlayer(const Player& player);
     void removePlayer(int userId);
+    bool hasPlayer(int userId) const;
 
-    std::optional<int> createLobby(int userId, const std::string& lobbyName);
+    std::optional<int> createLobby(int userId, const std::string& lobbyName,
+                                   const RuleSet& rules = DEFAULT_RULES);
     bool joinLobby(int userId, const std::string& lobbyName);
     void leaveLobby(int userId);
 
     std::optional<Lobby*> getLobbyOf(int userId);
+    std::optional<Lobby*> findLobby(const std::string& lobbyName);
+    std::optional<Lobby*> findLobbyById(int lobbyId);
 
     bool canStartGame(Lobby* lobby) const;
     void startGame(Lobby* lobby);
@@ -53,17 +66,62 @@ public:
                     int& outP1Wins,
                     int& outP2Wins);
 
+    // A round whose move deadline passed: whoever moved wins it, nobody if neither did.
+    // Same outputs as submitMove; the missing move comes back as NONE.
+    bool forfeitRound(Lobby* lobby,
+                      int& outRoundWinnerUserId,
+                      MoveType& outP1Move,
+                      MoveType& outP2Move,
+                      bool& outMatchEnded,
+                      int& outMatchWinnerUserId,
+                      int& outP1Wins,
+                      int& outP2Wins);
+
+    // Ends a running match at the current score with the other player as winner.
+    bool forfeitMatch(Lobby* lobby, int loserUserId, int& outWinnerUserId);
+
     bool requestRematch(int userId, Lobby* lobby);
     bool canStartRematch(Lobby* lobby) const;
     void startRematch(Lobby* lobby);
 
+    // Every change gives the lobby a new version. Ids of lobbies modified (or removed) since the
+    // last take are also collected, separately for snapshots and for state pushes, while enabled.
+    void trackChanges(bool enabled) { tracking = enabled; }
+    void trackBumps(bool enabled);
+    void touchLobby(Lobby& lobby);
+    std::vector<int> takeChangedLobbies();
+    std::vector<int> takeBumpedLobbies();
+
+    // Reinstates a lobby and its players from a snapshot, keeping their ids.
+    bool restoreLobby(const Lobby& lobby);
+    // New ids will be greater than these.
+    void reserveIds(int maxUserId, int maxLobbyId);
+    int lastUserId() const { return nextUserId - idStride; }
+    int lastLobbyId() const { return nextLobbyId - idStride; }
+
 private:
     std::unordered_map<int, Player> players;
     std::unordered_map<int, Lobby> lobbies;
+    std::unordered_map<int, int> playerLobby;               // userId -> lobbyId
+    std::unordered_map<std::string, int> lobbyByName;       // name -> lobbyId
 
     int nextUserId{1};
     int nextLobbyId{1};
+    uint64_t nextVersion{1};                                // on the id stride, like the ids
+    int idStride{1};
+
+    bool tracking{false};
+    std::unordered_set<int> changedLobbies;
+    bool trackingBumps{false};
+    std::unordered_set<int> bumpedLobbies;
 
-    int evaluate_round(MoveType p1, MoveType p2) const;
     bool checkMatchEnd(Lobby* lobby, int& outWinnerUserId) const;
+    void resolveRound(Lobby* lobby, int winner,
+                      int& outRoundWinnerUserId,
+                      MoveType& outP1Move,
+                      MoveType& outP2Move,
+                      bool& outMatchEnded,
+                      int& outMatchWinnerUserId,
+                      int& outP1Wins,
+                      int& outP2Wins);
 };
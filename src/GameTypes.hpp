@@ -6,21 +6,25 @@ enum class MoveType {
     NONE,
     ROCK,
     PAPER,
-    SCISSORS
+    SCISSORS,
+    LIZARD,
+    SPOCK
 };
 
+// Wire names, indexed by MoveType.
+inline constexpr const char* MOVE_NAMES[] = {"", "R", "P", "S", "L", "K"};
+
 inline std::string move_to_string(MoveType m) {
-    switch (m) {
-        case MoveType::ROCK: return "R";
-        case MoveType::PAPER: return "P";
-        case MoveType::SCISSORS: return "S";
-        default: return "";
-    }
+    return MOVE_NAMES[static_cast<size_t>(m)];
 }
 
 inline bool string_to_move(const std::string& s, MoveType& out) {
-    if (s == "R") { out = MoveType::ROCK; return true; }
-    if (s == "P") { out = MoveType::PAPER; return true; }
-    if (s == "S") { out = MoveType::SCISSORS; return true; }
+    if (s.size() != 1) return false;
+    for (size_t i = 1; i <= static_cast<size_t>(MoveType::SPOCK); i++) {
+        if (s[0] == MOVE_NAMES[i][0]) {
+            out = static_cast<MoveType>(i);
+            return true;
+        }
+    }
     return false;
 }
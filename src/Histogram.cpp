@@ -0,0 +1,52 @@
+#include "Histogram.hpp"
+
+namespace {
+    size_t bucket_for(uint64_t us) {
+        size_t b = 0;
+        while (b + 1 < LatencyHistogram::BUCKETS && us >= (uint64_t{1} << b)) b++;
+        return b;
+    }
+}
+
+void LatencyHistogram::record(std::chrono::microseconds value) {
+    const uint64_t us = value.count() > 0 ? static_cast<uint64_t>(value.count()) : 0;
+    buckets[bucket_for(us)].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const {
+    uint64_t n = 0;
+    for (const auto& b : buckets) n += b.load(std::memory_order_relaxed);
+    return n;
+}
+
+uint64_t LatencyHistogram::quantile_upper_bound(double q) const {
+    std::array<uint64_t, BUCKETS> snapshot{};
+    uint64_t n = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        snapshot[i] = buckets[i].load(std::memory_order_relaxed);
+        n += snapshot[i];
+    }
+    if (n == 0) return 0;
+
+    const double target = q * static_cast<double>(n);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += snapshot[i];
+        if (static_cast<double>(seen) >= target) return uint64_t{1} << i;
+    }
+    return uint64_t{1} << (BUCKETS - 1);
+}
+
+void LatencyHistogram::report(std::ostream& os, const char* prefix, const char* name) const {
+    os << prefix << name << " samples=" << count()
+       << " p50_us<=" << quantile_upper_bound(0.50)
+       << " p90_us<=" << quantile_upper_bound(0.90)
+       << " p99_us<=" << quantile_upper_bound(0.99) << "\n";
+
+    os << prefix << name << "_hist";
+    for (size_t i = 0; i < BUCKETS; i++) {
+        const uint64_t n = buckets[i].load(std::memory_order_relaxed);
+        if (n > 0) os << " lt" << (uint64_t{1} << i) << "us=" << n;
+    }
+    os << "\n";
+}
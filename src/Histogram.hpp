@@ -0,0 +1,27 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Lock-free histogram of durations in power-of-two microsecond buckets.
+// record() may be called from any thread; report() reads a relaxed snapshot.
+class LatencyHistogram {
+public:
+    static constexpr size_t BUCKETS = 32;   // bucket i holds values below 2^i us
+
+    void record(std::chrono::microseconds value);
+
+    uint64_t count() const;
+
+    // Upper bound of the bucket holding the given quantile (0..1), in microseconds.
+    uint64_t quantile_upper_bound(double q) const;
+
+    // One summary line and one bucket line, each starting with prefix and name.
+    void report(std::ostream& os, const char* prefix, const char* name) const;
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+};
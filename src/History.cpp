@@ -0,0 +1,190 @@
+#include "History.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+    constexpr int WRITER_INTERVAL_MS = 100;
+    constexpr const char* SEGMENT_PREFIX = "history-";
+    constexpr const char* SEGMENT_SUFFIX = ".bin";
+
+    bool write_all(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+}
+
+void HistoryRecord::copy_name(char (&dst)[32], const std::string& name) {
+    std::memset(dst, 0, sizeof(dst));
+    std::memcpy(dst, name.data(), std::min(name.size(), sizeof(dst) - 1));
+}
+
+HistoryLog::HistoryLog(const std::string& dir) : dir(dir) {
+    if (::mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        perror("mkdir history");
+        std::exit(1);
+    }
+    scan_existing_segments();
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        perror("eventfd");
+        std::exit(1);
+    }
+    writer = std::thread([this] { run(); });
+
+    std::cerr << "[SYS] Match history in " << dir << " (segment " << current_segment.load() << ")\n";
+}
+
+HistoryLog::~HistoryLog() {
+    running.store(false, std::memory_order_release);
+    uint64_t one = 1;
+    if (::write(wake_fd, &one, sizeof(one)) < 0) perror("write");
+    if (writer.joinable()) writer.join();
+    if (segment_fd >= 0) ::close(segment_fd);
+    if (wake_fd >= 0) ::close(wake_fd);
+}
+
+void HistoryLog::append(const HistoryRecord& record) {
+    queue.push(record);
+}
+
+std::string HistoryLog::segment_path(uint32_t segment) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%s%06u%s", SEGMENT_PREFIX, segment, SEGMENT_SUFFIX);
+    return dir + "/" + name;
+}
+
+// Each run starts a fresh segment after the newest one already on disk.
+void HistoryLog::scan_existing_segments() {
+    DIR* d = ::opendir(dir.c_str());
+    if (!d) return;
+
+    uint32_t lowest = 0;
+    uint32_t highest = 0;
+    while (dirent* entry = ::readdir(d)) {
+        unsigned segment = 0;
+        char suffix[8] = {};
+        if (std::sscanf(entry->d_name, "history-%6u%7s", &segment, suffix) != 2) continue;
+        if (std::strcmp(suffix, SEGMENT_SUFFIX) != 0 || segment == 0) continue;
+        if (lowest == 0 || segment < lowest) lowest = segment;
+        highest = std::max<uint32_t>(highest, segment);
+    }
+    ::closedir(d);
+
+    if (highest > 0) {
+        first_segment = lowest;
+        current_segment.store(highest + 1, std::memory_order_relaxed);
+    }
+}
+
+void HistoryLog::open_segment(uint32_t segment) {
+    if (segment_fd >= 0) ::close(segment_fd);
+    const std::string path = segment_path(segment);
+    segment_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (segment_fd < 0) {
+        perror("open history segment");
+        std::exit(1);
+    }
+    segment_records = 0;
+}
+
+void HistoryLog::run() {
+    std::vector<HistoryRecord> batch;
+    bool stopping = false;
+
+    while (!stopping) {
+        stopping = !running.load(std::memory_order_acquire);
+        if (!stopping) {
+            pollfd pfd{wake_fd, POLLIN, 0};
+            if (::poll(&pfd, 1, WRITER_INTERVAL_MS) > 0) {
+                uint64_t count = 0;
+                if (::read(wake_fd, &count, sizeof(count)) < 0) {}
+            }
+        }
+
+        HistoryRecord record;
+        while (queue.pop(record)) batch.push_back(record);
+        if (!batch.empty()) flush(batch);
+    }
+}
+
+void HistoryLog::flush(std::vector<HistoryRecord>& batch) {
+    // Segments are created on first write so idle restarts leave no empty files.
+    if (segment_fd < 0) open_segment(current_segment.load(std::memory_order_relaxed));
+
+    size_t done = 0;
+    while (done < batch.size()) {
+        const size_t n = std::min(batch.size() - done, SEGMENT_RECORDS - segment_records);
+        const char* bytes = reinterpret_cast<const char*>(batch.data() + done);
+        if (!write_all(segment_fd, bytes, n * sizeof(HistoryRecord))) {
+            perror("write history");
+            break;
+        }
+        done += n;
+        segment_records += n;
+
+        if (segment_records == SEGMENT_RECORDS) {
+            const uint32_t next = current_segment.load(std::memory_order_relaxed) + 1;
+            open_segment(next);
+            current_segment.store(next, std::memory_order_release);
+        }
+    }
+    batch.clear();
+}
+
+std::vector<HistoryRecord> HistoryLog::recent_matches(const std::string& username, size_t limit) const {
+    std::vector<HistoryRecord> out;
+    char key[32];
+    HistoryRecord::copy_name(key, username);
+
+    for (uint32_t segment = current_segment.load(std::memory_order_acquire);
+         segment >= first_segment && segment > 0 && out.size() < limit; segment--) {
+        const int fd = ::open(segment_path(segment).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+
+        struct stat st{};
+        const size_t count = ::fstat(fd, &st) == 0 ? static_cast<size_t>(st.st_size) / sizeof(HistoryRecord) : 0;
+        if (count == 0) {
+            ::close(fd);
+            continue;
+        }
+
+        // Only whole records are mapped; the writer may be appending past the end.
+        const size_t len = count * sizeof(HistoryRecord);
+        void* base = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) continue;
+
+        const auto* records = static_cast<const HistoryRecord*>(base);
+        for (size_t i = count; i-- > 0 && out.size() < limit;) {
+            const HistoryRecord& r = records[i];
+            if (r.kind != HistoryRecord::MATCH) continue;
+            if (std::strncmp(r.p1_name, key, sizeof(key)) == 0 || std::strncmp(r.p2_name, key, sizeof(key)) == 0) {
+                out.push_back(r);
+            }
+        }
+        ::munmap(base, len);
+    }
+    return out;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "MpscQueue.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// One completed round or match, as stored on disk. Fixed size and trivially copyable,
+// so a segment is a plain array of records that can be mapped and indexed directly.
+struct HistoryRecord {
+    enum Kind : uint8_t { ROUND = 1, MATCH = 2 };
+
+    int64_t unix_ms;
+    uint8_t kind;
+    uint8_t p1_move;          // MoveType; NONE for MATCH records
+    uint8_t p2_move;
+    uint8_t round;            // rounds played so far in the match
+    uint16_t p1_wins;
+    uint16_t p2_wins;
+    int32_t lobby_id;
+    int32_t p1_id;
+    int32_t p2_id;
+    int32_t winner_id;        // 0 = draw
+    char p1_name[32];         // NUL-terminated, truncated to 31 bytes
+    char p2_name[32];
+
+    static void copy_name(char (&dst)[32], const std::string& name);
+};
+
+static_assert(sizeof(HistoryRecord) == 96, "on-disk record layout changed");
+static_assert(std::is_trivially_copyable<HistoryRecord>::value, "records are written as raw bytes");
+
+// Append-only, segmented history log. append() may be called from any game thread and
+// only pushes onto a lock-free queue; a background thread batches records into
+// <dir>/history-NNNNNN.bin, starting a new segment every SEGMENT_RECORDS records.
+// Records are not fsync'ed; a crash may lose the last batch.
+class HistoryLog {
+public:
+    static constexpr size_t SEGMENT_RECORDS = 64 * 1024;
+
+    explicit HistoryLog(const std::string& dir);
+    ~HistoryLog();
+
+    HistoryLog(const HistoryLog&) = delete;
+    HistoryLog& operator=(const HistoryLog&) = delete;
+
+    void append(const HistoryRecord& record);
+
+    // Most recent MATCH records involving the player, newest first. Reads segments
+    // through read-only mappings, newest segment first, and stops once limit is reached.
+    std::vector<HistoryRecord> recent_matches(const std::string& username, size_t limit) const;
+
+    const std::string& directory() const { return dir; }
+
+private:
+    std::string dir;
+    uint32_t first_segment{1};
+    std::atomic<uint32_t> current_segment{1};
+
+    MpscQueue<HistoryRecord> queue;
+    std::atomic<bool> running{true};
+    int wake_fd{-1};
+    std::thread writer;
+
+    int segment_fd{-1};
+    size_t segment_records{0};
+
+    std::string segment_path(uint32_t segment) const;
+    void scan_existing_segments();
+    void open_segment(uint32_t segment);
+    void run();
+    void flush(std::vector<HistoryRecord>& batch);
+};
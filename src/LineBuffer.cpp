@@ -0,0 +1,26 @@
+#include "LineBuffer.hpp"
+
+namespace {
+    // Larger buffers are freed on release so one burst does not pin memory forever.
+    constexpr size_t MAX_POOLED_CAPACITY = 4096;
+    constexpr size_t MAX_POOLED_BUFFERS = 1024;
+}
+
+std::string* LineBufferPool::acquire() {
+    outstanding++;
+    if (free_list.empty()) return new std::string();
+
+    std::string* buf = free_list.back().release();
+    free_list.pop_back();
+    return buf;
+}
+
+void LineBufferPool::release(std::string* buf) {
+    outstanding--;
+    if (buf->capacity() > MAX_POOLED_CAPACITY || free_list.size() >= MAX_POOLED_BUFFERS) {
+        delete buf;
+        return;
+    }
+    buf->clear();
+    free_list.emplace_back(buf);
+}
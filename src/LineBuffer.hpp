@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Reusable buffers for partial request lines. A session holds one only while it has
+// an incomplete line pending, so idle sessions cost a null pointer instead of a string.
+// Single-threaded: each engine (or I/O thread) owns its own pool.
+class LineBufferPool {
+public:
+    std::string* acquire();
+
+    // Clears and keeps the buffer for reuse; buffers grown by a burst are freed instead.
+    void release(std::string* buf);
+
+    size_t in_use() const { return outstanding; }
+    size_t pooled() const { return free_list.size(); }
+
+private:
+    std::vector<std::unique_ptr<std::string>> free_list;
+    size_t outstanding{0};
+};
+
+// Feeds every complete line in pending + data to on_line(std::string_view) and keeps the
+// incomplete tail in a pooled buffer. Lines are parsed straight out of data when nothing
+// is pending. on_line returns false once the session is gone; framing then stops and
+// any buffer is returned, so on_line may safely destroy the owner of `pending`.
+template <typename OnLine>
+void frame_lines(LineBufferPool& pool, std::string*& pending, const char* data, size_t len, OnLine&& on_line) {
+    std::string* buf = pending;
+    pending = nullptr;
+
+    std::string_view view(data, len);
+    if (buf) {
+        buf->append(data, len);
+        view = *buf;
+    }
+
+    size_t start = 0;
+    while (true) {
+        const size_t pos = view.find('\n', start);
+        if (pos == std::string_view::npos) break;
+
+        const bool alive = on_line(view.substr(start, pos - start));
+        start = pos + 1;
+        if (!alive) {
+            if (buf) pool.release(buf);
+            return;
+        }
+    }
+
+    if (start == view.size()) {
+        if (buf) pool.release(buf);
+        return;
+    }
+
+    if (buf) {
+        buf->erase(0, start);
+    } else {
+        buf = pool.acquire();
+        buf->assign(view.substr(start));
+    }
+    pending = buf;
+}
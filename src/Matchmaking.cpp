@@ -0,0 +1,116 @@
+#include "Matchmaking.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+
+static Matchmaker::Stats process_stats;
+
+const Matchmaker::Stats& Matchmaker::stats() {
+    return process_stats;
+}
+
+int Matchmaker::band_of(int rating) {
+    return std::clamp(rating / BAND_WIDTH, 0, BANDS - 1);
+}
+
+bool Matchmaker::enqueue(int userId, int rating, Clock::time_point now, std::vector<Pairing>& out) {
+    if (queued.count(userId)) return false;
+    process_stats.enqueued.fetch_add(1, std::memory_order_relaxed);
+    process_stats.waiting.fetch_add(1, std::memory_order_relaxed);
+
+    const int b = band_of(rating);
+    Band& band = bands[static_cast<size_t>(b)];
+    band.push_back(Waiter{userId, rating, now});
+    queued.emplace(userId, std::make_pair(b, std::prev(band.end())));
+
+    if (band.size() >= 2) pair(b, band.begin(), b, std::prev(band.end()), now, out);
+    return true;
+}
+
+bool Matchmaker::remove(int userId) {
+    auto it = queued.find(userId);
+    if (it == queued.end()) return false;
+    bands[static_cast<size_t>(it->second.first)].erase(it->second.second);
+    queued.erase(it);
+    process_stats.waiting.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+void Matchmaker::poll(Clock::time_point now, std::vector<Pairing>& out) {
+    if (queued.size() < 2) return;
+
+    for (int b = 0; b < BANDS; b++) {
+        Band& band = bands[static_cast<size_t>(b)];
+        auto it = band.begin();
+        while (it != band.end()) {
+            const int64_t reach = std::min<int64_t>((now - it->since) / WIDEN_AFTER, BANDS);
+            if (reach == 0) break;   // everyone behind joined later
+
+            // Same band first, then the nearest band in reach; the closer rating breaks a tie.
+            int partner_band = -1;
+            if (std::next(it) != band.end()) partner_band = b;
+            for (int d = 1; partner_band < 0 && d <= reach; d++) {
+                const int lo = b - d;
+                const int hi = b + d;
+                const bool has_lo = lo >= 0 && !bands[static_cast<size_t>(lo)].empty();
+                const bool has_hi = hi < BANDS && !bands[static_cast<size_t>(hi)].empty();
+                if (has_lo && has_hi) {
+                    const int gap_lo = it->rating - bands[static_cast<size_t>(lo)].front().rating;
+                    const int gap_hi = bands[static_cast<size_t>(hi)].front().rating - it->rating;
+                    partner_band = gap_lo <= gap_hi ? lo : hi;
+                } else if (has_lo) {
+                    partner_band = lo;
+                } else if (has_hi) {
+                    partner_band = hi;
+                }
+            }
+            if (partner_band < 0) {
+                ++it;
+                continue;
+            }
+
+            auto partner = partner_band == b ? std::next(it) : bands[static_cast<size_t>(partner_band)].begin();
+            pair(b, it, partner_band, partner, now, out);
+            it = band.begin();
+        }
+    }
+}
+
+void Matchmaker::pair(int band_a, Band::iterator a, int band_b, Band::iterator b, Clock::time_point now,
+                      std::vector<Pairing>& out) {
+    using namespace std::chrono;
+    if (b->since < a->since) {
+        std::swap(band_a, band_b);
+        std::swap(a, b);
+    }
+    out.push_back(Pairing{a->userId, b->userId, a->rating, b->rating});
+
+    process_stats.wait.record(duration_cast<microseconds>(now - a->since));
+    process_stats.wait.record(duration_cast<microseconds>(now - b->since));
+    process_stats.gap_bands[static_cast<size_t>(std::abs(band_a - band_b))].fetch_add(1, std::memory_order_relaxed);
+    process_stats.gap_points.fetch_add(static_cast<uint64_t>(std::abs(a->rating - b->rating)),
+                                       std::memory_order_relaxed);
+    process_stats.paired.fetch_add(1, std::memory_order_relaxed);
+
+    remove(a->userId);
+    remove(b->userId);
+}
+
+void Matchmaker::Stats::report(std::ostream& os, const char* prefix) const {
+    const uint64_t n = enqueued.load(std::memory_order_relaxed);
+    if (n == 0) return;
+    const uint64_t matches = paired.load(std::memory_order_relaxed);
+
+    os << prefix << "queue enqueued=" << n << " paired=" << matches
+       << " waiting=" << waiting.load(std::memory_order_relaxed)
+       << " mean_gap=" << (matches ? gap_points.load(std::memory_order_relaxed) / matches : 0) << "\n";
+    wait.report(os, prefix, "queue_wait");
+
+    os << prefix << "queue_gap_bands";
+    for (size_t d = 0; d < gap_bands.size(); d++) {
+        const uint64_t count = gap_bands[d].load(std::memory_order_relaxed);
+        if (count > 0) os << " d" << d << "=" << count;
+    }
+    os << "\n";
+}
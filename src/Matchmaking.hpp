@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Clock.hpp"
+#include "Histogram.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+// Two queued players the matchmaker decided should play each other.
+struct Pairing {
+    int p1{0};                 // the longer waiter
+    int p2{0};
+    int p1Rating{0};
+    int p2Rating{0};
+};
+
+// Skill-bucketed queue behind REQ_QUEUE. Waiting players sit in FIFO lists, one per
+// BAND_WIDTH rating points. A newcomer is paired at once with the longest waiter of its own
+// band, so enqueue is O(1); otherwise it waits. Every poll() lets a waiter reach one more
+// band on either side per WIDEN_AFTER spent in the queue, and pairs it with the longest
+// waiter of the nearest band in reach. A band rarely holds more than one player, so a poll
+// costs O(BANDS * reach) however many are queued. Single-threaded, like the engine owning it.
+class Matchmaker {
+public:
+    static constexpr int BAND_WIDTH = 50;
+    static constexpr int BANDS = 64;    // ratings clamp into [0, BANDS * BAND_WIDTH)
+    static constexpr std::chrono::seconds WIDEN_AFTER{3};
+
+    // Queue matches are seated in lobbies "<POOL>#<n>", which route like a tournament called
+    // POOL: the queue and its lobbies live on the same shard and cluster node.
+    static constexpr const char* POOL = "queue";
+
+    // False if the player is already queued. A pairing found at once is appended to out.
+    bool enqueue(int userId, int rating, Clock::time_point now, std::vector<Pairing>& out);
+
+    // False if the player was not queued.
+    bool remove(int userId);
+
+    bool contains(int userId) const { return queued.count(userId) > 0; }
+    size_t size() const { return queued.size(); }
+
+    // Widens every waiter's reach and appends the pairings that makes possible.
+    void poll(Clock::time_point now, std::vector<Pairing>& out);
+
+    // Waits and rating gaps of every pairing in the process, for [STATS] and the benchmark.
+    struct Stats {
+        LatencyHistogram wait;
+        std::array<std::atomic<uint64_t>, BANDS> gap_bands{};   // pairings by band distance
+        std::atomic<uint64_t> gap_points{0};                    // sum of rating differences
+        std::atomic<uint64_t> enqueued{0};
+        std::atomic<uint64_t> paired{0};                        // pairings, two players each
+        std::atomic<int64_t> waiting{0};                        // queued right now
+
+        // Nothing at all until the first REQ_QUEUE.
+        void report(std::ostream& os, const char* prefix) const;
+    };
+    static const Stats& stats();
+
+private:
+    struct Waiter {
+        int userId{0};
+        int rating{0};
+        Clock::time_point since;
+    };
+    using Band = std::list<Waiter>;
+
+    std::array<Band, BANDS> bands;
+    std::unordered_map<int, std::pair<int, Band::iterator>> queued;   // userId -> (band, entry)
+
+    static int band_of(int rating);
+    void pair(int band_a, Band::iterator a, int band_b, Band::iterator b, Clock::time_point now,
+              std::vector<Pairing>& out);
+};
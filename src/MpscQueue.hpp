@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+// Unbounded lock-free multi-producer / single-consumer queue (Vyukov's intrusive list).
+// push() is wait-free for producers; pop() and empty() must only be called by the consumer.
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() {
+        Node* stub = new Node();
+        head.store(stub, std::memory_order_relaxed);
+        tail = stub;
+    }
+
+    ~MpscQueue() {
+        T discard;
+        while (pop(discard)) {}
+        delete tail;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value) {
+        Node* node = new Node(std::move(value));
+        Node* prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    bool pop(T& out) {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (!next) return false;
+        out = std::move(next->value);
+        delete tail;
+        tail = next;
+        return true;
+    }
+
+    bool empty() const {
+        return tail->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        T value{};
+
+        Node() = default;
+        explicit Node(T v) : value(std::move(v)) {}
+    };
+
+    std::atomic<Node*> head;
+    Node* tail;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+// USDT static probes under the "ups" provider, compiled in with -DUPS_USDT=ON (needs
+// sys/sdt.h from systemtap-sdt-dev). An unattached probe is a single nop and its
+// arguments are only materialised in registers, so they must be cheap and side-effect
+// free. Without the option every probe compiles away.
+//
+//   bpftrace -e 'usdt:./ups_server:ups:request__start { @t[tid] = nsecs; @ty[tid] = arg1; }
+//                usdt:./ups_server:ups:request__done /@t[tid]/ {
+//                    @lat[@ty[tid]] = hist(nsecs - @t[tid]); delete(@t[tid]); }'
+//
+// Probes and arguments:
+//   request__parsed  (sid, fd, type)      type is the RequestType ordinal
+//   request__start   (sid, type)          around handle_request
+//   request__done    (sid, type)
+//   send__line       (sid, bytes)         bytes include the newline
+//   round__resolved  (lobbyId, round, winner)   winner 0 = draw, else 1/2
+//   match__resolved  (lobbyId, p1Wins, p2Wins)
+//   disconnect       (sid, reason, soft)  reason is a C string
+//   heartbeat__ping  (sid, nonce)
+//   heartbeat__pong  (sid, rttMicros)     rttMicros is -1 for a stale echo
+//   heartbeat__timeout (sid)
+//   lobby__create    (lobbyId, name)
+//   lobby__destroy   (lobbyId)
+
+#if defined(UPS_USDT) && __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define UPS_PROBE(...) STAP_PROBEV(ups, __VA_ARGS__)
+#else
+#define UPS_PROBE(...) ((void)0)
+#endif
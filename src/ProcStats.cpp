@@ -0,0 +1,13 @@
+#include "ProcStats.hpp"
+
+#include <unistd.h>
+
+#include <fstream>
+
+size_t resident_set_bytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t total_pages = 0;
+    size_t resident_pages = 0;
+    if (!(statm >> total_pages >> resident_pages)) return 0;
+    return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
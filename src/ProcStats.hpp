@@ -0,0 +1,6 @@
+#pragma once
+
+#include <cstddef>
+
+// Resident set size of this process in bytes, from /proc/self/statm; 0 if unavailable.
+size_t resident_set_bytes();
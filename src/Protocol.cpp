@@ -7,7 +7,7 @@
 // ------------------------------------
 // Helpers
 // ------------------------------------
-static std::vector<std::string> split_pipe_keep_empty(const std::string& s) {
+static std::vector<std::string> split_pipe_keep_empty(std::string_view s) {
     std::vector<std::string> out;
     std::string cur;
     for (char c : s) {
@@ -30,7 +30,7 @@ static std::string prefix(const std::string& payload) {
 // ------------------------------------
 // Request parsing (USED by Server.cpp)
 // ------------------------------------
-Request parse_request_line(const std::string& line) {
+Request parse_request_line(std::string_view line) {
     Request req;
     req.valid_magic = true;
     req.type = RequestType::INVALID;
@@ -65,18 +65,64 @@ Request parse_request_line(const std::string& line) {
     else if (type_desc == "REQ_REMATCH") req.type = RequestType::REMATCH;
     else if (type_desc == "REQ_STATE") req.type = RequestType::STATE;
     else if (type_desc == "REQ_PONG") req.type = RequestType::PONG;
+    else if (type_desc == "REQ_RESUME") req.type = RequestType::RESUME;
+    else if (type_desc == "REQ_SPECTATE") req.type = RequestType::SPECTATE;
+    else if (type_desc == "REQ_TOURNEY_CREATE") req.type = RequestType::TOURNEY_CREATE;
+    else if (type_desc == "REQ_TOURNEY_JOIN") req.type = RequestType::TOURNEY_JOIN;
+    else if (type_desc == "REQ_TOURNEY_START") req.type = RequestType::TOURNEY_START;
+    else if (type_desc == "REQ_HISTORY") req.type = RequestType::HISTORY;
+    else if (type_desc == "REQ_SUBSCRIBE") req.type = RequestType::SUBSCRIBE;
+    else if (type_desc == "REQ_LEADERBOARD") req.type = RequestType::LEADERBOARD;
+    else if (type_desc == "REQ_RANK") req.type = RequestType::RANK;
+    else if (type_desc == "REQ_QUEUE") req.type = RequestType::QUEUE;
+    else if (type_desc == "REQ_UNQUEUE") req.type = RequestType::UNQUEUE;
+    else if (type_desc == "PEER_HELLO") req.type = RequestType::PEER_HELLO;
+    else if (type_desc == "PEER_CLAIM") req.type = RequestType::PEER_CLAIM;
+    else if (type_desc == "PEER_RELEASE") req.type = RequestType::PEER_RELEASE;
+    else if (type_desc == "PEER_CLAIMED") req.type = RequestType::PEER_CLAIMED;
     else { req.type = RequestType::INVALID; }
 
     return req;
 }
 
+const char* request_type_name(RequestType type) {
+    switch (type) {
+        case RequestType::LOGIN:           return "LOGIN";
+        case RequestType::LOGOUT:          return "LOGOUT";
+        case RequestType::CREATE_LOBBY:    return "CREATE_LOBBY";
+        case RequestType::JOIN_LOBBY:      return "JOIN_LOBBY";
+        case RequestType::LEAVE_LOBBY:     return "LEAVE_LOBBY";
+        case RequestType::MOVE:            return "MOVE";
+        case RequestType::REMATCH:         return "REMATCH";
+        case RequestType::STATE:           return "STATE";
+        case RequestType::PONG:            return "PONG";
+        case RequestType::RESUME:          return "RESUME";
+        case RequestType::SPECTATE:        return "SPECTATE";
+        case RequestType::TOURNEY_CREATE:  return "TOURNEY_CREATE";
+        case RequestType::TOURNEY_JOIN:    return "TOURNEY_JOIN";
+        case RequestType::TOURNEY_START:   return "TOURNEY_START";
+        case RequestType::HISTORY:         return "HISTORY";
+        case RequestType::SUBSCRIBE:       return "SUBSCRIBE";
+        case RequestType::LEADERBOARD:     return "LEADERBOARD";
+        case RequestType::RANK:            return "RANK";
+        case RequestType::QUEUE:           return "QUEUE";
+        case RequestType::UNQUEUE:         return "UNQUEUE";
+        case RequestType::PEER_HELLO:      return "PEER_HELLO";
+        case RequestType::PEER_CLAIM:      return "PEER_CLAIM";
+        case RequestType::PEER_RELEASE:    return "PEER_RELEASE";
+        case RequestType::PEER_CLAIMED:    return "PEER_CLAIMED";
+        case RequestType::INVALID:         return "INVALID";
+    }
+    return "UNKNOWN";
+}
+
 // ------------------------------------
 // Responses (USED by Server.cpp)
 // ------------------------------------
 namespace Responses {
 
-    std::string login_ok(int userId) {
-        return prefix("RES_LOGIN_OK|" + std::to_string(userId));
+    std::string login_ok(int userId, const std::string& resumeToken) {
+        return prefix("RES_LOGIN_OK|" + std::to_string(userId) + "|" + resumeToken);
     }
     std::string login_fail() {
         return prefix("RES_LOGIN_FAIL");
@@ -95,8 +141,9 @@ namespace Responses {
         return prefix("RES_LOBBY_LEFT");
     }
 
-    std::string game_started() {
-        return prefix("RES_GAME_STARTED");
+    std::string game_started(int moveDeadlineSeconds) {
+        if (moveDeadlineSeconds <= 0) return prefix("RES_GAME_STARTED");
+        return prefix("RES_GAME_STARTED|" + std::to_string(moveDeadlineSeconds));
     }
 
     std::string move_accepted(const std::string& moveStr) {
@@ -115,10 +162,13 @@ namespace Responses {
                             const std::string& p1Move,
                             const std::string& p2Move,
                             int p1Wins,
-                            int p2Wins) {
-        return prefix("RES_ROUND_RESULT|" + std::to_string(winnerUserId) + "|" +
+                            int p2Wins,
+                            int moveDeadlineSeconds) {
+        std::string body = "RES_ROUND_RESULT|" + std::to_string(winnerUserId) + "|" +
                     p1Move + "|" + p2Move + "|" +
-                    std::to_string(p1Wins) + "|" + std::to_string(p2Wins));
+                    std::to_string(p1Wins) + "|" + std::to_string(p2Wins);
+        if (moveDeadlineSeconds > 0) body += "|" + std::to_string(moveDeadlineSeconds);
+        return prefix(body);
     }
 
     std::string match_result(int winnerUserId,
@@ -140,6 +190,16 @@ namespace Responses {
         return prefix("RES_STATE|" + debug);
     }
 
+    std::string state_unchanged(uint64_t version) {
+        return prefix("RES_STATE_UNCHANGED|" + std::to_string(version));
+    }
+    std::string state_delta(uint64_t version, const std::string& fields) {
+        return prefix("RES_STATE_DELTA|" + std::to_string(version) + "|" + fields);
+    }
+    std::string subscribed(bool on) {
+        return prefix(std::string("RES_SUBSCRIBED|") + (on ? "1" : "0"));
+    }
+
     std::string ping(const std::string& nonce) {
         return prefix("RES_PING|" + nonce);
     }
@@ -152,6 +212,61 @@ namespace Responses {
         return prefix("RES_GAME_RESUMED");
     }
 
+    std::string spectating(const std::string& lobbyName) {
+        return prefix("RES_SPECTATING|" + lobbyName);
+    }
+
+    std::string redirect(const std::string& address) {
+        return prefix("RES_REDIRECT|" + address);
+    }
+
+    // ---- Tournaments ----
+    std::string tourney_created(const std::string& name) {
+        return prefix("RES_TOURNEY_CREATED|" + name);
+    }
+    std::string tourney_joined(const std::string& name, size_t entrants) {
+        return prefix("RES_TOURNEY_JOINED|" + name + "|" + std::to_string(entrants));
+    }
+    std::string tourney_match(const std::string& name, int round, const std::string& lobbyName,
+                              const std::string& opponentName) {
+        return prefix("RES_TOURNEY_MATCH|" + name + "|" + std::to_string(round) + "|" + lobbyName + "|" + opponentName);
+    }
+    std::string tourney_bye(const std::string& name, int round) {
+        return prefix("RES_TOURNEY_BYE|" + name + "|" + std::to_string(round));
+    }
+    std::string tourney_result(const std::string& name, int round, int winnerUserId) {
+        return prefix("RES_TOURNEY_RESULT|" + name + "|" + std::to_string(round) + "|" + std::to_string(winnerUserId));
+    }
+    std::string tourney_end(const std::string& name, int winnerUserId) {
+        return prefix("RES_TOURNEY_END|" + name + "|" + std::to_string(winnerUserId));
+    }
+
+    std::string history(const std::string& username, const std::vector<std::string>& entries) {
+        std::string body = "RES_HISTORY|" + username + "|" + std::to_string(entries.size());
+        for (const auto& e : entries) body += "|" + e;
+        return prefix(body);
+    }
+
+    std::string leaderboard(const std::vector<std::string>& entries) {
+        std::string body = "RES_LEADERBOARD|" + std::to_string(entries.size());
+        for (const auto& e : entries) body += "|" + e;
+        return prefix(body);
+    }
+    std::string rank(const std::string& username, size_t rank, int rating, uint32_t games, size_t total) {
+        return prefix("RES_RANK|" + username + "|" + std::to_string(rank) + "|" + std::to_string(rating) + "|" +
+                      std::to_string(games) + "|" + std::to_string(total));
+    }
+
+    std::string queued(int rating) {
+        return prefix("RES_QUEUED|" + std::to_string(rating));
+    }
+    std::string unqueued() {
+        return prefix("RES_UNQUEUED");
+    }
+    std::string match_found(const std::string& lobbyName, const std::string& opponentName, int opponentRating) {
+        return prefix("RES_MATCH_FOUND|" + lobbyName + "|" + opponentName + "|" + std::to_string(opponentRating));
+    }
+
     // ---- Error responses ----
     std::string error_unexpected_state() {
         return prefix("RES_ERROR|Unexpected state");
@@ -183,8 +298,31 @@ namespace Responses {
     std::string error_malformed_request() {
         return prefix("RES_ERROR|Malformed request");
     }
+    std::string error_server_busy() {
+        return prefix("RES_ERROR|Server busy");
+    }
     std::string error(const std::string& msg) {
         return prefix("RES_ERROR|" + msg);
     }
 
 }
+
+// ------------------------------------
+// Cluster links
+// ------------------------------------
+namespace PeerMessages {
+
+    std::string hello(int node, const std::string& secret) {
+        return prefix("PEER_HELLO|" + std::to_string(node) + "|" + secret);
+    }
+    std::string claim(const std::string& username) {
+        return prefix("PEER_CLAIM|" + username);
+    }
+    std::string release(const std::string& username) {
+        return prefix("PEER_RELEASE|" + username);
+    }
+    std::string claimed(const std::string& username, bool granted) {
+        return prefix("PEER_CLAIMED|" + username + "|" + (granted ? "1" : "0"));
+    }
+
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 inline constexpr const char* PROTOCOL_MAGIC = "MRLLN";
@@ -15,6 +18,21 @@ enum class RequestType {
     REMATCH,
     STATE,
     PONG,
+    RESUME,
+    SPECTATE,
+    TOURNEY_CREATE,
+    TOURNEY_JOIN,
+    TOURNEY_START,
+    HISTORY,
+    SUBSCRIBE,
+    LEADERBOARD,
+    RANK,
+    QUEUE,
+    UNQUEUE,
+    PEER_HELLO,      // cluster links only, never from clients
+    PEER_CLAIM,
+    PEER_RELEASE,
+    PEER_CLAIMED,
     INVALID
 };
 
@@ -33,12 +51,14 @@ struct Request {
     bool valid_magic{true};
 };
 
-Request parse_request_line(const std::string& line);
+Request parse_request_line(std::string_view line);
+
+const char* request_type_name(RequestType type);
 
 namespace Responses {
 
     // ---- Standard OK responses ----
-    std::string login_ok(int userId);
+    std::string login_ok(int userId, const std::string& resumeToken);
     std::string login_fail();
 
     std::string logout_ok();
@@ -47,7 +67,9 @@ namespace Responses {
     std::string lobby_joined(const std::string& lobbyName);
     std::string lobby_left();
 
-    std::string game_started();
+    // With move deadlines on, game_started and round_result carry the seconds allowed for
+    // the next move. A move missing from a round result was forfeited.
+    std::string game_started(int moveDeadlineSeconds = 0);
 
     std::string move_accepted(const std::string& moveStr);
 
@@ -55,7 +77,8 @@ namespace Responses {
                              const std::string& p1Move,
                              const std::string& p2Move,
                              int p1Wins,
-                             int p2Wins);
+                             int p2Wins,
+                             int moveDeadlineSeconds = 0);
 
     std::string match_result(int winnerUserId,
                              int p1Wins,
@@ -67,12 +90,45 @@ namespace Responses {
 
     std::string state(const std::string& debug);
 
+    // Versioned lobby state. A delta lists only the fields that changed, "key=" for one that
+    // is gone; the first delta after entering a lobby carries every field.
+    std::string state_unchanged(uint64_t version);
+    std::string state_delta(uint64_t version, const std::string& fields);
+    std::string subscribed(bool on);
+
     std::string ping(const std::string& nonce);
 
     std::string opponent_disconnected(int seconds);
 
     std::string game_resumed();
 
+    std::string spectating(const std::string& lobbyName);
+
+    // Cluster mode: the lobby lives on another node; reconnect there and log in again.
+    std::string redirect(const std::string& address);
+
+    // ---- Tournaments ----
+    std::string tourney_created(const std::string& name);
+    std::string tourney_joined(const std::string& name, size_t entrants);
+    std::string tourney_match(const std::string& name, int round, const std::string& lobbyName,
+                              const std::string& opponentName);
+    std::string tourney_bye(const std::string& name, int round);
+    std::string tourney_result(const std::string& name, int round, int winnerUserId);
+    std::string tourney_end(const std::string& name, int winnerUserId);
+
+    // entries: "<opponent>,<W|L|D>,<myWins>,<opponentWins>,<unixMs>", newest first
+    std::string history(const std::string& username, const std::vector<std::string>& entries);
+
+    // entries: "<username>,<rating>,<games>", best first
+    std::string leaderboard(const std::vector<std::string>& entries);
+    std::string rank(const std::string& username, size_t rank, int rating, uint32_t games, size_t total);
+
+    // ---- Matchmaking ----
+    std::string queued(int rating);
+    std::string unqueued();
+    // Followed by lobby_joined and game_started for the seated match.
+    std::string match_found(const std::string& lobbyName, const std::string& opponentName, int opponentRating);
+
     // ---- Error responses ----
     std::string error_unexpected_state();
     std::string error_invalid_magic();
@@ -84,6 +140,16 @@ namespace Responses {
     std::string error_not_in_game();
     std::string error_rematch_not_allowed();
     std::string error_malformed_request();
+    std::string error_server_busy();
     std::string error(const std::string& msg);
 
 }
+
+// Node-to-node lines on cluster links, framed like client requests. A node asks a
+// username's home node to CLAIM it before a login completes and RELEASEs it afterwards.
+namespace PeerMessages {
+    std::string hello(int node, const std::string& secret);
+    std::string claim(const std::string& username);
+    std::string release(const std::string& username);
+    std::string claimed(const std::string& username, bool granted);
+}
@@ -0,0 +1,224 @@
+#include "Ratings.hpp"
+#include "ByteCodec.hpp"
+#include "Protocol.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+namespace {
+    constexpr uint32_t RATINGS_MAGIC = 0x55505345;   // "UPSE"
+
+    bool write_all(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            const ssize_t n = ::write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+}
+
+RatingTable::RatingTable(const std::string& path, std::chrono::milliseconds interval, bool inline_updates)
+    : path(path), period(interval), inline_updates(inline_updates) {
+    if (!path.empty()) load();
+    if (inline_updates) return;
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        perror("eventfd");
+        std::exit(1);
+    }
+    owner = std::thread([this] { run(); });
+}
+
+RatingTable::~RatingTable() {
+    if (inline_updates) return;
+    running.store(false, std::memory_order_release);
+    uint64_t one = 1;
+    if (::write(wake_fd, &one, sizeof(one)) < 0) perror("write");
+    if (owner.joinable()) owner.join();
+    if (wake_fd >= 0) ::close(wake_fd);
+}
+
+// Caller holds the exclusive lock. top_touched ends up as the best rank (1-based) the player held
+// before or after the change.
+void RatingTable::rate(const std::string& name, int rating, size_t& top_touched) {
+    auto [it, added] = players.try_emplace(name);
+    Rated& p = it->second;
+    if (!added) {
+        const Key old{-p.rating, name};
+        top_touched = std::min(top_touched, ladder.order_of_key(old) + 1);
+        ladder.erase(old);
+    }
+    p.rating = rating;
+    p.games++;
+    const Key now{-rating, name};
+    ladder.insert(now);
+    top_touched = std::min(top_touched, ladder.order_of_key(now) + 1);
+}
+
+void RatingTable::record_match(const std::string& p1, const std::string& p2, int winner) {
+    if (p1 == p2) return;
+    if (inline_updates) {
+        apply(Match{p1, p2, winner});
+        return;
+    }
+    queue.push(Match{p1, p2, winner});
+    uint64_t one = 1;
+    if (::write(wake_fd, &one, sizeof(one)) < 0) {}
+}
+
+// Runs on the owner thread (or the caller, with inline updates), the table's only writer.
+void RatingTable::apply(const Match& m) {
+    std::unique_lock<std::shared_mutex> lock(table_mutex);
+
+    auto rating_of = [this](const std::string& name) {
+        auto it = players.find(name);
+        return it == players.end() ? INITIAL_RATING : it->second.rating;
+    };
+    const int r1 = rating_of(m.p1);
+    const int r2 = rating_of(m.p2);
+
+    const double expected1 = 1.0 / (1.0 + std::pow(10.0, (r2 - r1) / 400.0));
+    const double score1 = m.winner == 1 ? 1.0 : (m.winner == 2 ? 0.0 : 0.5);
+    // One rounded delta for both keeps the total rating constant.
+    const int delta = static_cast<int>(std::lround(K_FACTOR * (score1 - expected1)));
+
+    size_t top_touched = SIZE_MAX;
+    rate(m.p1, r1 + delta, top_touched);
+    rate(m.p2, r2 - delta, top_touched);
+
+    // Pages shorter than the best rank involved still list exactly the same players. No
+    // reader holds the shared lock now, so the page cache is ours as well.
+    pages.erase(pages.lower_bound(top_touched), pages.end());
+}
+
+std::string RatingTable::leaderboard(size_t n) {
+    n = std::min(n, MAX_PAGE);
+    std::shared_lock<std::shared_mutex> lock(table_mutex);
+    std::lock_guard<std::mutex> page_lock(pages_mutex);
+
+    auto cached = pages.find(n);
+    if (cached != pages.end()) return cached->second;
+
+    std::vector<std::string> entries;
+    entries.reserve(std::min(n, ladder.size()));
+    for (auto it = ladder.begin(); it != ladder.end() && entries.size() < n; ++it) {
+        const Rated& p = players.at(it->second);
+        entries.push_back(it->second + "," + std::to_string(p.rating) + "," + std::to_string(p.games));
+    }
+    return pages.emplace(n, Responses::leaderboard(entries)).first->second;
+}
+
+bool RatingTable::standing(const std::string& username, Standing& out) const {
+    std::shared_lock<std::shared_mutex> lock(table_mutex);
+    auto it = players.find(username);
+    if (it == players.end()) return false;
+    out.rank = ladder.order_of_key(Key{-it->second.rating, username}) + 1;
+    out.total = ladder.size();
+    out.rating = it->second.rating;
+    out.games = it->second.games;
+    return true;
+}
+
+void RatingTable::load() {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return;
+    const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    ByteReader r{bytes.data(), bytes.data() + bytes.size()};
+    const uint32_t magic = r.get<uint32_t>();
+    const uint32_t count = r.get<uint32_t>();
+    if (!r.ok || magic != RATINGS_MAGIC) {
+        std::cerr << "[ERR] Ratings " << path << " are corrupt, starting empty\n";
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        std::string name = r.get_string();
+        Rated p;
+        p.rating = r.get<int32_t>();
+        p.games = r.get<uint32_t>();
+        if (!r.ok) break;
+        ladder.insert(Key{-p.rating, name});
+        players.emplace(std::move(name), p);
+    }
+    std::cerr << "[SYS] Loaded ratings " << path << ": " << players.size() << " players\n";
+}
+
+// Applies matches as soon as they arrive; with a path, rewrites the file at most once per
+// period while anything changed, and once more on shutdown.
+void RatingTable::run() {
+    using Clock = std::chrono::steady_clock;
+    bool dirty = false;
+    auto next_write = Clock::now();
+    bool stopping = false;
+
+    while (!stopping) {
+        stopping = !running.load(std::memory_order_acquire);
+        if (!stopping) {
+            int timeout = -1;
+            if (dirty) {
+                const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(next_write - Clock::now());
+                timeout = static_cast<int>(std::max<std::chrono::milliseconds::rep>(0, left.count()));
+            }
+            pollfd pfd{wake_fd, POLLIN, 0};
+            if (::poll(&pfd, 1, timeout) > 0) {
+                uint64_t count = 0;
+                if (::read(wake_fd, &count, sizeof(count)) < 0) {}
+            }
+        }
+
+        Match m;
+        while (queue.pop(m)) {
+            apply(m);
+            if (!path.empty() && !dirty) {
+                dirty = true;
+                next_write = std::max(next_write, Clock::now());
+            }
+        }
+        if (dirty && (stopping || Clock::now() >= next_write)) {
+            dirty = false;
+            next_write = Clock::now() + period;
+            if (!write_file(serialize())) perror("write ratings");
+        }
+    }
+}
+
+// Owner thread only: nothing else writes the table, so reading it needs no lock.
+std::string RatingTable::serialize() const {
+    std::string bytes;
+    put<uint32_t>(bytes, RATINGS_MAGIC);
+    put<uint32_t>(bytes, static_cast<uint32_t>(players.size()));
+    for (const auto& kv : players) {
+        put_string(bytes, kv.first);
+        put<int32_t>(bytes, kv.second.rating);
+        put<uint32_t>(bytes, kv.second.games);
+    }
+    return bytes;
+}
+
+bool RatingTable::write_file(const std::string& bytes) const {
+    const std::string tmp = path + ".tmp";
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    const bool ok = write_all(fd, bytes.data(), bytes.size()) && ::fsync(fd) == 0;
+    ::close(fd);
+    return ok && ::rename(tmp.c_str(), path.c_str()) == 0;
+}
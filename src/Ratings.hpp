@@ -0,0 +1,96 @@
+#pragma once
+
+#include "MpscQueue.hpp"
+
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+// Elo ratings by username. The leaderboard is an order-statistics tree keyed by
+// (-rating, name), so a player's rank and the top N are O(log n) (+ N) and nothing ever
+// sorts the whole population. Serialized leaderboard pages are cached per size and
+// dropped only when a match moves someone into, out of or within that many top places.
+// Shared by every engine: finished matches go over a lock-free queue to one owner thread,
+// the only writer, which applies them under a brief exclusive lock and serializes the
+// table for --ratings (temp file, fsync, rename) without holding any lock. Lookups share
+// a reader lock, so a standing may trail a just-finished match by one wakeup.
+class RatingTable {
+public:
+    static constexpr int INITIAL_RATING = 1200;
+    static constexpr int K_FACTOR = 32;
+    static constexpr size_t MAX_PAGE = 100;   // largest REQ_LEADERBOARD page
+
+    struct Standing {
+        size_t rank{0};       // 1-based
+        size_t total{0};      // rated players
+        int rating{INITIAL_RATING};
+        uint32_t games{0};
+    };
+
+    // An empty path keeps ratings in memory only. With inline_updates there is no owner
+    // thread: matches are applied by the caller and nothing is written, for single-threaded
+    // use such as replay.
+    RatingTable(const std::string& path, std::chrono::milliseconds interval, bool inline_updates = false);
+    ~RatingTable();
+
+    RatingTable(const RatingTable&) = delete;
+    RatingTable& operator=(const RatingTable&) = delete;
+
+    // One finished match; winner is 1 or 2 for that player, 0 for a draw. Players enter the
+    // leaderboard with their first rated match. Never blocks on the table.
+    void record_match(const std::string& p1, const std::string& p2, int winner);
+
+    // Complete RES_LEADERBOARD line for the top n (clamped to MAX_PAGE).
+    std::string leaderboard(size_t n);
+
+    // False for a player without a rated match.
+    bool standing(const std::string& username, Standing& out) const;
+
+private:
+    struct Rated {
+        int rating{INITIAL_RATING};
+        uint32_t games{0};
+    };
+    struct Match {
+        std::string p1;
+        std::string p2;
+        int winner{0};
+    };
+    using Key = std::pair<int, std::string>;   // (-rating, name): best first, ties by name
+    using Ladder = __gnu_pbds::tree<Key, __gnu_pbds::null_type, std::less<Key>, __gnu_pbds::rb_tree_tag,
+                                    __gnu_pbds::tree_order_statistics_node_update>;
+
+    // players and ladder change only on the owner thread, under the exclusive lock.
+    mutable std::shared_mutex table_mutex;
+    std::unordered_map<std::string, Rated> players;
+    Ladder ladder;
+    std::mutex pages_mutex;                // filled by readers holding the shared lock
+    std::map<size_t, std::string> pages;   // page size -> serialized line
+
+    std::string path;
+    std::chrono::milliseconds period;
+    bool inline_updates;
+
+    MpscQueue<Match> queue;
+    std::atomic<bool> running{true};
+    int wake_fd{-1};
+    std::thread owner;
+
+    void apply(const Match& m);
+    void rate(const std::string& name, int rating, size_t& top_touched);
+    void load();
+    void run();
+    std::string serialize() const;
+    bool write_file(const std::string& bytes) const;
+};
@@ -0,0 +1,305 @@
+#include "Reactor.hpp"
+#include "UringReactor.hpp"
+
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+    constexpr int MAX_EVENTS = 256;
+    constexpr size_t RECV_BUFFER_SIZE = 4096;
+
+    // Broadcast output a connection may have queued before it is considered too slow.
+    constexpr size_t MAX_SHARED_BACKLOG = 256 * 1024;
+
+    // Direct responses are never dropped, so a peer that lets this much pile up is cut off
+    // instead; its read side then reports the hangup like any other.
+    constexpr size_t MAX_BACKLOG = 4 * 1024 * 1024;
+
+    uint64_t pack_event(int fd, uint32_t gen) {
+        return (static_cast<uint64_t>(gen) << 32) | static_cast<uint32_t>(fd);
+    }
+}
+
+const char* io_backend_name(IoBackend backend) {
+    switch (backend) {
+        case IoBackend::Epoll:   return "epoll";
+        case IoBackend::IoUring: return "io_uring";
+    }
+    return "unknown";
+}
+
+bool parse_io_backend(const std::string& s, IoBackend& out) {
+    if (s == "epoll") { out = IoBackend::Epoll; return true; }
+    if (s == "uring" || s == "io_uring") { out = IoBackend::IoUring; return true; }
+    return false;
+}
+
+EpollReactor::EpollReactor() : recv_buffer(RECV_BUFFER_SIZE) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        std::exit(1);
+    }
+}
+
+EpollReactor::~EpollReactor() {
+    if (epoll_fd >= 0) ::close(epoll_fd);
+}
+
+bool EpollReactor::set_recv_buffer(size_t bytes) {
+    recv_buffer.resize(bytes);
+    return true;
+}
+
+uint32_t& EpollReactor::generation_of(int fd) {
+    if (static_cast<size_t>(fd) >= generations.size()) {
+        generations.resize(static_cast<size_t>(fd) + 1, 0);
+    }
+    return generations[static_cast<size_t>(fd)];
+}
+
+EpollReactor::Backlog& EpollReactor::backlog_of(int fd) {
+    if (static_cast<size_t>(fd) >= backlogs.size()) {
+        backlogs.resize(static_cast<size_t>(fd) + 1);
+    }
+    return backlogs[static_cast<size_t>(fd)];
+}
+
+void EpollReactor::set_writable_interest(int fd, bool want) {
+    epoll_event ev{};
+    ev.events = want ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.u64 = pack_event(fd, generation_of(fd));
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) perror("epoll_ctl");
+}
+
+// Starts (or extends) fd's backlog with the unsent part of chunk.
+void EpollReactor::queue_output(int fd, SharedBytes chunk, size_t offset) {
+    Backlog& b = backlog_of(fd);
+    const bool was_empty = b.chunks.empty();
+    b.bytes += chunk->size() - offset;
+    if (was_empty) b.offset = offset;
+    b.chunks.push_back(std::move(chunk));
+    if (was_empty) set_writable_interest(fd, true);
+    if (b.bytes > MAX_BACKLOG) ::shutdown(fd, SHUT_RDWR);
+}
+
+// Writes queued output until the socket would block. True once nothing is left.
+bool EpollReactor::flush_backlog(int fd) {
+    Backlog& b = backlog_of(fd);
+    while (!b.chunks.empty()) {
+        const std::string& front = *b.chunks.front();
+        ssize_t n = ::send(fd, front.data() + b.offset, front.size() - b.offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+            // The peer is gone; the read side reports the hangup.
+            b.chunks.clear();
+            b.offset = 0;
+            b.bytes = 0;
+            break;
+        }
+        b.offset += static_cast<size_t>(n);
+        b.bytes -= static_cast<size_t>(n);
+        if (b.offset < front.size()) return false;
+        b.chunks.pop_front();
+        b.offset = 0;
+    }
+    return true;
+}
+
+void EpollReactor::listen(int fd) {
+    listen_fd = fd;
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = pack_event(fd, generation_of(fd));
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        std::exit(1);
+    }
+}
+
+void EpollReactor::add_wakeup(int event_fd) {
+    wakeup_fd = event_fd;
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = pack_event(event_fd, generation_of(event_fd));
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        std::exit(1);
+    }
+}
+
+void EpollReactor::adopt(int fd) {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = pack_event(fd, generation_of(fd));
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) perror("epoll_ctl");
+}
+
+std::string EpollReactor::pending_output(int fd) const {
+    std::string out;
+    if (fd < 0 || static_cast<size_t>(fd) >= backlogs.size()) return out;
+    const Backlog& b = backlogs[static_cast<size_t>(fd)];
+    for (size_t i = 0; i < b.chunks.size(); i++) {
+        out.append(*b.chunks[i], i == 0 ? b.offset : 0, std::string::npos);
+    }
+    return out;
+}
+
+void EpollReactor::send(int fd, const char* data, size_t len) {
+    Backlog& b = backlog_of(fd);
+    if (b.closing) return;
+    if (!b.chunks.empty()) {
+        // Keep ordering behind queued output.
+        queue_output(fd, std::make_shared<const std::string>(data, len), 0);
+        return;
+    }
+
+    ssize_t n = ::send(fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return;   // hangup is reported on read
+        n = 0;
+    }
+    if (static_cast<size_t>(n) == len) return;
+    queue_output(fd, std::make_shared<const std::string>(data + n, len - static_cast<size_t>(n)), 0);
+}
+
+bool EpollReactor::send_shared(int fd, const SharedBytes& bytes) {
+    Backlog& b = backlog_of(fd);
+    if (b.closing) return true;
+    if (!b.chunks.empty()) {
+        if (b.bytes + bytes->size() > MAX_SHARED_BACKLOG) return false;
+        queue_output(fd, bytes, 0);
+        return true;
+    }
+
+    ssize_t n = ::send(fd, bytes->data(), bytes->size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return true;   // hangup is reported on read
+        n = 0;
+    }
+    if (static_cast<size_t>(n) == bytes->size()) return true;
+    queue_output(fd, bytes, static_cast<size_t>(n));
+    return true;
+}
+
+// With output still queued the fd stays open, watched for EPOLLOUT only, until the backlog
+// drains or CLOSE_LINGER runs out. The generation moves on at once, so nothing more is
+// reported for the connection.
+void EpollReactor::close(int fd) {
+    Backlog& b = backlog_of(fd);
+    if (b.closing) return;
+    if (b.chunks.empty()) {
+        finish_close(fd);
+        return;
+    }
+
+    b.closing = true;
+    b.linger_until = std::chrono::steady_clock::now() + CLOSE_LINGER;
+    const uint32_t gen = ++generation_of(fd);
+    lingering.emplace_back(fd, gen);
+
+    epoll_event ev{};
+    ev.events = EPOLLOUT;
+    ev.data.u64 = pack_event(fd, gen);
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) finish_close(fd);
+}
+
+void EpollReactor::finish_close(int fd) {
+    backlog_of(fd) = Backlog{};
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    generation_of(fd)++;
+}
+
+void EpollReactor::expire_lingering() {
+    const auto now = std::chrono::steady_clock::now();
+    auto done = [&](const std::pair<int, uint32_t>& entry) {
+        const int fd = entry.first;
+        if (generation_of(fd) != entry.second || !backlog_of(fd).closing) return true;   // drained
+        if (now < backlog_of(fd).linger_until) return false;
+        finish_close(fd);
+        return true;
+    };
+    lingering.erase(std::remove_if(lingering.begin(), lingering.end(), done), lingering.end());
+}
+
+bool EpollReactor::poll(ReactorHandler& handler, int timeout_ms) {
+    epoll_event events[MAX_EVENTS];
+    int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+    if (ready < 0) {
+        if (errno == EINTR) return true;
+        perror("epoll_wait");
+        return false;
+    }
+
+    if (ready > 0) handler.on_batch_begin();
+    for (int i = 0; i < ready; i++) {
+        const int fd = static_cast<int>(events[i].data.u64 & 0xffffffffu);
+        const uint32_t gen = static_cast<uint32_t>(events[i].data.u64 >> 32);
+        if (gen != generation_of(fd)) continue;
+
+        if (backlog_of(fd).closing) {
+            if (flush_backlog(fd)) finish_close(fd);
+            continue;
+        }
+
+        if (fd == wakeup_fd) {
+            uint64_t count = 0;
+            if (read(wakeup_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("read");
+            handler.on_wakeup();
+            continue;
+        }
+
+        if (fd == listen_fd) {
+            sockaddr_in client_addr{};
+            socklen_t len = sizeof(client_addr);
+            int client_fd = accept(listen_fd, (sockaddr*)&client_addr, &len);
+            if (client_fd < 0) continue;
+
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.u64 = pack_event(client_fd, generation_of(client_fd));
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+                perror("epoll_ctl");
+                ::close(client_fd);
+                continue;
+            }
+            handler.on_accept(client_fd);
+            continue;
+        }
+
+        if (events[i].events & EPOLLOUT) {
+            if (flush_backlog(fd)) set_writable_interest(fd, false);
+            if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) continue;
+        }
+
+        ssize_t n = recv(fd, recv_buffer.data(), recv_buffer.size(), 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+        if (n <= 0) {
+            handler.on_hangup(fd);
+            continue;
+        }
+        handler.on_data(fd, recv_buffer.data(), static_cast<size_t>(n));
+    }
+
+    if (!lingering.empty()) expire_lingering();
+    return true;
+}
+
+std::unique_ptr<Reactor> make_reactor(IoBackend backend) {
+    if (backend == IoBackend::IoUring) {
+        std::string why_not;
+        auto uring = UringReactor::create(why_not);
+        if (uring) return uring;
+        std::cerr << "[SYS] io_uring unavailable (" << why_not << "), falling back to epoll\n";
+    }
+    return std::make_unique<EpollReactor>();
+}
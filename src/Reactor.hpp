@@ -0,0 +1,121 @@
+#pragma once
+
+#include "SharedBytes.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum class IoBackend {
+    Epoll,
+    IoUring
+};
+
+// How long close() waits for a peer that is not reading to take its last output.
+constexpr std::chrono::seconds CLOSE_LINGER{2};
+
+const char* io_backend_name(IoBackend backend);
+bool parse_io_backend(const std::string& s, IoBackend& out);
+
+// Callbacks a reactor delivers while dispatching completed I/O.
+class ReactorHandler {
+public:
+    virtual ~ReactorHandler() = default;
+
+    virtual void on_accept(int fd) = 0;
+    virtual void on_data(int fd, const char* data, size_t len) = 0;
+    virtual void on_hangup(int fd) = 0;
+
+    // An eventfd registered with add_wakeup() was signalled (and has been drained).
+    virtual void on_wakeup() {}
+
+    // poll() stopped waiting and is about to dispatch a non-empty batch.
+    virtual void on_batch_begin() {}
+};
+
+// Readiness/completion loop shared by all I/O backends.
+// send() never blocks and may be deferred until the next poll(). close() flushes pending
+// sends first: a connection with queued output lingers until it drains or CLOSE_LINGER
+// passes, and reports nothing more to the handler meanwhile.
+class Reactor {
+public:
+    virtual ~Reactor() = default;
+
+    virtual const char* name() const = 0;
+
+    virtual void listen(int listen_fd) = 0;
+    virtual void add_wakeup(int event_fd) = 0;
+
+    // Starts serving an already connected socket, e.g. one handed over by another process.
+    virtual void adopt(int fd) = 0;
+    // Output queued for fd that has not reached the socket yet.
+    virtual std::string pending_output(int fd) const = 0;
+
+    // Bytes read per receive from now on. False if the backend's buffers are fixed at startup.
+    virtual bool set_recv_buffer(size_t bytes) = 0;
+
+    virtual void send(int fd, const char* data, size_t len) = 0;
+    virtual void close(int fd) = 0;
+
+    // Queues a broadcast buffer without blocking. Returns false when the fd's backlog is
+    // over the limit; the caller should drop that connection rather than wait for it.
+    virtual bool send_shared(int fd, const SharedBytes& bytes) = 0;
+
+    // Submits queued work, waits up to timeout_ms and dispatches events.
+    // Returns false on an unrecoverable backend error.
+    virtual bool poll(ReactorHandler& handler, int timeout_ms) = 0;
+};
+
+class EpollReactor : public Reactor {
+public:
+    EpollReactor();
+    ~EpollReactor() override;
+
+    const char* name() const override { return "epoll"; }
+
+    void listen(int listen_fd) override;
+    void add_wakeup(int event_fd) override;
+    void adopt(int fd) override;
+    std::string pending_output(int fd) const override;
+    bool set_recv_buffer(size_t bytes) override;
+    void send(int fd, const char* data, size_t len) override;
+    void close(int fd) override;
+    bool send_shared(int fd, const SharedBytes& bytes) override;
+    bool poll(ReactorHandler& handler, int timeout_ms) override;
+
+private:
+    // Output that could not be written without blocking; flushed on EPOLLOUT.
+    struct Backlog {
+        std::deque<SharedBytes> chunks;
+        size_t offset{0};   // bytes of chunks.front() already sent
+        size_t bytes{0};
+        bool closing{false};   // close() was called; the fd stays open until this drains
+        std::chrono::steady_clock::time_point linger_until;
+    };
+
+    int epoll_fd{-1};
+    int listen_fd{-1};
+    int wakeup_fd{-1};
+    std::vector<char> recv_buffer;
+
+    // Bumped on close so events for a recycled fd number within one batch are dropped.
+    std::vector<uint32_t> generations;
+    std::vector<Backlog> backlogs;   // indexed by fd
+    std::vector<std::pair<int, uint32_t>> lingering;   // (fd, generation) closed with output left
+
+    uint32_t& generation_of(int fd);
+    Backlog& backlog_of(int fd);
+    void set_writable_interest(int fd, bool want);
+    void queue_output(int fd, SharedBytes chunk, size_t offset);
+    bool flush_backlog(int fd);
+    void finish_close(int fd);
+    void expire_lingering();
+};
+
+// Creates the requested backend; io_uring falls back to epoll when the kernel lacks support.
+std::unique_ptr<Reactor> make_reactor(IoBackend backend);
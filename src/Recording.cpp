@@ -0,0 +1,100 @@
+#include "Recording.hpp"
+#include "ByteCodec.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+    constexpr size_t FLUSH_BYTES = 64 * 1024;
+}
+
+TrafficRecorder::TrafficRecorder(const std::string& path, const RecordingHeader& header)
+    : last(std::chrono::steady_clock::now()) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("open recording");
+        std::exit(1);
+    }
+
+    put<uint32_t>(buffer, RECORDING_MAGIC);
+    put<uint32_t>(buffer, RECORDING_VERSION);
+    put<uint64_t>(buffer, header.seed);
+    put<uint8_t>(buffer, header.heartbeat.enabled ? 1 : 0);
+    put<uint8_t>(buffer, header.heartbeat.piggyback ? 1 : 0);
+    put<uint32_t>(buffer, static_cast<uint32_t>(header.heartbeat.ping_idle.count()));
+    std::cerr << "[SYS] Recording traffic to " << path << "\n";
+}
+
+TrafficRecorder::~TrafficRecorder() {
+    flush();
+    ::close(fd);
+    std::cerr << "[SYS] Recording closed (" << count << " events)\n";
+}
+
+void TrafficRecorder::begin(RecordKind kind) {
+    using namespace std::chrono;
+    const auto now = steady_clock::now();
+    const auto delta = duration_cast<microseconds>(now - last).count();
+    last = now;
+    put<uint8_t>(buffer, static_cast<uint8_t>(kind));
+    put<uint32_t>(buffer, static_cast<uint32_t>(std::min<int64_t>(delta, UINT32_MAX)));
+    count++;
+}
+
+void TrafficRecorder::event(RecordKind kind, SessionId sid) {
+    begin(kind);
+    put<uint64_t>(buffer, sid);
+    if (buffer.size() >= FLUSH_BYTES) flush();
+}
+
+void TrafficRecorder::data(SessionId sid, const char* bytes, size_t len) {
+    begin(RecordKind::Data);
+    put<uint64_t>(buffer, sid);
+    put<uint32_t>(buffer, static_cast<uint32_t>(len));
+    buffer.append(bytes, len);
+    if (buffer.size() >= FLUSH_BYTES) flush();
+}
+
+void TrafficRecorder::output(SessionId sid, const std::string& bytes) {
+    begin(RecordKind::Output);
+    put<uint64_t>(buffer, sid);
+    put_blob(buffer, bytes);
+    if (buffer.size() >= FLUSH_BYTES) flush();
+}
+
+void TrafficRecorder::tick() {
+    begin(RecordKind::Tick);
+}
+
+void TrafficRecorder::configure(const RuntimeConfig& config) {
+    begin(RecordKind::Configure);
+    put<int64_t>(buffer, config.ping_interval.count());
+    put<int64_t>(buffer, config.pong_timeout.count());
+    put<int64_t>(buffer, config.reconnect_grace.count());
+    put<int64_t>(buffer, config.move_deadline.count());
+    put<int64_t>(buffer, config.forfeit_after);
+    put_string(buffer, config.default_rules->name);
+}
+
+void TrafficRecorder::flush() {
+    if (buffer.empty()) return;
+    const char* p = buffer.data();
+    size_t left = buffer.size();
+    while (left > 0) {
+        const ssize_t n = ::write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("write recording");
+            break;
+        }
+        p += n;
+        left -= static_cast<size_t>(n);
+    }
+    buffer.clear();
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Config.hpp"
+#include "SessionEngine.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Traffic capture for deterministic replay. The file starts with a header carrying the
+// engine's random seed and heartbeat options, followed by one event per transport call
+// into the engine (open, bytes, close, tick, config) and per engine output, each stamped
+// with the microseconds since the previous event. Replaying the inputs into a fresh
+// engine seeded the same way must reproduce the recorded outputs byte for byte.
+//
+// Layout (native endian, see ByteCodec.hpp):
+//   header: u32 magic, u32 version, u64 seed, u8 heartbeat, u8 piggyback, u32 ping_idle_ms
+//   event:  u8 kind, u32 delta_us, then per kind:
+//     Open, Closed, Drop:  u64 sid
+//     Data, Output:        u64 sid, blob bytes
+//     Tick:                -
+//     Configure:           i64 ping_ms, i64 pong_ms, i64 grace_s, i64 move_deadline_s,
+//                          i64 forfeit_after, string default_rules
+enum class RecordKind : uint8_t {
+    Open = 1,     // transport opened a session
+    Data,         // bytes read from a session
+    Closed,       // transport saw the connection go away
+    Tick,
+    Configure,    // runtime config applied (start and every reload)
+    Output,       // bytes the engine sent to a session
+    Drop          // the engine closed a session
+};
+
+constexpr uint32_t RECORDING_MAGIC = 0x55505354;   // "UPST"
+constexpr uint32_t RECORDING_VERSION = 2;
+
+struct RecordingHeader {
+    uint64_t seed{0};
+    HeartbeatOptions heartbeat;
+};
+
+// Appends events to a capture file from the I/O thread. Events are buffered; the server
+// flushes once per loop iteration, so a killed process loses at most its last batch.
+class TrafficRecorder {
+public:
+    TrafficRecorder(const std::string& path, const RecordingHeader& header);
+    ~TrafficRecorder();
+
+    TrafficRecorder(const TrafficRecorder&) = delete;
+    TrafficRecorder& operator=(const TrafficRecorder&) = delete;
+
+    void open(SessionId sid) { event(RecordKind::Open, sid); }
+    void data(SessionId sid, const char* bytes, size_t len);
+    void closed(SessionId sid) { event(RecordKind::Closed, sid); }
+    void tick();
+    void configure(const RuntimeConfig& config);
+    void output(SessionId sid, const std::string& bytes);
+    void drop(SessionId sid) { event(RecordKind::Drop, sid); }
+
+    void flush();
+
+private:
+    int fd{-1};
+    std::string buffer;
+    uint64_t count{0};
+    std::chrono::steady_clock::time_point last;
+
+    void begin(RecordKind kind);
+    void event(RecordKind kind, SessionId sid);
+};
@@ -0,0 +1,158 @@
+#include "Replay.hpp"
+#include "ByteCodec.hpp"
+#include "Recording.hpp"
+#include "SessionEngine.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <thread>
+
+namespace {
+    class CapturingSink : public SessionSink {
+    public:
+        std::map<SessionId, std::string> outputs;
+        std::set<SessionId> dropped;
+
+        void deliver(SessionId sid, const std::string& bytes) override { outputs[sid] += bytes; }
+        void close(SessionId sid) override { dropped.insert(sid); }
+    };
+
+    // First line where two output streams part ways, for the mismatch report.
+    std::string first_difference(const std::string& expected, const std::string& actual) {
+        size_t at = 0;
+        while (at < expected.size() && at < actual.size() && expected[at] == actual[at]) at++;
+        const size_t line = expected.rfind('\n', at == 0 ? 0 : at - 1);
+        const size_t from = (line == std::string::npos || at == 0) ? 0 : line + 1;
+        auto line_at = [from](const std::string& s) {
+            if (from >= s.size()) return std::string("<end of output>");
+            return s.substr(from, s.find('\n', from) - from);
+        };
+        return "expected '" + line_at(expected) + "', got '" + line_at(actual) + "'";
+    }
+}
+
+int run_replay(const ReplayOptions& opts) {
+    using namespace std::chrono;
+
+    std::ifstream in(opts.path, std::ios::binary);
+    if (!in) {
+        std::cerr << "[ERR] Cannot open recording " << opts.path << "\n";
+        return 1;
+    }
+    const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ByteReader r{bytes.data(), bytes.data() + bytes.size()};
+
+    RecordingHeader header;
+    const uint32_t magic = r.get<uint32_t>();
+    const uint32_t version = r.get<uint32_t>();
+    header.seed = r.get<uint64_t>();
+    header.heartbeat.enabled = r.get<uint8_t>() != 0;
+    header.heartbeat.piggyback = r.get<uint8_t>() != 0;
+    header.heartbeat.ping_idle = milliseconds(r.get<uint32_t>());
+    if (!r.ok || magic != RECORDING_MAGIC || version != RECORDING_VERSION) {
+        std::cerr << "[ERR] " << opts.path << " is not a traffic recording\n";
+        return 1;
+    }
+
+    // Timers follow the recorded timestamps, not how fast the replay runs.
+    ManualClock clock;
+    CapturingSink sink;
+    SessionEngine engine(sink, header.heartbeat);
+    engine.set_clock(&clock);
+    RatingTable ratings("", {}, true);
+    engine.set_ratings(&ratings);
+    engine.seed_random(header.seed);
+
+    std::map<SessionId, std::string> expected;
+    std::set<SessionId> expected_dropped;
+    size_t inputs = 0;
+    size_t input_bytes = 0;
+
+    const auto start = steady_clock::now();
+    auto due = start;
+    while (r.ok && r.p < r.end) {
+        const auto kind = static_cast<RecordKind>(r.get<uint8_t>());
+        const microseconds delta(r.get<uint32_t>());
+        clock.advance(delta);
+        if (opts.realtime) {
+            due += delta;
+            std::this_thread::sleep_until(due);
+        }
+
+        switch (kind) {
+            case RecordKind::Open:
+                engine.open_session(r.get<uint64_t>());
+                inputs++;
+                break;
+            case RecordKind::Data: {
+                const SessionId sid = r.get<uint64_t>();
+                const std::string data = r.get_blob();
+                if (!r.ok) break;
+                engine.on_data(sid, data.data(), data.size());
+                inputs++;
+                input_bytes += data.size();
+                break;
+            }
+            case RecordKind::Closed:
+                engine.on_transport_closed(r.get<uint64_t>());
+                inputs++;
+                break;
+            case RecordKind::Tick:
+                engine.tick();
+                break;
+            case RecordKind::Configure: {
+                RuntimeConfig config;
+                config.ping_interval = milliseconds(r.get<int64_t>());
+                config.pong_timeout = milliseconds(r.get<int64_t>());
+                config.reconnect_grace = seconds(r.get<int64_t>());
+                config.move_deadline = seconds(r.get<int64_t>());
+                config.forfeit_after = static_cast<int>(r.get<int64_t>());
+                const RuleSet* rules = find_ruleset(r.get_string());
+                if (rules) config.default_rules = rules;
+                engine.configure(config);
+                break;
+            }
+            case RecordKind::Output: {
+                const SessionId sid = r.get<uint64_t>();
+                expected[sid] += r.get_blob();
+                break;
+            }
+            case RecordKind::Drop:
+                expected_dropped.insert(r.get<uint64_t>());
+                break;
+            default:
+                r.ok = false;
+                break;
+        }
+    }
+    const double elapsed = duration<double>(steady_clock::now() - start).count();
+
+    if (!r.ok) {
+        std::cerr << "[ERR] Recording is truncated or corrupt at byte " << (r.p - bytes.data())
+                  << "; comparing what was replayed\n";
+    }
+
+    size_t mismatched = 0;
+    std::set<SessionId> sessions;
+    for (const auto& kv : expected) sessions.insert(kv.first);
+    for (const auto& kv : sink.outputs) sessions.insert(kv.first);
+    for (SessionId sid : sessions) {
+        const std::string& want = expected[sid];
+        const std::string& got = sink.outputs[sid];
+        if (want == got && expected_dropped.count(sid) == sink.dropped.count(sid)) continue;
+        if (mismatched++ < 5) {
+            std::cout << "[REPLAY] session " << sid << " differs: "
+                      << (want == got ? std::string("close does not match") : first_difference(want, got)) << "\n";
+        }
+    }
+
+    std::cout << "[REPLAY] " << inputs << " inputs (" << input_bytes << " bytes) in " << elapsed << "s";
+    if (elapsed > 0) std::cout << ", " << static_cast<size_t>(inputs / elapsed) << " inputs/s";
+    std::cout << "\n[REPLAY] " << sessions.size() - mismatched << " of " << sessions.size()
+              << " sessions match the recording\n";
+    return mismatched == 0 && r.ok ? 0 : 1;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+struct ReplayOptions {
+    std::string path;
+    bool realtime{false};   // keep the recorded gaps between events instead of running flat out
+};
+
+// Feeds a --record capture into a fresh in-process SessionEngine, reports throughput and
+// checks every session's output against the recording. Returns 0 when all outputs match.
+int run_replay(const ReplayOptions& opts);
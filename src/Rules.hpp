@@ -0,0 +1,118 @@
+#pragma once
+
+#include "GameTypes.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+// Match rules as plain constexpr data. A lobby holds a pointer to one RuleSet, so
+// evaluating a round is a single table lookup and there is no virtual dispatch on the
+// move path; new rule sets are composed from the templates below at compile time.
+
+inline constexpr size_t MOVE_KINDS = static_cast<size_t>(MoveType::SPOCK) + 1;
+
+// outcomes[p1][p2]: 0 = draw, 1 = p1 wins, 2 = p2 wins. Indexed by MoveType.
+using OutcomeTable = std::array<std::array<uint8_t, MOVE_KINDS>, MOVE_KINDS>;
+
+struct MoveSet {
+    OutcomeTable outcomes;
+    uint32_t allowed;   // bit per MoveType
+};
+
+// Builds the table from (winner, loser) pairs; every other pairing is a draw.
+template <size_t N>
+constexpr MoveSet make_move_set(const std::array<std::pair<MoveType, MoveType>, N>& beats) {
+    MoveSet set{};
+    for (const auto& [winner, loser] : beats) {
+        const size_t w = static_cast<size_t>(winner);
+        const size_t l = static_cast<size_t>(loser);
+        set.outcomes[w][l] = 1;
+        set.outcomes[l][w] = 2;
+        set.allowed |= (1u << w) | (1u << l);
+    }
+    return set;
+}
+
+inline constexpr MoveSet RPS_MOVES = make_move_set<3>({{
+    {MoveType::ROCK, MoveType::SCISSORS},
+    {MoveType::PAPER, MoveType::ROCK},
+    {MoveType::SCISSORS, MoveType::PAPER},
+}});
+
+inline constexpr MoveSet RPSLS_MOVES = make_move_set<10>({{
+    {MoveType::ROCK, MoveType::SCISSORS},
+    {MoveType::ROCK, MoveType::LIZARD},
+    {MoveType::PAPER, MoveType::ROCK},
+    {MoveType::PAPER, MoveType::SPOCK},
+    {MoveType::SCISSORS, MoveType::PAPER},
+    {MoveType::SCISSORS, MoveType::LIZARD},
+    {MoveType::LIZARD, MoveType::PAPER},
+    {MoveType::LIZARD, MoveType::SPOCK},
+    {MoveType::SPOCK, MoveType::ROCK},
+    {MoveType::SPOCK, MoveType::SCISSORS},
+}});
+
+enum class MatchFormat {
+    FixedRounds,   // exactly N rounds, draws included
+    BestOf,        // ends once a player has won a majority of N
+    FirstTo        // ends once a player has won N rounds
+};
+
+struct RuleSet {
+    const char* name;
+    const MoveSet* moves;
+    MatchFormat format;
+    int target;
+
+    constexpr bool allows(MoveType m) const {
+        return m != MoveType::NONE && (moves->allowed & (1u << static_cast<size_t>(m))) != 0;
+    }
+
+    constexpr int evaluate(MoveType p1, MoveType p2) const {
+        return moves->outcomes[static_cast<size_t>(p1)][static_cast<size_t>(p2)];
+    }
+
+    constexpr bool matchOver(int roundsPlayed, int p1Wins, int p2Wins) const {
+        switch (format) {
+            case MatchFormat::FixedRounds: return roundsPlayed >= target;
+            case MatchFormat::BestOf:      return p1Wins > target / 2 || p2Wins > target / 2;
+            case MatchFormat::FirstTo:     return p1Wins >= target || p2Wins >= target;
+        }
+        return false;
+    }
+};
+
+template <const MoveSet& Moves, MatchFormat Format, int Target>
+struct Rules {
+    static_assert(Target > 0, "a match needs at least one round");
+    static_assert(Format != MatchFormat::BestOf || Target % 2 == 1, "best-of needs an odd round count");
+
+    static constexpr RuleSet make(const char* name) { return RuleSet{name, &Moves, Format, Target}; }
+};
+
+// Selectable at CREATE_LOBBY; the first entry is the default and matches the original rules.
+inline constexpr std::array<RuleSet, 7> RULESETS = {{
+    Rules<RPS_MOVES,   MatchFormat::FixedRounds, 3>::make("classic"),
+    Rules<RPS_MOVES,   MatchFormat::BestOf,      3>::make("rps-bo3"),
+    Rules<RPS_MOVES,   MatchFormat::BestOf,      5>::make("rps-bo5"),
+    Rules<RPS_MOVES,   MatchFormat::FirstTo,     3>::make("rps-ft3"),
+    Rules<RPSLS_MOVES, MatchFormat::BestOf,      3>::make("rpsls-bo3"),
+    Rules<RPSLS_MOVES, MatchFormat::BestOf,      5>::make("rpsls-bo5"),
+    Rules<RPSLS_MOVES, MatchFormat::FirstTo,     3>::make("rpsls-ft3"),
+}};
+
+inline constexpr const RuleSet& DEFAULT_RULES = RULESETS[0];
+
+static_assert(DEFAULT_RULES.evaluate(MoveType::ROCK, MoveType::SCISSORS) == 1);
+static_assert(RULESETS[4].evaluate(MoveType::SPOCK, MoveType::LIZARD) == 2);
+static_assert(!DEFAULT_RULES.allows(MoveType::LIZARD));
+
+inline const RuleSet* find_ruleset(std::string_view name) {
+    for (const auto& rules : RULESETS) {
+        if (name == rules.name) return &rules;
+    }
+    return nullptr;
+}
@@ -1,68 +1,117 @@
 #pragma once
 
-#include "Game.hpp"
-#include "Protocol.hpp"
+#include "Admission.hpp"
+#include "Cluster.hpp"
+#include "Config.hpp"
+#include "Reactor.hpp"
+#include "Recording.hpp"
+#include "SessionEngine.hpp"
 
-#include <unordered_map>
-#include <string>
-#include <sys/select.h>
 #include <chrono>
-#include <random>
+#include <string>
+#include <memory>
+#include <vector>
+
+class ShardedEngine;
+
+// Opt-in trades of CPU for response latency; all off by default.
+struct LatencyOptions {
+    bool tcp{false};                      // TCP_NODELAY and TCP_QUICKACK on client sockets
+    std::chrono::microseconds spin{0};    // poll without blocking this long while traffic flows
+    int busy_poll_us{0};                  // SO_BUSY_POLL on client sockets (0 = off)
+    int cpu{-1};                          // pin the I/O thread to this CPU (-1 = off)
+};
+
+struct ServerOptions {
+    std::string host{"0.0.0.0"};   // bind IP address
+    int port{10000};
+    HeartbeatOptions heartbeat;
+    IoBackend io_backend{IoBackend::Epoll};
+    size_t game_workers{0};        // 0 = game logic runs on the I/O thread
+    AdmissionOptions admission;
+    int stats_interval_s{0};       // 0 = no periodic [STATS] report
+    std::string history_dir;       // empty = match history is not recorded
+    std::string snapshot_path;     // empty = no snapshots, nothing restored
+    std::chrono::milliseconds snapshot_interval{1000};
+    std::string upgrade_socket;    // accept a newer process taking over here (empty = off)
+    std::string upgrade_from;      // take over from the process listening on this socket
+    std::string cluster_nodes;     // "host:port,..." shared by every node (empty = standalone)
+    std::string cluster_self;      // this node's entry in cluster_nodes
+    std::string cluster_secret;    // shared by every node; authenticates peer links
+    std::string config_path;       // runtime tunables, re-read on SIGHUP (empty = built-in values)
+    std::string record_path;       // capture engine traffic for --replay (empty = off)
+    std::string ratings_path;      // persist Elo ratings here (empty = kept in memory)
+    LatencyOptions latency;
+};
 
-class Server {
+// Socket transport: maps accepted fds to engine sessions and relays bytes both ways.
+class Server : private ReactorHandler, private SessionSink {
 public:
-    // Constructor also accepts 'host' (bind IP address)
-    explicit Server(const std::string& host, int port, bool enable_heartbeat = true, bool hb_logs = false);
+    explicit Server(const ServerOptions& options);
+    ~Server() override;
     void run();
 
 private:
     int listen_fd{-1};
 
-    fd_set master_set{};
-    int max_fd{0};
+    std::unique_ptr<Reactor> reactor;
+    std::unique_ptr<HistoryLog> history;   // outlives host, whose engines append to it
+    std::unique_ptr<SnapshotStore> snapshots;
+    std::unique_ptr<RatingTable> ratings;
+    std::unique_ptr<SessionHost> host;
+    ShardedEngine* sharded{nullptr};   // set when host runs on game workers
+    SessionEngine* engine{nullptr};    // set when host runs inline
+    int upgrade_fd{-1};
+    std::unique_ptr<TrafficRecorder> recorder;   // inline engine only
 
-    std::unordered_map<int, std::string> client_buffers;   // fd -> buffered incoming data
-    std::unordered_map<int, int> fd_to_player;             // fd -> userId
+    // Cluster mode: one outbound link per other node, reopened while it is down.
+    std::unique_ptr<ClusterMap> cluster;
+    std::vector<SessionId> peer_links;   // by node index, 0 = not connected
+    std::chrono::steady_clock::time_point next_peer_attempt;
 
-    Game game;
+    AdmissionController admission;
+    std::chrono::steady_clock::time_point batch_begin;
 
-    // --- Heartbeat ---
-    struct Heartbeat {
-        std::chrono::steady_clock::time_point last_ping;
-        std::chrono::steady_clock::time_point last_pong;
-        std::string last_nonce;
-    };
+    std::string config_path;
+    RuntimeConfig config;
 
-    bool heartbeat_enabled{true};
-    bool heartbeat_logs{false};
+    LatencyOptions latency;
+    bool busy_poll_refused{false};
 
-    std::unordered_map<int, Heartbeat> heartbeats;         // fd -> heartbeat state
+    std::chrono::seconds stats_interval{0};
+    std::chrono::steady_clock::time_point next_stats;
 
-    std::mt19937 rng{std::random_device{}()};
-    std::uniform_int_distribution<int> nonce_dist{100000, 999999};
+    // Indexed by fd, 0 = none. A session id carries its fd in the low 32 bits and a
+    // serial in the high bits, so neither direction needs a hash map.
+    std::vector<SessionId> fd_sessions;
+    uint32_t next_serial{1};
+    size_t open_sessions{0};
 
-    std::unordered_map<int, std::chrono::steady_clock::time_point> disconnected_players; // userId -> disconnect time
+    // Sessions whose broadcast backlog overflowed; dropped after the current batch.
+    std::vector<SessionId> slow_sessions;
 
     void init_socket(const std::string& host, int port);
-
-    void accept_client();
-    void remove_client(int fd);
-
-    void handle_client_data(int fd);
-    void handle_request(int fd, const Request& req);
-
-    void send_line(int fd, const std::string& line);
-
-    SessionPhase get_phase(int fd) const;
-    bool is_request_allowed(SessionPhase phase, RequestType type) const;
-
-    void notify_lobby_peers_player_left(int playerId, const std::string& reason);
-
-    void check_disconnection_timeouts();
-
-    int find_disconnected_player_by_name(const std::string& name);
-
-    void disconnect_fd(int fd, const std::string& reason, bool allow_soft_disconnect = true);
-
-    void heartbeat_tick();
+    void take_over(const std::string& upgrade_path);
+    bool hand_over();
+    void connect_peers();
+    void apply_config();
+    void reload_config();
+    void tune_client_socket(int fd);
+    bool wait_for_events(bool spin);
+
+    SessionId add_session(int fd);
+    SessionId session_of(int fd) const;
+    int fd_of(SessionId sid) const;
+    void report_stats();
+    void drop_slow_sessions();
+
+    void on_accept(int fd) override;
+    void on_data(int fd, const char* data, size_t len) override;
+    void on_hangup(int fd) override;
+    void on_wakeup() override;
+    void on_batch_begin() override;
+
+    void deliver(SessionId sid, const std::string& bytes) override;
+    void deliver_shared(SessionId sid, const SharedBytes& bytes) override;
+    void close(SessionId sid) override;
 };
@@ -0,0 +1,2103 @@
+#include "SessionEngine.hpp"
+#include "AllocStats.hpp"
+#include "Probes.hpp"
+
+#include <sys/random.h>
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <optional>
+#include <random>
+#include <vector>
+
+static std::string phase_to_debug(SessionPhase ph) {
+    switch (ph) {
+        case SessionPhase::NotLoggedIn:      return "NotLoggedIn";
+        case SessionPhase::LoggedInNoLobby:  return "LoggedInNoLobby";
+        case SessionPhase::InLobby:          return "InLobby";
+        case SessionPhase::InGame:           return "InGame";
+        case SessionPhase::AFTER_GAME:       return "AfterGame";
+        case SessionPhase::INVALID:          return "Invalid";
+    }
+    return "Unknown";
+}
+
+struct LobbySnapshot {
+    std::string name;
+    size_t size;
+};
+
+static std::optional<LobbySnapshot> snapshot_lobby_of(Game& game, int userId) {
+    auto lobbyOpt = game.getLobbyOf(userId);
+    if (!lobbyOpt.has_value()) return std::nullopt;
+    Lobby* lobby = lobbyOpt.value();
+    if (!lobby) return std::nullopt;
+    return LobbySnapshot{lobby->name, lobby->players.size()};
+}
+
+static SessionPhase lobby_phase(const Lobby& lobby) {
+    if (lobby.matchJustEnded) return SessionPhase::AFTER_GAME;
+    if (lobby.inGame) return SessionPhase::InGame;
+    return SessionPhase::InLobby;
+}
+
+// The lobby part of a STATE line, in wire order. viewerId is the player asking, 0 for a spectator.
+static void lobby_state_fields(const Lobby& lobby, int viewerId, std::vector<StateField>& out) {
+    out.emplace_back("rules", lobby.rules->name);
+    out.emplace_back("score", std::to_string(lobby.p1Wins) + ":" + std::to_string(lobby.p2Wins));
+
+    if (lobby.players.size() >= 1) {
+        out.emplace_back("p1Id", std::to_string(lobby.players[0].userId));
+        out.emplace_back("p1Name", lobby.players[0].username);
+    }
+    if (lobby.players.size() >= 2) {
+        out.emplace_back("p2Id", std::to_string(lobby.players[1].userId));
+        out.emplace_back("p2Name", lobby.players[1].username);
+    }
+
+    if (lobby.inGame && viewerId > 0) {
+        MoveType myMove = MoveType::NONE;
+        if (!lobby.players.empty() && lobby.players[0].userId == viewerId) {
+            myMove = lobby.p1Move;
+        } else if (lobby.players.size() > 1 && lobby.players[1].userId == viewerId) {
+            myMove = lobby.p2Move;
+        }
+
+        const bool hasMoved = myMove != MoveType::NONE;
+        out.emplace_back("hasMoved", hasMoved ? "true" : "false");
+        if (hasMoved) {
+            const std::string mv = move_to_string(myMove);
+            out.emplace_back("lastMove", mv.empty() ? "?" : mv);
+        }
+    }
+}
+
+static void append_fields(std::string& out, const std::vector<StateField>& fields) {
+    for (const auto& f : fields) {
+        out += f.first;
+        out += '=';
+        out += f.second;
+        out += ';';
+    }
+}
+
+static LatencyHistogram process_rtt_histogram;
+
+// Matches returned by one REQ_HISTORY.
+static constexpr size_t HISTORY_QUERY_LIMIT = 10;
+
+// Players listed by REQ_LEADERBOARD without a size.
+static constexpr size_t LEADERBOARD_DEFAULT_PAGE = 10;
+
+// Timer deadlines (liveness checks, move deadlines) are rounded up to this so nearby ones
+// fire in one pass.
+static constexpr auto TIMER_QUANTUM = std::chrono::milliseconds(250);
+
+static std::chrono::steady_clock::time_point round_up_to_quantum(std::chrono::steady_clock::time_point when) {
+    using namespace std::chrono;
+    const auto q = duration_cast<steady_clock::duration>(TIMER_QUANTUM);
+    return steady_clock::time_point(((when.time_since_epoch() + q - steady_clock::duration(1)) / q) * q);
+}
+
+void RttStats::add(std::chrono::microseconds sample) {
+    if (samples == 0) {
+        smoothed = min = max = sample;
+    } else {
+        smoothed += (sample - smoothed) / 8;
+        if (sample < min) min = sample;
+        if (sample > max) max = sample;
+    }
+    samples++;
+}
+
+static bool parse_nonce(const std::string& s, uint32_t& out) {
+    const auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+    return res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+static bool parse_rounds(const std::string& s, int& out) {
+    const auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+    return res.ec == std::errc() && res.ptr == s.data() + s.size() && out > 0;
+}
+
+static bool parse_page(const std::string& s, size_t& out) {
+    const auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+    return res.ec == std::errc() && res.ptr == s.data() + s.size() && out > 0;
+}
+
+static bool parse_version(const std::string& s, uint64_t& out) {
+    const auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+    return res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+static bool parse_node_index(const std::string& s, int& out) {
+    const auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+    return res.ec == std::errc() && res.ptr == s.data() + s.size() && out >= 0;
+}
+
+static std::string format_ms(std::chrono::microseconds us) {
+    std::ostringstream oss;
+    oss << us.count() / 1000 << "." << (us.count() % 1000) / 100;
+    return oss.str();
+}
+
+const LatencyHistogram& SessionEngine::rtt_histogram() {
+    return process_rtt_histogram;
+}
+
+void SessionEngine::release_lobby_name(const std::string& lobbyName) {
+    auto it = active_lobbies.find(lobbyName);
+    if (it != active_lobbies.end()) {
+        active_lobbies.erase(it);
+        std::cerr << "[SYS] Lobby '" << lobbyName << "' destroyed. Name released.\n";
+    }
+    release_spectators(lobbyName);
+}
+
+void SessionEngine::start_spectating(SessionId sid, const std::string& lobbyName) {
+    stop_spectating(sid);
+    spectating[sid] = lobbyName;
+    lobby_spectators[lobbyName].push_back(sid);
+}
+
+void SessionEngine::stop_spectating(SessionId sid) {
+    auto it = spectating.find(sid);
+    if (it == spectating.end()) return;
+
+    auto lit = lobby_spectators.find(it->second);
+    if (lit != lobby_spectators.end()) {
+        auto& list = lit->second;
+        for (size_t i = 0; i < list.size(); i++) {
+            if (list[i] == sid) {
+                list[i] = list.back();
+                list.pop_back();
+                break;
+            }
+        }
+        if (list.empty()) lobby_spectators.erase(lit);
+    }
+    spectating.erase(it);
+}
+
+void SessionEngine::release_spectators(const std::string& lobbyName) {
+    auto it = lobby_spectators.find(lobbyName);
+    if (it == lobby_spectators.end()) return;
+
+    std::vector<SessionId> watchers = std::move(it->second);
+    lobby_spectators.erase(it);
+    for (SessionId sid : watchers) spectating.erase(sid);
+
+    notify(watchers, Responses::lobby_left());
+}
+
+void SessionEngine::notify_spectators(const std::string& lobbyName, const std::string& line) {
+    auto it = lobby_spectators.find(lobbyName);
+    if (it == lobby_spectators.end()) return;
+    notify(it->second, line);
+}
+
+// Serializes once; every recipient shares the same immutable buffer.
+void SessionEngine::notify(const std::vector<SessionId>& targets, const std::string& line) {
+    if (targets.empty()) return;
+    AllocScope scope(AllocSubsystem::Output);
+    const SharedBytes bytes = std::make_shared<const std::string>(line + "\n");
+    for (SessionId sid : targets) sink.deliver_shared(sid, bytes);
+}
+
+void SessionEngine::bind_player(SessionId sid, int userId) {
+    session_to_player[sid] = userId;
+    player_sessions[userId] = sid;
+}
+
+void SessionEngine::unbind_player(SessionId sid, int userId) {
+    auto it = player_sessions.find(userId);
+    if (it != player_sessions.end() && it->second == sid) player_sessions.erase(it);
+}
+
+void SessionEngine::send_to_player(int userId, const std::string& line) {
+    auto it = player_sessions.find(userId);
+    if (it != player_sessions.end()) send_line(it->second, line);
+}
+
+// A bracket match is over: both players go back to the menu and the bracket moves on.
+void SessionEngine::finish_bracket_match(Lobby* lobby, int winnerUserId) {
+    const int lobbyId = lobby->lobbyId;
+    const std::string lobbyName = lobby->name;
+    std::vector<int> playerIds;
+    for (auto& p : lobby->players) playerIds.push_back(p.userId);
+
+    for (int userId : playerIds) {
+        game.leaveLobby(userId);
+        send_to_player(userId, Responses::lobby_left());
+    }
+    release_lobby_name(lobbyName);
+
+    std::vector<BracketEvent> events;
+    tournaments.matchEnded(lobbyId, winnerUserId, events);
+    apply_bracket_events(events);
+}
+
+void SessionEngine::apply_bracket_events(const std::vector<BracketEvent>& events) {
+    for (const auto& ev : events) {
+        switch (ev.kind) {
+            case BracketEvent::Kind::MatchStarted:
+                active_lobbies.insert(ev.lobbyName);
+                matchmaker.remove(ev.p1);
+                matchmaker.remove(ev.p2);
+                if (auto lobbyOpt = game.findLobby(ev.lobbyName); lobbyOpt.has_value()) {
+                    arm_move_deadline(*lobbyOpt.value(), true);
+                }
+                send_to_player(ev.p1, Responses::tourney_match(ev.tournament, ev.round, ev.lobbyName, online_users[ev.p2]));
+                send_to_player(ev.p2, Responses::tourney_match(ev.tournament, ev.round, ev.lobbyName, online_users[ev.p1]));
+                for (int userId : {ev.p1, ev.p2}) {
+                    send_to_player(userId, Responses::lobby_joined(ev.lobbyName));
+                    send_to_player(userId, Responses::game_started(move_deadline_seconds()));
+                }
+                break;
+
+            case BracketEvent::Kind::MatchAbandoned:
+                // MatchDecided follows with the forfeit.
+                send_to_player(ev.p1, Responses::game_cannot_continue("Opponent left the tournament"));
+                send_to_player(ev.p1, Responses::lobby_left());
+                notify_spectators(ev.lobbyName, Responses::game_cannot_continue("Opponent left the tournament"));
+                release_lobby_name(ev.lobbyName);
+                break;
+
+            case BracketEvent::Kind::Bye:
+                send_to_player(ev.p1, Responses::tourney_bye(ev.tournament, ev.round));
+                break;
+
+            case BracketEvent::Kind::MatchDecided:
+                send_to_player(ev.p1, Responses::tourney_result(ev.tournament, ev.round, ev.winner));
+                if (ev.p2 != -1) send_to_player(ev.p2, Responses::tourney_result(ev.tournament, ev.round, ev.winner));
+                break;
+
+            case BracketEvent::Kind::Finished: {
+                std::cerr << "[SYS] Tournament '" << ev.tournament << "' finished after round " << ev.round
+                          << ", winner " << ev.winner << "\n";
+                std::vector<SessionId> targets;
+                targets.reserve(ev.audience.size());
+                for (int userId : ev.audience) {
+                    auto it = player_sessions.find(userId);
+                    if (it != player_sessions.end()) targets.push_back(it->second);
+                }
+                notify(targets, Responses::tourney_end(ev.tournament, ev.winner));
+                break;
+            }
+        }
+    }
+}
+
+void SessionEngine::release_username(int userId) {
+    revoke_resume_token(userId);
+    matchmaker.remove(userId);
+
+    std::vector<BracketEvent> events;
+    tournaments.withdraw(userId, events);
+    apply_bracket_events(events);
+
+    auto it = online_users.find(userId);
+    if (it == online_users.end()) return;
+    const std::string name = it->second;
+    online_users.erase(it);
+    sink.user_offline(name);
+    release_claim(name);
+}
+
+SessionEngine::SessionEngine(SessionSink& sink, const HeartbeatOptions& heartbeat)
+    : sink(sink), heartbeat(heartbeat) {}
+
+SessionEngine::~SessionEngine() {
+    for (auto& kv : sessions) {
+        if (kv.second.pending) line_buffers.release(kv.second.pending);
+    }
+}
+
+void SessionEngine::configure(const RuntimeConfig& runtime) {
+    config = runtime;
+    tournaments.setRules(*config.default_rules);
+}
+
+void SessionEngine::set_id_space(int first, int stride) {
+    game.setIdSpace(first, stride);
+}
+
+void SessionEngine::seed_random(uint64_t seed) {
+    rng.seed(static_cast<std::mt19937::result_type>(seed));
+    token_rng.seed(seed);
+    tokens_seeded = true;
+}
+
+void SessionEngine::set_clock(const Clock* source) {
+    clock = source;
+}
+
+void SessionEngine::set_admission(const AdmissionController* controller) {
+    admission = controller;
+}
+
+void SessionEngine::set_ratings(RatingTable* table) {
+    ratings = table;
+}
+
+void SessionEngine::set_history(HistoryLog* log) {
+    history = log;
+}
+
+void SessionEngine::set_snapshots(SnapshotStore* store) {
+    snapshots = store;
+    game.trackChanges(store != nullptr);
+}
+
+// Runs on the game thread: only lobbies touched since the last capture are encoded.
+void SessionEngine::capture_snapshot() {
+    const auto now = clock->now();
+    if (now < next_snapshot) return;
+    next_snapshot = now + snapshots->interval();
+
+    for (int lobbyId : game.takeChangedLobbies()) {
+        auto lobbyOpt = game.findLobbyById(lobbyId);
+        // Brackets are not persisted; their lobbies end with the tournament.
+        if (!lobbyOpt.has_value() || tournaments.isBracketLobby(lobbyId)) {
+            snapshots->update(lobbyId, {});
+            continue;
+        }
+        snapshots->update(lobbyId, SnapshotStore::encode(capture_lobby(*lobbyOpt.value())));
+    }
+}
+
+LobbyImage SessionEngine::capture_lobby(const Lobby& lobby) const {
+    using namespace std::chrono;
+    const auto now = clock->now();
+    const int64_t now_unix = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+
+    LobbyImage image;
+    image.lobby = lobby;
+    for (const auto& p : lobby.players) {
+        LobbyImage::Seat seat;
+        auto tok = user_tokens.find(p.userId);
+        if (tok != user_tokens.end()) seat.resumeToken = tok->second;
+        auto dc = disconnected_players.find(p.userId);
+        if (dc != disconnected_players.end()) {
+            seat.disconnectedUnixMs = now_unix - duration_cast<milliseconds>(now - dc->second).count();
+        }
+        image.seats.push_back(std::move(seat));
+    }
+    return image;
+}
+
+// Every restored player starts soft-disconnected.
+size_t SessionEngine::restore_lobbies(const std::vector<LobbyImage>& images,
+                                      const std::function<bool(const Lobby&)>& owns) {
+    using namespace std::chrono;
+    const auto now = clock->now();
+    const int64_t now_unix = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+
+    int maxUserId = 0;
+    int maxLobbyId = 0;
+    size_t restored = 0;
+    for (const auto& image : images) {
+        const Lobby& lobby = image.lobby;
+        maxLobbyId = std::max(maxLobbyId, lobby.lobbyId);
+        for (const auto& p : lobby.players) maxUserId = std::max(maxUserId, p.userId);
+
+        if (owns && !owns(lobby)) continue;
+        if (!game.restoreLobby(lobby)) continue;
+        active_lobbies.insert(lobby.name);
+        restored++;
+
+        for (size_t i = 0; i < lobby.players.size(); i++) {
+            const Player& p = lobby.players[i];
+            const LobbyImage::Seat& seat = image.seats[i];
+            online_users[p.userId] = p.username;
+
+            // The grace window starts now unless it was already running.
+            auto since = now;
+            if (seat.disconnectedUnixMs > 0) {
+                since -= milliseconds(std::clamp<int64_t>(now_unix - seat.disconnectedUnixMs, 0, 60000));
+            }
+            disconnected_players[p.userId] = since;
+
+            if (!seat.resumeToken.empty() && resume_tokens.find(seat.resumeToken) == resume_tokens.end()) {
+                resume_tokens[seat.resumeToken] = p.userId;
+                user_tokens[p.userId] = seat.resumeToken;
+                sink.resume_token_issued(seat.resumeToken, p.username);
+            }
+        }
+    }
+    game.reserveIds(maxUserId, maxLobbyId);
+    return restored;
+}
+
+void SessionEngine::restore_snapshot(const std::vector<LobbyImage>& images,
+                                     const std::function<bool(const Lobby&)>& owns) {
+    // The restart cut everyone off; they get the usual window to come back.
+    const size_t restored = restore_lobbies(images, owns);
+    if (restored > 0) {
+        std::cerr << "[SYS] Restored " << restored << " lobbies from snapshot. Waiting "
+                  << config.reconnect_grace.count() << "s for reconnects.\n";
+    }
+}
+
+bool SessionEngine::export_image(EngineImage& out, std::string& why_not) {
+    if (tournaments.count() > 0) {
+        why_not = "a tournament is in progress";
+        return false;
+    }
+    if (cluster) {
+        why_not = "cluster links cannot be handed over";
+        return false;
+    }
+
+    out = EngineImage{};
+    out.lastUserId = game.lastUserId();
+    out.lastLobbyId = game.lastLobbyId();
+
+    std::set<int> seen;
+    for (const auto& kv : online_users) {
+        auto lobbyOpt = game.getLobbyOf(kv.first);
+        if (lobbyOpt.has_value() && seen.insert(lobbyOpt.value()->lobbyId).second) {
+            out.lobbies.push_back(capture_lobby(*lobbyOpt.value()));
+        }
+    }
+
+    for (const auto& kv : sessions) {
+        SessionImage image;
+        image.sid = kv.first;
+        if (kv.second.pending) image.pending = *kv.second.pending;
+
+        auto player = session_to_player.find(kv.first);
+        if (player != session_to_player.end()) {
+            image.userId = player->second;
+            image.username = online_users.at(player->second);
+            auto tok = user_tokens.find(player->second);
+            if (tok != user_tokens.end()) image.resumeToken = tok->second;
+        }
+        auto watched = spectating.find(kv.first);
+        if (watched != spectating.end()) image.spectating = watched->second;
+        image.subscribed = state_subscribers.count(kv.first) > 0;
+        image.queued = image.userId != 0 && matchmaker.contains(image.userId);
+        out.sessions.push_back(std::move(image));
+    }
+    return true;
+}
+
+void SessionEngine::import_image(const EngineImage& image) {
+    restore_lobbies(image.lobbies, {});
+    game.reserveIds(image.lastUserId, image.lastLobbyId);
+
+    // Players with a connection are simply reattached; the rest keep their grace window.
+    for (const auto& s : image.sessions) {
+        open_session(s.sid);
+        if (!s.pending.empty()) {
+            std::string*& pending = sessions[s.sid].pending;
+            pending = line_buffers.acquire();
+            pending->assign(s.pending);
+        }
+
+        if (s.userId != 0) {
+            if (!game.hasPlayer(s.userId)) game.adoptPlayer(Player{s.userId, s.username});
+            online_users[s.userId] = s.username;
+            bind_player(s.sid, s.userId);
+            disconnected_players.erase(s.userId);
+
+            if (!s.resumeToken.empty() && user_tokens.find(s.userId) == user_tokens.end()) {
+                resume_tokens[s.resumeToken] = s.userId;
+                user_tokens[s.userId] = s.resumeToken;
+                sink.resume_token_issued(s.resumeToken, s.username);
+            }
+        }
+        if (!s.spectating.empty() && game.findLobby(s.spectating).has_value()) {
+            start_spectating(s.sid, s.spectating);
+        }
+        if (s.subscribed) set_state_subscription(s.sid, true);
+    }
+
+    // Games carried over start their current round's clock again.
+    for (const auto& l : image.lobbies) {
+        auto lobby = game.findLobbyById(l.lobby.lobbyId);
+        if (!lobby.has_value() || !lobby.value()->inGame) continue;
+        bool seated = true;
+        for (const auto& p : lobby.value()->players) seated = seated && !disconnected_players.count(p.userId);
+        if (seated) arm_move_deadline(*lobby.value(), false);
+    }
+
+    // Queued players rejoin with a fresh wait.
+    for (const auto& s : image.sessions) {
+        if (s.queued && s.userId != 0) enqueue_player(s.userId);
+    }
+}
+
+void SessionEngine::set_cluster(const ClusterMap* map) {
+    cluster = map;
+
+    // Players restored from a snapshot keep their names. Those homed here are claimed now,
+    // the rest once the link to their home node is up (attach_peer).
+    if (!cluster) return;
+    for (const auto& kv : online_users) {
+        if (cluster->home_of_user(kv.second) == cluster->self()) name_claims.emplace(kv.second, cluster->self());
+    }
+}
+
+void SessionEngine::attach_peer(SessionId sid, int node) {
+    peer_nodes[sid] = node;
+    peer_links[node] = sid;
+    send_line(sid, PeerMessages::hello(cluster->self(), cluster->shared_secret()));
+
+    // The node may have restarted and forgotten our claims; renew the ones it is home to.
+    for (const auto& kv : online_users) {
+        if (cluster->home_of_user(kv.second) == node) send_line(sid, PeerMessages::claim(kv.second));
+    }
+    std::cerr << "[SYS] Cluster link to " << cluster->node(node).address() << " up session=" << sid << "\n";
+}
+
+void SessionEngine::drop_peer(SessionId sid) {
+    auto it = peer_nodes.find(sid);
+    if (it == peer_nodes.end()) return;
+    const int node = it->second;
+    peer_nodes.erase(it);
+
+    auto link = peer_links.find(node);
+    if (link != peer_links.end() && link->second == sid) {
+        // Logins waiting on that node's directory fail; the client may simply retry.
+        peer_links.erase(link);
+        for (auto p = pending_claims.begin(); p != pending_claims.end();) {
+            if (cluster->home_of_user(p->first) == node) {
+                send_line(p->second, Responses::error("Directory unavailable"));
+                p = pending_claims.erase(p);
+            } else {
+                ++p;
+            }
+        }
+        std::cerr << "[SYS] Cluster link to " << cluster->node(node).address() << " down\n";
+        return;
+    }
+
+    // The node's names go with it; if it is still alive it renews them on reconnect.
+    size_t released = 0;
+    for (auto c = name_claims.begin(); c != name_claims.end();) {
+        if (c->second == node) {
+            c = name_claims.erase(c);
+            released++;
+        } else {
+            ++c;
+        }
+    }
+    std::cerr << "[SYS] Cluster peer " << cluster->node(node).address() << " gone, released "
+              << released << " names\n";
+}
+
+void SessionEngine::login_player(SessionId sid, const std::string& username) {
+    int userId = game.addPlayer(username);
+    bind_player(sid, userId);
+    online_users[userId] = username;
+    send_line(sid, Responses::login_ok(userId, issue_resume_token(userId)));
+}
+
+// LOGIN completes here, or when the home node answers PEER_CLAIM.
+void SessionEngine::claim_username(SessionId sid, const std::string& username) {
+    const int home = cluster->home_of_user(username);
+    if (home == cluster->self()) {
+        if (!name_claims.emplace(username, home).second) {
+            send_line(sid, Responses::error("Name already in use"));
+            return;
+        }
+        login_player(sid, username);
+        return;
+    }
+
+    auto link = peer_links.find(home);
+    if (link == peer_links.end()) {
+        send_line(sid, Responses::error("Directory unavailable"));
+        return;
+    }
+    if (!pending_claims.emplace(username, sid).second) {
+        send_line(sid, Responses::error("Name already in use"));
+        return;
+    }
+    send_line(link->second, PeerMessages::claim(username));
+}
+
+void SessionEngine::release_claim(const std::string& username) {
+    if (!cluster) return;
+    const int home = cluster->home_of_user(username);
+    if (home == cluster->self()) {
+        auto it = name_claims.find(username);
+        if (it != name_claims.end() && it->second == home) name_claims.erase(it);
+        return;
+    }
+    auto link = peer_links.find(home);
+    if (link != peer_links.end()) send_line(link->second, PeerMessages::release(username));
+}
+
+// Only CLAIMED ever goes back over a link, so a misbehaving peer cannot start an error echo.
+void SessionEngine::handle_peer_request(SessionId sid, const Request& req) {
+    if (req.type == RequestType::PEER_HELLO) {
+        int node = -1;
+        if (req.params.size() != 2 || !parse_node_index(req.params[0], node) || peer_nodes.count(sid) ||
+            is_logged_in(sid) || node == cluster->self() || node >= static_cast<int>(cluster->size()) ||
+            !cluster->admits(req.params[1])) {
+            std::cerr << "[ERR] Rejected cluster peer session=" << sid << "\n";
+            send_line(sid, Responses::error_unexpected_state());
+            disconnect_session(sid, "BAD_PEER");
+            return;
+        }
+        peer_nodes[sid] = node;
+        std::cerr << "[SYS] Cluster peer " << cluster->node(node).address() << " connected session=" << sid << "\n";
+        return;
+    }
+
+    const int node = peer_nodes.at(sid);
+    switch (req.type) {
+        case RequestType::PEER_CLAIM: {
+            if (req.params.size() != 1) break;
+            const std::string& name = req.params[0];
+            bool granted = false;
+            if (cluster->home_of_user(name) == cluster->self()) {
+                auto [it, inserted] = name_claims.emplace(name, node);
+                granted = inserted || it->second == node;
+            }
+            send_line(sid, PeerMessages::claimed(name, granted));
+            break;
+        }
+
+        case RequestType::PEER_RELEASE: {
+            if (req.params.size() != 1) break;
+            auto it = name_claims.find(req.params[0]);
+            if (it != name_claims.end() && it->second == node) name_claims.erase(it);
+            break;
+        }
+
+        case RequestType::PEER_CLAIMED: {
+            if (req.params.size() != 2) break;
+            const std::string& name = req.params[0];
+            const bool granted = req.params[1] == "1";
+            // Only the name's home node decides who holds it.
+            if (cluster->home_of_user(name) != node) {
+                std::cerr << "[ERR] Ignored claim answer for '" << name << "' from node " << node << "\n";
+                break;
+            }
+
+            auto pending = pending_claims.find(name);
+            if (pending == pending_claims.end()) {
+                if (!granted) std::cerr << "[ERR] Username '" << name << "' is also held on another node\n";
+                break;
+            }
+            const SessionId waiting = pending->second;
+            pending_claims.erase(pending);
+
+            if (!granted) {
+                send_line(waiting, Responses::error("Name already in use"));
+            } else if (sessions.find(waiting) == sessions.end() || is_logged_in(waiting)) {
+                release_claim(name);
+            } else {
+                login_player(waiting, name);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+// Sends a request about a lobby owned elsewhere to its node. The client is logged out
+// here, so its name is free to log in again over there.
+bool SessionEngine::redirect_if_remote(SessionId sid, const Request& req) {
+    if (!cluster) return false;
+    std::string lobbyName;
+    switch (req.type) {
+        case RequestType::CREATE_LOBBY:
+        case RequestType::JOIN_LOBBY:
+        case RequestType::SPECTATE:
+        case RequestType::TOURNEY_CREATE:
+        case RequestType::TOURNEY_JOIN:
+        case RequestType::TOURNEY_START:
+            if (req.params.empty()) return false;
+            lobbyName = req.params[0];
+            break;
+        case RequestType::QUEUE:
+            lobbyName = Matchmaker::POOL;
+            break;
+        default:
+            return false;
+    }
+
+    const int owner = cluster->owner_of_lobby(lobbyName);
+    if (owner == cluster->self()) return false;
+    send_line(sid, Responses::redirect(cluster->node(owner).address()));
+    disconnect_session(sid, "REDIRECT");
+    return true;
+}
+
+int SessionEngine::rating_of(int userId) {
+    RatingTable::Standing s;
+    if (ratings && ratings->standing(online_users[userId], s)) return s.rating;
+    return RatingTable::INITIAL_RATING;
+}
+
+void SessionEngine::enqueue_player(int userId) {
+    std::vector<Pairing> pairings;
+    matchmaker.enqueue(userId, rating_of(userId), clock->now(), pairings);
+    seat_pairings(std::move(pairings));
+}
+
+// Seats each pairing in a fresh "<POOL>#<n>" lobby under the default rules and starts the
+// game. A player who got into a lobby some other way meanwhile is skipped and the other
+// one goes back to the queue.
+void SessionEngine::seat_pairings(std::vector<Pairing> pairings) {
+    for (size_t i = 0; i < pairings.size(); i++) {
+        const Pairing pr = pairings[i];
+        const bool free1 = online_users.count(pr.p1) && !game.getLobbyOf(pr.p1).has_value();
+        const bool free2 = online_users.count(pr.p2) && !game.getLobbyOf(pr.p2).has_value();
+        if (!free1 || !free2) {
+            if (free1) matchmaker.enqueue(pr.p1, pr.p1Rating, clock->now(), pairings);
+            if (free2) matchmaker.enqueue(pr.p2, pr.p2Rating, clock->now(), pairings);
+            continue;
+        }
+
+        std::string lobbyName;
+        do {
+            lobbyName = std::string(Matchmaker::POOL) + "#" + std::to_string(next_queue_lobby++);
+        } while (active_lobbies.count(lobbyName) || game.findLobby(lobbyName).has_value());
+
+        if (!game.createLobby(pr.p1, lobbyName, *config.default_rules).has_value() ||
+            !game.joinLobby(pr.p2, lobbyName)) {
+            std::cerr << "[ERR] Cannot seat queue match " << lobbyName << "\n";
+            game.leaveLobby(pr.p1);
+            continue;
+        }
+        active_lobbies.insert(lobbyName);
+        Lobby* lobby = game.getLobbyOf(pr.p1).value();
+        game.startGame(lobby);
+        arm_move_deadline(*lobby, true);
+
+        for (int userId : {pr.p1, pr.p2}) {
+            auto session = player_sessions.find(userId);
+            if (session != player_sessions.end()) stop_spectating(session->second);
+        }
+        send_to_player(pr.p1, Responses::match_found(lobbyName, online_users[pr.p2], pr.p2Rating));
+        send_to_player(pr.p2, Responses::match_found(lobbyName, online_users[pr.p1], pr.p1Rating));
+        for (int userId : {pr.p1, pr.p2}) {
+            send_to_player(userId, Responses::lobby_joined(lobbyName));
+            send_to_player(userId, Responses::game_started(move_deadline_seconds()));
+        }
+    }
+}
+
+void SessionEngine::announce_round(Lobby* lobby, int roundWinner, MoveType m1, MoveType m2, bool matchEnded) {
+    const std::string result = Responses::round_result(roundWinner, move_to_string(m1), move_to_string(m2),
+                                                       lobby->p1Wins, lobby->p2Wins,
+                                                       matchEnded ? 0 : move_deadline_seconds());
+    for (auto& p : lobby->players) {
+        for (auto& kv : session_to_player) {
+            if (kv.second == p.userId) send_line(kv.first, result);
+        }
+    }
+    notify_spectators(lobby->name, result);
+    record_history(*lobby, HistoryRecord::ROUND, m1, m2, roundWinner);
+}
+
+void SessionEngine::announce_match_end(Lobby* lobby, int matchWinner, int p1Wins, int p2Wins) {
+    round_clocks.erase(lobby->lobbyId);
+
+    const std::string result = Responses::match_result(matchWinner, p1Wins, p2Wins);
+    for (auto& p : lobby->players) {
+        for (auto& kv : session_to_player) {
+            if (kv.second == p.userId) send_line(kv.first, result);
+        }
+    }
+    notify_spectators(lobby->name, result);
+    record_history(*lobby, HistoryRecord::MATCH, MoveType::NONE, MoveType::NONE, matchWinner);
+    if (ratings && lobby->players.size() == 2) {
+        const int winner = matchWinner == 0 ? 0 : (matchWinner == lobby->players[0].userId ? 1 : 2);
+        ratings->record_match(lobby->players[0].username, lobby->players[1].username, winner);
+    }
+
+    if (tournaments.isBracketLobby(lobby->lobbyId)) finish_bracket_match(lobby, matchWinner);
+}
+
+int SessionEngine::move_deadline_seconds() const {
+    return static_cast<int>(config.move_deadline.count());
+}
+
+// Starts the clock on the current round of a running game. fresh forgets earlier misses.
+void SessionEngine::arm_move_deadline(const Lobby& lobby, bool fresh) {
+    if (config.move_deadline.count() <= 0) return;
+    RoundClock& rc = round_clocks[lobby.lobbyId];
+    if (fresh) rc.p1Missed = rc.p2Missed = 0;
+    rc.deadline = round_up_to_quantum(clock->now() + config.move_deadline);
+    move_deadlines_due[rc.deadline].push_back(lobby.lobbyId);
+}
+
+void SessionEngine::expire_move_deadlines() {
+    AllocScope scope(AllocSubsystem::Timers);
+    const auto now = clock->now();
+
+    while (!move_deadlines_due.empty() && move_deadlines_due.begin()->first <= now) {
+        auto due = move_deadlines_due.extract(move_deadlines_due.begin());
+        for (int lobbyId : due.mapped()) {
+            auto rc = round_clocks.find(lobbyId);
+            if (rc == round_clocks.end() || rc->second.deadline != due.key()) continue;   // round moved on
+
+            auto lobbyOpt = game.findLobbyById(lobbyId);
+            Lobby* lobby = lobbyOpt.has_value() ? lobbyOpt.value() : nullptr;
+            if (!lobby || !lobby->inGame || lobby->players.size() != 2 || config.move_deadline.count() <= 0) {
+                round_clocks.erase(rc);
+                continue;
+            }
+            // A seat waiting for its player belongs to the reconnect grace; resuming re-arms.
+            if (disconnected_players.count(lobby->players[0].userId) ||
+                disconnected_players.count(lobby->players[1].userId)) {
+                round_clocks.erase(rc);
+                continue;
+            }
+            forfeit_round(lobby);
+        }
+    }
+}
+
+// The current round ran out. A player who missed forfeit_after deadlines in a row loses the
+// match and is removed, which dissolves the lobby; otherwise the round goes to whoever moved.
+void SessionEngine::forfeit_round(Lobby* lobby) {
+    RoundClock& rc = round_clocks[lobby->lobbyId];
+    const bool p1Idle = lobby->p1Move == MoveType::NONE;
+    const bool p2Idle = lobby->p2Move == MoveType::NONE;
+    rc.p1Missed = p1Idle ? static_cast<uint8_t>(rc.p1Missed + 1) : 0;
+    rc.p2Missed = p2Idle ? static_cast<uint8_t>(rc.p2Missed + 1) : 0;
+
+    const int p1Id = lobby->players[0].userId;
+    const int p2Id = lobby->players[1].userId;
+    const bool p1Out = rc.p1Missed >= config.forfeit_after;
+    const bool p2Out = rc.p2Missed >= config.forfeit_after;
+    std::cerr << "[SYS] Lobby '" << lobby->name << "' missed its move deadline (" << static_cast<int>(rc.p1Missed)
+              << "/" << static_cast<int>(rc.p2Missed) << ")\n";
+
+    if (p1Out && p2Out) {
+        round_clocks.erase(lobby->lobbyId);
+        evict_player(p1Id, "Move deadline missed");
+        return;
+    }
+    if (p1Out || p2Out) {
+        const int loser = p1Out ? p1Id : p2Id;
+        const bool bracket = tournaments.isBracketLobby(lobby->lobbyId);
+        int winner = 0;
+        game.forfeitMatch(lobby, loser, winner);
+        announce_match_end(lobby, winner, lobby->p1Wins, lobby->p2Wins);
+        // A bracket lobby is already gone; any other would wait on the idle player forever.
+        if (!bracket) evict_player(loser, "Opponent missed the move deadline");
+        return;
+    }
+
+    int rw = 0, mw = 0, p1w = 0, p2w = 0;
+    MoveType m1 = MoveType::NONE;
+    MoveType m2 = MoveType::NONE;
+    bool me = false;
+    game.forfeitRound(lobby, rw, m1, m2, me, mw, p1w, p2w);
+    if (!me) arm_move_deadline(*lobby, false);
+    announce_round(lobby, rw, m1, m2, me);
+    if (me) announce_match_end(lobby, mw, p1w, p2w);
+}
+
+// Takes an unresponsive player out of their lobby; like a LEAVE_LOBBY, the lobby goes with them.
+void SessionEngine::evict_player(int userId, const std::string& peerReason) {
+    auto snap = snapshot_lobby_of(game, userId);
+    notify_lobby_peers_player_left(userId, peerReason);
+    send_to_player(userId, Responses::game_cannot_continue("Move deadline missed"));
+    send_to_player(userId, Responses::lobby_left());
+    game.leaveLobby(userId);
+    if (snap.has_value()) release_lobby_name(snap->name);
+}
+
+void SessionEngine::record_history(const Lobby& lobby, HistoryRecord::Kind kind, MoveType m1, MoveType m2, int winner) {
+    if (!history || lobby.players.size() != 2) return;
+
+    HistoryRecord r{};
+    r.unix_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    r.kind = kind;
+    r.p1_move = static_cast<uint8_t>(m1);
+    r.p2_move = static_cast<uint8_t>(m2);
+    r.round = static_cast<uint8_t>(std::min(lobby.roundsPlayed, 255));
+    r.p1_wins = static_cast<uint16_t>(lobby.p1Wins);
+    r.p2_wins = static_cast<uint16_t>(lobby.p2Wins);
+    r.lobby_id = lobby.lobbyId;
+    r.p1_id = lobby.players[0].userId;
+    r.p2_id = lobby.players[1].userId;
+    r.winner_id = winner;
+    HistoryRecord::copy_name(r.p1_name, lobby.players[0].username);
+    HistoryRecord::copy_name(r.p2_name, lobby.players[1].username);
+    history->append(r);
+}
+
+void SessionEngine::open_session(SessionId sid) {
+    auto now = clock->now();
+    Session& session = sessions[sid];
+    session.last_pong = now;
+    session.last_ping = now;
+
+    if (heartbeat.piggyback) schedule_liveness(sid, now + heartbeat.ping_idle);
+}
+
+void SessionEngine::on_transport_closed(SessionId sid) {
+    if (sessions.find(sid) == sessions.end()) return;
+    disconnect_session(sid, "DISCONNECTED");
+    if (!state_subscribers.empty()) push_state_deltas();
+}
+
+void SessionEngine::tick() {
+    if (heartbeat.enabled) {
+        if (heartbeat.piggyback) piggyback_tick();
+        else heartbeat_tick();
+    }
+    check_disconnection_timeouts();
+    if (!move_deadlines_due.empty()) expire_move_deadlines();
+    if (matchmaker.size() >= 2 && !(admission && admission->sheds_lobbies())) {
+        std::vector<Pairing> pairings;
+        matchmaker.poll(clock->now(), pairings);
+        seat_pairings(std::move(pairings));
+    }
+    if (!state_subscribers.empty()) push_state_deltas();
+    if (snapshots) capture_snapshot();
+}
+
+size_t SessionEngine::session_count() const {
+    return sessions.size();
+}
+
+void SessionEngine::erase_session(SessionId sid) {
+    auto it = sessions.find(sid);
+    if (it == sessions.end()) return;
+    if (it->second.pending) line_buffers.release(it->second.pending);
+    sessions.erase(it);
+    stop_spectating(sid);
+    set_state_subscription(sid, false);
+}
+
+bool SessionEngine::is_logged_in(SessionId sid) const {
+    return session_to_player.find(sid) != session_to_player.end();
+}
+
+std::optional<SessionTransfer> SessionEngine::detach_session(SessionId sid) {
+    auto sit = sessions.find(sid);
+    if (sit == sessions.end()) return std::nullopt;
+
+    SessionTransfer t;
+    auto it = session_to_player.find(sid);
+    if (it != session_to_player.end()) {
+        const int userId = it->second;
+        // Lobby members stay with their lobby.
+        if (game.getLobbyOf(userId).has_value()) return std::nullopt;
+
+        t.logged_in = true;
+        t.player = Player{userId, online_users[userId]};
+
+        // The token travels with the player; the directory entry for it stays valid.
+        auto tok = user_tokens.find(userId);
+        if (tok != user_tokens.end()) {
+            t.resume_token = tok->second;
+            resume_tokens.erase(tok->second);
+            user_tokens.erase(tok);
+        }
+        online_users.erase(userId);
+        matchmaker.remove(userId);
+
+        // A bracket cannot seat a player who now lives on another engine.
+        std::vector<BracketEvent> events;
+        tournaments.withdraw(userId, events);
+        apply_bracket_events(events);
+
+        game.removePlayer(userId);
+        unbind_player(sid, userId);
+        session_to_player.erase(it);
+    }
+
+    t.last_ping = sit->second.last_ping;
+    t.last_pong = sit->second.last_pong;
+    t.nonce = sit->second.nonce;
+    t.rtt = sit->second.rtt;
+    t.state_subscribed = state_subscribers.count(sid) > 0;
+    erase_session(sid);
+    return t;
+}
+
+void SessionEngine::adopt_session(SessionId sid, const SessionTransfer& t) {
+    Session& session = sessions[sid];
+    session.last_ping = t.last_ping;
+    session.last_pong = t.last_pong;
+    session.nonce = t.nonce;
+    session.rtt = t.rtt;
+    if (heartbeat.piggyback) schedule_liveness(sid, session.last_pong + heartbeat.ping_idle);
+
+    if (t.logged_in) {
+        game.adoptPlayer(t.player);
+        online_users[t.player.userId] = t.player.username;
+        bind_player(sid, t.player.userId);
+        if (!t.resume_token.empty()) {
+            resume_tokens[t.resume_token] = t.player.userId;
+            user_tokens[t.player.userId] = t.resume_token;
+        }
+    }
+    if (t.state_subscribed) set_state_subscription(sid, true);
+}
+
+// A token must not be predictable from the ones other players saw, which rules out any
+// seeded generator: 312 outputs of mt19937_64 give away its whole state.
+static uint64_t secure_random_u64() {
+    uint64_t bits = 0;
+    size_t got = 0;
+    while (got < sizeof(bits)) {
+        const ssize_t n = getrandom(reinterpret_cast<char*>(&bits) + got, sizeof(bits) - got, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("getrandom");
+            std::exit(1);
+        }
+        got += static_cast<size_t>(n);
+    }
+    return bits;
+}
+
+const std::string& SessionEngine::issue_resume_token(int userId) {
+    revoke_resume_token(userId);
+
+    static const char* HEX = "0123456789abcdef";
+    std::string token;
+    do {
+        uint64_t bits = tokens_seeded ? token_rng() : secure_random_u64();
+        token.assign(16, '0');
+        for (int i = 15; i >= 0; i--, bits >>= 4) token[static_cast<size_t>(i)] = HEX[bits & 0xf];
+    } while (resume_tokens.find(token) != resume_tokens.end());
+
+    resume_tokens[token] = userId;
+    sink.resume_token_issued(token, online_users[userId]);
+    return user_tokens[userId] = token;
+}
+
+const std::string& SessionEngine::resume_token_of(int userId) {
+    auto it = user_tokens.find(userId);
+    if (it != user_tokens.end()) return it->second;
+    return issue_resume_token(userId);
+}
+
+void SessionEngine::revoke_resume_token(int userId) {
+    auto it = user_tokens.find(userId);
+    if (it == user_tokens.end()) return;
+    sink.resume_token_revoked(it->second);
+    resume_tokens.erase(it->second);
+    user_tokens.erase(it);
+}
+
+SessionPhase SessionEngine::get_phase(SessionId sid) const {
+    auto it = session_to_player.find(sid);
+    if (it == session_to_player.end()) {
+        return SessionPhase::NotLoggedIn;
+    }
+    int playerId = it->second;
+
+    auto lobbyOpt = const_cast<Game&>(game).getLobbyOf(playerId);
+    if (!lobbyOpt.has_value()) {
+        return SessionPhase::LoggedInNoLobby;
+    }
+    Lobby* lobby = lobbyOpt.value();
+    if (!lobby) return SessionPhase::LoggedInNoLobby;
+
+    if (lobby->matchJustEnded) return SessionPhase::AFTER_GAME;
+
+    if (lobby->inGame) return SessionPhase::InGame;
+    return SessionPhase::InLobby;
+}
+
+bool SessionEngine::is_request_allowed(SessionPhase phase, RequestType type) const {
+    switch (phase) {
+        case SessionPhase::NotLoggedIn:
+            return (type == RequestType::LOGIN    ||
+                    type == RequestType::RESUME   ||
+                    type == RequestType::LOGOUT   ||
+                    type == RequestType::SPECTATE ||
+                    type == RequestType::PONG     ||
+                    type == RequestType::STATE  ||
+                    type == RequestType::SUBSCRIBE);
+
+        case SessionPhase::LoggedInNoLobby:
+            return (type == RequestType::LOGOUT         ||
+                    type == RequestType::CREATE_LOBBY   ||
+                    type == RequestType::JOIN_LOBBY     ||
+                    type == RequestType::SPECTATE       ||
+                    type == RequestType::TOURNEY_CREATE ||
+                    type == RequestType::TOURNEY_JOIN   ||
+                    type == RequestType::TOURNEY_START  ||
+                    type == RequestType::HISTORY        ||
+                    type == RequestType::LEADERBOARD    ||
+                    type == RequestType::RANK           ||
+                    type == RequestType::QUEUE          ||
+                    type == RequestType::UNQUEUE        ||
+                    type == RequestType::PONG           ||
+                    type == RequestType::STATE  ||
+                    type == RequestType::SUBSCRIBE);
+
+        case SessionPhase::InLobby:
+            return (type == RequestType::LOGOUT      ||
+                    type == RequestType::LEAVE_LOBBY ||
+                    type == RequestType::HISTORY     ||
+                    type == RequestType::LEADERBOARD ||
+                    type == RequestType::RANK        ||
+                    type == RequestType::PONG        ||
+                    type == RequestType::STATE  ||
+                    type == RequestType::SUBSCRIBE);
+
+        case SessionPhase::InGame:
+            return (type == RequestType::LOGOUT      ||
+                    type == RequestType::LEAVE_LOBBY ||
+                    type == RequestType::MOVE        ||
+                    type == RequestType::PONG        ||
+                    type == RequestType::STATE  ||
+                    type == RequestType::SUBSCRIBE);
+
+        case SessionPhase::AFTER_GAME:
+            return (type == RequestType::LOGOUT      ||
+                    type == RequestType::LEAVE_LOBBY ||
+                    type == RequestType::REMATCH     ||
+                    type == RequestType::HISTORY     ||
+                    type == RequestType::LEADERBOARD ||
+                    type == RequestType::RANK        ||
+                    type == RequestType::PONG        ||
+                    type == RequestType::STATE  ||
+                    type == RequestType::SUBSCRIBE);
+
+        case SessionPhase::INVALID:
+            return false;
+    }
+    return false;
+}
+
+void SessionEngine::notify_lobby_peers_player_left(int playerId, const std::string& reason) {
+    auto lobbyOpt = game.getLobbyOf(playerId);
+    if (!lobbyOpt.has_value()) return;
+    Lobby* lobby = lobbyOpt.value();
+    if (!lobby) return;
+
+    std::vector<int> peerIds;
+    for (auto& p : lobby->players) {
+        if (p.userId == playerId) continue;
+        peerIds.push_back(p.userId);
+    }
+    const std::string lobbyName = lobby->name;
+    const int lobbyId = lobby->lobbyId;
+    notify_spectators(lobbyName, Responses::game_cannot_continue(reason));
+
+    for (int peerId : peerIds) {
+        for (auto& kv : session_to_player) {
+            if (kv.second == peerId) {
+                send_line(kv.first, Responses::game_cannot_continue(reason));
+                send_line(kv.first, Responses::lobby_left());
+            }
+        }
+        game.leaveLobby(peerId);
+    }
+    // The match is over for good; watchers are sent back as well.
+    release_spectators(lobbyName);
+
+    if (tournaments.isBracketLobby(lobbyId)) {
+        std::vector<BracketEvent> events;
+        tournaments.forfeit(lobbyId, playerId, events);
+        apply_bracket_events(events);
+    }
+}
+
+void SessionEngine::disconnect_session(SessionId sid, const std::string& reason, bool allow_soft_disconnect) {
+    UPS_PROBE(disconnect, sid, reason.c_str(), allow_soft_disconnect ? 1 : 0);
+    drop_peer(sid);
+
+    auto it = session_to_player.find(sid);
+    if (it != session_to_player.end()) {
+        int userId = it->second;
+        auto lobbySnap = snapshot_lobby_of(game, userId);
+        auto lobbyOpt = game.getLobbyOf(userId);
+        SessionPhase phase = get_phase(sid);
+
+        if (allow_soft_disconnect && lobbyOpt.has_value() && phase == SessionPhase::InGame) {
+            const int grace = static_cast<int>(config.reconnect_grace.count());
+            disconnected_players[userId] = clock->now();
+            std::cerr << "[SYS] User " << userId << " lost connection (Soft). Waiting " << grace << "s.\n";
+
+            Lobby* lobby = lobbyOpt.value();
+            game.touchLobby(*lobby);
+            for (auto& p : lobby->players) {
+                if (p.userId == userId) continue;
+                for (auto& kv : session_to_player) {
+                    if (kv.second == p.userId) {
+                        send_line(kv.first, Responses::opponent_disconnected(grace));
+                    }
+                }
+            }
+            notify_spectators(lobby->name, Responses::opponent_disconnected(grace));
+        } else if (lobbyOpt.has_value() && phase == SessionPhase::AFTER_GAME) {
+            notify_lobby_peers_player_left(userId, "Opponent left after match");
+
+            std::cerr << "[SYS] User " << userId << " disconnected in AFTER_GAME. Cleaning up immediately.\n";
+            game.leaveLobby(userId);
+
+            if (lobbySnap.has_value()) {
+                release_lobby_name(lobbySnap->name);
+            }
+
+            release_username(userId);
+            game.removePlayer(userId);
+        } else {
+            if (phase == SessionPhase::AFTER_GAME || phase == SessionPhase::InLobby) {
+                notify_lobby_peers_player_left(userId, "Opponent left the session");
+            }
+
+            std::cerr << "[SYS] User " << userId << " hard disconnected. Reason: " << reason << ".\n";
+            game.leaveLobby(userId);
+
+            if (lobbySnap.has_value() && (phase == SessionPhase::AFTER_GAME || phase == SessionPhase::InLobby)) {
+                release_lobby_name(lobbySnap->name);
+            } else if (lobbySnap.has_value() && lobbySnap->size <= 1) {
+                release_lobby_name(lobbySnap->name);
+            }
+
+            release_username(userId);
+            game.removePlayer(userId);
+        }
+        unbind_player(sid, userId);
+        session_to_player.erase(it);
+    }
+
+    erase_session(sid);
+    sink.close(sid);
+}
+
+void SessionEngine::check_disconnection_timeouts() {
+    using namespace std::chrono;
+    AllocScope scope(AllocSubsystem::Timers);
+    auto now = clock->now();
+    std::vector<int> timed_out_users;
+
+    for (auto& kv : disconnected_players) {
+        int userId = kv.first;
+        auto disconnect_time = kv.second;
+
+        if (duration_cast<seconds>(now - disconnect_time) > config.reconnect_grace) {
+            std::cerr << "[SYS] Reconnect timeout for user " << userId << ". Ending match.\n";
+
+            auto lobbySnap = snapshot_lobby_of(game, userId);
+            notify_lobby_peers_player_left(userId, "Opponent timed out");
+
+            game.leaveLobby(userId);
+            game.removePlayer(userId);
+
+            if (lobbySnap.has_value()) {
+                release_lobby_name(lobbySnap->name);
+            }
+
+            release_username(userId);
+            timed_out_users.push_back(userId);
+        }
+    }
+
+    for (int uid : timed_out_users) {
+        disconnected_players.erase(uid);
+    }
+}
+
+int SessionEngine::find_disconnected_player_by_name(const std::string& name) {
+    for (auto& kv : disconnected_players) {
+        int uid = kv.first;
+        auto lobbyOpt = game.getLobbyOf(uid);
+        if (lobbyOpt.has_value()) {
+            Lobby* lobby = lobbyOpt.value();
+            for (auto& p : lobby->players) {
+                if (p.userId == uid && p.username == name) {
+                    return uid;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+// Attaches a new session to a soft-disconnected player and replays its match state.
+void SessionEngine::resume_player(SessionId sid, int userId) {
+    const std::string username = online_users[userId];
+    std::cerr << "[SYS] User " << username << " reconnected (ID: " << userId << ")\n";
+
+    bind_player(sid, userId);
+    disconnected_players.erase(userId);
+
+    auto now = clock->now();
+    sessions[sid].last_pong = now;
+    sessions[sid].last_ping = now;
+
+    send_line(sid, Responses::login_ok(userId, resume_token_of(userId)));
+
+    auto lobbyOpt = game.getLobbyOf(userId);
+    if (lobbyOpt.has_value()) {
+        Lobby* lobby = lobbyOpt.value();
+        game.touchLobby(*lobby);
+        send_line(sid, Responses::lobby_joined(lobby->name));
+
+        if (lobby->inGame) {
+            // The clock stopped while a seat was empty; the round starts over for both.
+            arm_move_deadline(*lobby, false);
+            send_line(sid, Responses::game_started(move_deadline_seconds()));
+
+            for (auto& p : lobby->players) {
+                if (p.userId == userId) continue;
+                for (auto& kv : session_to_player) {
+                    if (kv.second == p.userId) send_line(kv.first, Responses::game_resumed());
+                }
+                // Both may be away, e.g. after a restart from a snapshot.
+                auto away = disconnected_players.find(p.userId);
+                if (away != disconnected_players.end()) {
+                    const auto waited = std::chrono::duration_cast<std::chrono::seconds>(now - away->second);
+                    const auto left = std::max(config.reconnect_grace - waited, std::chrono::seconds(0));
+                    send_line(sid, Responses::opponent_disconnected(static_cast<int>(left.count())));
+                }
+            }
+            notify_spectators(lobby->name, Responses::game_resumed());
+
+            send_line(sid, Responses::state(describe_state(sid, get_phase(sid))));
+        }
+    } else {
+        std::cerr << "[SYS] User " << username << " reconnected but lobby is gone. Redirecting to menu.\n";
+        send_line(sid, Responses::lobby_left());
+    }
+}
+
+void SessionEngine::heartbeat_tick() {
+    using namespace std::chrono;
+    AllocScope scope(AllocSubsystem::Heartbeat);
+    const auto now = clock->now();
+
+    std::vector<SessionId> to_disconnect;
+
+    for (auto& [sid, hb] : sessions) {
+        if (peer_nodes.count(sid)) continue;
+        if (now - hb.last_pong > config.pong_timeout) {
+            std::cerr << "[SYS] Heartbeat timeout session=" << sid << "\n";
+            UPS_PROBE(heartbeat__timeout, sid);
+            to_disconnect.push_back(sid);
+            continue;
+        }
+
+        if (now - hb.last_ping >= config.ping_interval) {
+            hb.last_ping = now;
+            hb.nonce = nonce_dist(rng);
+            UPS_PROBE(heartbeat__ping, sid, hb.nonce);
+            send_line(sid, Responses::ping(std::to_string(hb.nonce)));
+        }
+    }
+
+    for (SessionId sid : to_disconnect) {
+        disconnect_session(sid, "TIMEOUT");
+    }
+}
+
+void SessionEngine::schedule_liveness(SessionId sid, std::chrono::steady_clock::time_point when) {
+    liveness_due[round_up_to_quantum(when)].push_back(sid);
+}
+
+void SessionEngine::piggyback_tick() {
+    using namespace std::chrono;
+    AllocScope scope(AllocSubsystem::Heartbeat);
+    const auto now = clock->now();
+    const auto pong_grace = config.pong_timeout - config.ping_interval;
+
+    std::vector<SessionId> due;
+    while (!liveness_due.empty() && liveness_due.begin()->first <= now) {
+        auto& bucket = liveness_due.begin()->second;
+        due.insert(due.end(), bucket.begin(), bucket.end());
+        liveness_due.erase(liveness_due.begin());
+    }
+    if (due.empty()) return;
+
+    // Every PING in one pass shares a nonce, so the line is built once.
+    uint32_t nonce = 0;
+    std::string ping_line;
+    std::vector<SessionId> to_disconnect;
+
+    for (SessionId sid : due) {
+        auto it = sessions.find(sid);
+        if (it == sessions.end() || peer_nodes.count(sid)) continue;
+        Session& hb = it->second;
+        const auto idle_since = hb.last_pong;
+
+        if (now - idle_since > heartbeat.ping_idle + pong_grace) {
+            std::cerr << "[SYS] Heartbeat timeout session=" << sid << "\n";
+            UPS_PROBE(heartbeat__timeout, sid);
+            to_disconnect.push_back(sid);
+            continue;
+        }
+        if (now - idle_since < heartbeat.ping_idle) {
+            schedule_liveness(sid, idle_since + heartbeat.ping_idle);
+            continue;
+        }
+
+        if (hb.last_ping <= idle_since) {
+            if (ping_line.empty()) {
+                nonce = nonce_dist(rng);
+                ping_line = Responses::ping(std::to_string(nonce));
+            }
+            hb.nonce = nonce;
+            hb.last_ping = now;
+            UPS_PROBE(heartbeat__ping, sid, nonce);
+            send_line(sid, ping_line);
+        }
+        schedule_liveness(sid, idle_since + heartbeat.ping_idle + pong_grace + milliseconds(1));
+    }
+
+    for (SessionId sid : to_disconnect) {
+        disconnect_session(sid, "TIMEOUT");
+    }
+}
+
+void SessionEngine::on_data(SessionId sid, const char* data, size_t len) {
+    auto it = sessions.find(sid);
+    if (it == sessions.end()) return;
+
+    AllocScope framing(AllocSubsystem::Framing);
+    frame_lines(line_buffers, it->second.pending, data, len, [&](std::string_view line) {
+        Request req;
+        {
+            AllocScope parse(AllocSubsystem::Parse);
+            req = parse_request_line(line);
+            parse.set_request(req.type);
+        }
+        UPS_PROBE(request__parsed, sid, static_cast<int>(sid & 0xffffffffu), static_cast<int>(req.type));
+        dispatch(sid, req);
+        return sessions.find(sid) != sessions.end();
+    });
+}
+
+void SessionEngine::dispatch(SessionId sid, const Request& req) {
+    if (sessions.find(sid) == sessions.end()) return;
+
+    AllocScope scope(AllocSubsystem::Session, req.type);
+    alloc_stats_count_request(req.type);
+
+    if (heartbeat.piggyback) {
+        auto it = sessions.find(sid);
+        if (it != sessions.end()) it->second.last_pong = clock->now();
+    }
+
+    if (!req.valid_magic) {
+        send_line(sid, Responses::error_invalid_magic());
+        disconnect_session(sid, "INVALID_MAGIC");
+    } else {
+        UPS_PROBE(request__start, sid, static_cast<int>(req.type));
+        handle_request(sid, req);
+        UPS_PROBE(request__done, sid, static_cast<int>(req.type));
+    }
+    if (!state_subscribers.empty()) push_state_deltas();
+}
+
+void SessionEngine::handle_request(SessionId sid, const Request& req) {
+    if (cluster && (req.type == RequestType::PEER_HELLO || peer_nodes.count(sid))) {
+        handle_peer_request(sid, req);
+        return;
+    }
+
+    SessionPhase ph = get_phase(sid);
+
+    if (req.type == RequestType::LEAVE_LOBBY && spectating.count(sid)) {
+        stop_spectating(sid);
+        send_line(sid, Responses::lobby_left());
+        return;
+    }
+
+    if (!is_request_allowed(ph, req.type)) {
+        if (req.type == RequestType::REMATCH && ph == SessionPhase::InGame) {
+             send_line(sid, Responses::error("Game already started"));
+             return;
+        }
+        send_line(sid, Responses::error_unexpected_state());
+        return;
+    }
+
+    if (redirect_if_remote(sid, req)) return;
+
+    switch (req.type) {
+        case RequestType::LOGIN: {
+            if (req.params.size() != 1) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            const std::string username = req.params[0];
+
+            int oldUserId = find_disconnected_player_by_name(username);
+            if (oldUserId != -1) {
+                resume_player(sid, oldUserId);
+                break;
+            }
+
+            if (admission && admission->sheds_logins()) {
+                send_line(sid, Responses::error_server_busy());
+                break;
+            }
+
+            bool nameTaken = false;
+            for (const auto& kv : online_users) {
+                if (kv.second == username) {
+                    nameTaken = true;
+                    break;
+                }
+            }
+
+            if (nameTaken) {
+                send_line(sid, Responses::error("Name already in use"));
+                break;
+            }
+
+            if (session_to_player.find(sid) != session_to_player.end()) {
+                send_line(sid, Responses::error_unexpected_state());
+                break;
+            }
+
+            if (cluster) claim_username(sid, username);
+            else login_player(sid, username);
+            break;
+        }
+
+        case RequestType::RESUME: {
+            if (req.params.size() != 1) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            auto tok = resume_tokens.find(req.params[0]);
+            if (tok == resume_tokens.end() || disconnected_players.find(tok->second) == disconnected_players.end()) {
+                send_line(sid, Responses::error("Resume not possible"));
+                break;
+            }
+            resume_player(sid, tok->second);
+            break;
+        }
+
+        case RequestType::LOGOUT: {
+            auto it = session_to_player.find(sid);
+            if (it != session_to_player.end()) {
+                int userId = it->second;
+                // Like a LEAVE_LOBBY: the opponent is told and a bracket match is forfeited.
+                auto snap = snapshot_lobby_of(game, userId);
+                notify_lobby_peers_player_left(userId, "Opponent logged out");
+                game.leaveLobby(userId);
+                if (snap.has_value()) release_lobby_name(snap->name);
+                release_username(userId);
+                game.removePlayer(userId);
+            }
+            send_line(sid, Responses::logout_ok());
+            disconnect_session(sid, "LOGOUT");
+            break;
+        }
+
+        case RequestType::CREATE_LOBBY: {
+            if (req.params.empty() || req.params.size() > 2) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            const RuleSet* rules = config.default_rules;
+            if (req.params.size() == 2) {
+                rules = find_ruleset(req.params[1]);
+                if (!rules) {
+                    send_line(sid, Responses::error("Unknown ruleset"));
+                    break;
+                }
+            }
+            if (admission && admission->sheds_lobbies()) {
+                send_line(sid, Responses::error_server_busy());
+                break;
+            }
+            int userId = session_to_player[sid];
+            std::string lobbyName = req.params[0];
+            stop_spectating(sid);
+
+            if (TournamentManager::isBracketLobbyName(lobbyName)) {
+                send_line(sid, Responses::error("Invalid lobby name"));
+                break;
+            }
+            if (active_lobbies.find(lobbyName) != active_lobbies.end()) {
+                send_line(sid, Responses::error("Lobby name already taken"));
+                break;
+            }
+
+            auto lobbyIdOpt = game.createLobby(userId, lobbyName, *rules);
+            if (!lobbyIdOpt.has_value()) {
+                send_line(sid, Responses::error("Cannot create lobby"));
+                break;
+            }
+            active_lobbies.insert(lobbyName);
+            matchmaker.remove(userId);
+            send_line(sid, Responses::lobby_created(*lobbyIdOpt));
+            break;
+        }
+
+        case RequestType::JOIN_LOBBY: {
+            if (req.params.size() != 1) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            if (admission && admission->sheds_lobbies()) {
+                send_line(sid, Responses::error_server_busy());
+                break;
+            }
+            int userId = session_to_player[sid];
+            std::string lobbyName = req.params[0];
+            stop_spectating(sid);
+
+            if (!game.joinLobby(userId, lobbyName)) {
+                send_line(sid, Responses::error("Join failed"));
+                break;
+            }
+            matchmaker.remove(userId);
+            send_line(sid, Responses::lobby_joined(lobbyName));
+
+            auto lobbyOpt = game.getLobbyOf(userId);
+            if (lobbyOpt.has_value() && game.canStartGame(lobbyOpt.value())) {
+                Lobby* lobby = lobbyOpt.value();
+                game.startGame(lobby);
+                arm_move_deadline(*lobby, true);
+                for (auto& p : lobby->players) {
+                    for (auto& kv : session_to_player) {
+                        if (kv.second == p.userId) send_line(kv.first, Responses::game_started(move_deadline_seconds()));
+                    }
+                }
+                notify_spectators(lobby->name, Responses::game_started(move_deadline_seconds()));
+            }
+            break;
+        }
+
+        case RequestType::LEAVE_LOBBY: {
+            int userId = session_to_player[sid];
+            auto snap = snapshot_lobby_of(game, userId);
+            notify_lobby_peers_player_left(userId, "Opponent left the lobby");
+            game.leaveLobby(userId);
+            if (snap.has_value() && snap->size <= 1) {
+                release_lobby_name(snap->name);
+            }
+            send_line(sid, Responses::lobby_left());
+            break;
+        }
+
+        case RequestType::MOVE: {
+            if (req.params.size() != 1) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            int userId = session_to_player[sid];
+            MoveType mv;
+            if (!string_to_move(req.params[0], mv)) {
+                send_line(sid, Responses::error_invalid_move());
+                break;
+            }
+            auto current = game.getLobbyOf(userId);
+            if (current.has_value() && !current.value()->rules->allows(mv)) {
+                send_line(sid, Responses::error_invalid_move());
+                break;
+            }
+
+            int rw = 0, mw = 0, p1w = 0, p2w = 0;
+            MoveType m1 = MoveType::NONE;
+            MoveType m2 = MoveType::NONE;
+            bool me = false;
+
+            if (!game.submitMove(userId, mv, rw, m1, m2, me, mw, p1w, p2w)) {
+                send_line(sid, Responses::error("Move rejected (already moved or not your turn)"));
+                break;
+            }
+            send_line(sid, Responses::move_accepted(move_to_string(mv)));
+
+            auto lobbyOpt = game.getLobbyOf(userId);
+            if (lobbyOpt.has_value()) {
+                Lobby* lobby = lobbyOpt.value();
+                if (m1 != MoveType::NONE && m2 != MoveType::NONE) {
+                    // Both moved in time, so neither has a missed deadline standing.
+                    if (!me) arm_move_deadline(*lobby, true);
+                    announce_round(lobby, rw, m1, m2, me);
+                }
+                if (me) announce_match_end(lobby, mw, p1w, p2w);
+            }
+            break;
+        }
+
+        case RequestType::REMATCH: {
+            int userId = session_to_player[sid];
+            auto lobbyOpt = game.getLobbyOf(userId);
+            if (!lobbyOpt.has_value()) {
+                send_line(sid, Responses::error_not_in_lobby());
+                break;
+            }
+            Lobby* lobby = lobbyOpt.value();
+            if (!game.requestRematch(userId, lobby)) {
+                send_line(sid, Responses::error_rematch_not_allowed());
+                break;
+            }
+            send_line(sid, Responses::rematch_ready());
+
+            if (game.canStartRematch(lobby)) {
+                game.startRematch(lobby);
+                arm_move_deadline(*lobby, true);
+                for (auto& p : lobby->players) {
+                    for (auto& kv : session_to_player) {
+                        if (kv.second == p.userId) send_line(kv.first, Responses::game_started(move_deadline_seconds()));
+                    }
+                }
+                notify_spectators(lobby->name, Responses::game_started(move_deadline_seconds()));
+            }
+            break;
+        }
+
+        case RequestType::SPECTATE: {
+            if (req.params.size() != 1) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            const std::string& lobbyName = req.params[0];
+            auto lobbyOpt = game.findLobby(lobbyName);
+            if (!lobbyOpt.has_value()) {
+                send_line(sid, Responses::error_lobby_not_found());
+                break;
+            }
+            Lobby* lobby = lobbyOpt.value();
+            start_spectating(sid, lobbyName);
+            send_line(sid, Responses::spectating(lobbyName));
+
+            std::vector<StateField> fields;
+            fields.emplace_back("phase", "Spectating");
+            lobby_state_fields(*lobby, 0, fields);
+            fields.emplace_back("inGame", lobby->inGame ? "true" : "false");
+            fields.emplace_back("version", std::to_string(lobby->version));
+
+            std::string line;
+            append_fields(line, fields);
+            send_line(sid, Responses::state(line));
+            break;
+        }
+
+        case RequestType::TOURNEY_CREATE: {
+            if (req.params.size() < 2 || req.params.size() > 3) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            BracketFormat format;
+            int rounds = 0;
+            if (!string_to_format(req.params[1], format) ||
+                (req.params.size() == 3 && !parse_rounds(req.params[2], rounds))) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            if (admission && admission->sheds_lobbies()) {
+                send_line(sid, Responses::error_server_busy());
+                break;
+            }
+            if (!tournaments.create(req.params[0], session_to_player[sid], format, rounds)) {
+                send_line(sid, Responses::error("Cannot create tournament"));
+                break;
+            }
+            std::cerr << "[SYS] Tournament '" << req.params[0] << "' created (" << req.params[1] << ")\n";
+            send_line(sid, Responses::tourney_created(req.params[0]));
+            break;
+        }
+
+        case RequestType::TOURNEY_JOIN: {
+            if (req.params.size() != 1) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            if (!tournaments.enter(req.params[0], session_to_player[sid])) {
+                send_line(sid, Responses::error("Cannot join tournament"));
+                break;
+            }
+            send_line(sid, Responses::tourney_joined(req.params[0], tournaments.find(req.params[0])->entrants.size()));
+            break;
+        }
+
+        case RequestType::TOURNEY_START: {
+            if (req.params.size() != 1) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            std::vector<BracketEvent> events;
+            if (!tournaments.start(req.params[0], session_to_player[sid], events)) {
+                send_line(sid, Responses::error("Cannot start tournament"));
+                break;
+            }
+            std::cerr << "[SYS] Tournament '" << req.params[0] << "' started\n";
+            apply_bracket_events(events);
+            break;
+        }
+
+        case RequestType::HISTORY: {
+            if (req.params.size() > 1) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            if (!history) {
+                send_line(sid, Responses::error("History disabled"));
+                break;
+            }
+            const std::string username = req.params.empty() ? online_users[session_to_player[sid]] : req.params[0];
+
+            std::vector<std::string> entries;
+            for (const HistoryRecord& r : history->recent_matches(username, HISTORY_QUERY_LIMIT)) {
+                const bool first = std::strncmp(r.p1_name, username.c_str(), sizeof(r.p1_name) - 1) == 0;
+                const int myId = first ? r.p1_id : r.p2_id;
+                const char outcome = r.winner_id == 0 ? 'D' : (r.winner_id == myId ? 'W' : 'L');
+
+                std::ostringstream e;
+                e << (first ? r.p2_name : r.p1_name) << "," << outcome << ","
+                  << (first ? r.p1_wins : r.p2_wins) << "," << (first ? r.p2_wins : r.p1_wins) << ","
+                  << r.unix_ms;
+                entries.push_back(e.str());
+            }
+            send_line(sid, Responses::history(username, entries));
+            break;
+        }
+
+        case RequestType::LEADERBOARD: {
+            // REQ_LEADERBOARD|<n>: the best n players (at most RatingTable::MAX_PAGE).
+            size_t n = LEADERBOARD_DEFAULT_PAGE;
+            if (req.params.size() > 1 || (req.params.size() == 1 && !parse_page(req.params[0], n))) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            if (!ratings) {
+                send_line(sid, Responses::error("Ratings disabled"));
+                break;
+            }
+            send_line(sid, ratings->leaderboard(n));
+            break;
+        }
+
+        case RequestType::RANK: {
+            if (req.params.size() > 1) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            if (!ratings) {
+                send_line(sid, Responses::error("Ratings disabled"));
+                break;
+            }
+            const std::string username = req.params.empty() ? online_users[session_to_player[sid]] : req.params[0];
+            RatingTable::Standing s;
+            if (!ratings->standing(username, s)) {
+                send_line(sid, Responses::error("Not rated"));
+                break;
+            }
+            send_line(sid, Responses::rank(username, s.rank, s.rating, s.games, s.total));
+            break;
+        }
+
+        case RequestType::QUEUE: {
+            if (!req.params.empty()) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            if (admission && admission->sheds_lobbies()) {
+                send_line(sid, Responses::error_server_busy());
+                break;
+            }
+            const int userId = session_to_player[sid];
+            if (matchmaker.contains(userId)) {
+                send_line(sid, Responses::error("Already queued"));
+                break;
+            }
+            send_line(sid, Responses::queued(rating_of(userId)));
+            enqueue_player(userId);
+            break;
+        }
+
+        case RequestType::UNQUEUE: {
+            if (!matchmaker.remove(session_to_player[sid])) {
+                send_line(sid, Responses::error("Not queued"));
+                break;
+            }
+            send_line(sid, Responses::unqueued());
+            break;
+        }
+
+        case RequestType::STATE: {
+            // REQ_STATE|<version>: a player whose lobby is still at that version gets a short
+            // answer instead of a freshly serialized line.
+            uint64_t known = 0;
+            if (req.params.size() == 1 && parse_version(req.params[0], known)) {
+                auto it = session_to_player.find(sid);
+                auto lobbyOpt = it != session_to_player.end() ? game.getLobbyOf(it->second) : std::nullopt;
+                if (lobbyOpt.has_value() && lobbyOpt.value()->version == known) {
+                    send_line(sid, Responses::state_unchanged(known));
+                    break;
+                }
+            }
+            send_line(sid, Responses::state(describe_state(sid, ph)));
+            break;
+        }
+
+        case RequestType::SUBSCRIBE: {
+            if (req.params.size() != 1 || (req.params[0] != "0" && req.params[0] != "1")) {
+                send_line(sid, Responses::error_malformed_request());
+                break;
+            }
+            const bool on = req.params[0] == "1";
+            set_state_subscription(sid, on);
+            send_line(sid, Responses::subscribed(on));
+
+            // Start the subscriber off with every field of the lobby it is in or watching.
+            if (!on) break;
+            auto it = session_to_player.find(sid);
+            auto lobbyOpt = it != session_to_player.end() ? game.getLobbyOf(it->second) : std::nullopt;
+            if (lobbyOpt.has_value()) {
+                push_state_delta(sid, *lobbyOpt.value(), it->second);
+            } else if (auto watched = spectating.find(sid); watched != spectating.end()) {
+                if (auto lobby = game.findLobby(watched->second)) push_state_delta(sid, *lobby.value(), 0);
+            }
+            break;
+        }
+
+        case RequestType::PONG: {
+            auto it = sessions.find(sid);
+            if (it != sessions.end()) {
+                Session& hb = it->second;
+                const auto now = clock->now();
+                hb.last_pong = now;
+
+                // Only an echo of the outstanding nonce is a valid RTT sample.
+                uint32_t echoed = 0;
+                if (req.params.size() == 1 && hb.nonce != 0 && parse_nonce(req.params[0], echoed) &&
+                    echoed == hb.nonce) {
+                    const auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(now - hb.last_ping);
+                    hb.rtt.add(rtt);
+                    process_rtt_histogram.record(rtt);
+                    hb.nonce = 0;
+                    UPS_PROBE(heartbeat__pong, sid, static_cast<int64_t>(rtt.count()));
+                } else {
+                    UPS_PROBE(heartbeat__pong, sid, static_cast<int64_t>(-1));
+                }
+            }
+            break;
+        }
+
+        default:
+            send_line(sid, Responses::error_unknown_request());
+            break;
+    }
+}
+
+std::string SessionEngine::describe_state(SessionId sid, SessionPhase ph) {
+    int userId = -1;
+    auto it = session_to_player.find(sid);
+    if (it != session_to_player.end()) userId = it->second;
+
+    std::vector<StateField> fields;
+    fields.emplace_back("phase", phase_to_debug(ph));
+
+    auto lobbyOpt = game.getLobbyOf(userId);
+    if (lobbyOpt.has_value()) {
+        const Lobby& lobby = *lobbyOpt.value();
+        lobby_state_fields(lobby, userId, fields);
+        fields.emplace_back("version", std::to_string(lobby.version));
+    }
+
+    if (userId >= 0) fields.emplace_back("playerId", std::to_string(userId));
+
+    if (const Tournament* t = tournaments.tournamentOf(userId)) {
+        fields.emplace_back("tournament", t->name);
+        fields.emplace_back("round", std::to_string(t->round));
+    }
+
+    auto watching = spectating.find(sid);
+    if (watching != spectating.end()) fields.emplace_back("spectating", watching->second);
+
+    auto hb = sessions.find(sid);
+    if (hb != sessions.end() && hb->second.rtt.samples > 0) {
+        const RttStats& rtt = hb->second.rtt;
+        fields.emplace_back("rttMs", format_ms(rtt.smoothed));
+        fields.emplace_back("rttMinMs", format_ms(rtt.min));
+        fields.emplace_back("rttMaxMs", format_ms(rtt.max));
+    }
+
+    std::string out;
+    append_fields(out, fields);
+    return out;
+}
+
+// Lobby changes are only collected while someone is subscribed.
+void SessionEngine::set_state_subscription(SessionId sid, bool on) {
+    if (on) {
+        state_subscribers.emplace(sid, StateSubscription{});
+    } else if (state_subscribers.erase(sid) == 0) {
+        return;
+    }
+    game.trackBumps(!state_subscribers.empty());
+}
+
+void SessionEngine::push_state_deltas() {
+    for (int lobbyId : game.takeBumpedLobbies()) {
+        auto lobbyOpt = game.findLobbyById(lobbyId);
+        if (!lobbyOpt.has_value()) continue;   // gone; its members were told they left
+        const Lobby& lobby = *lobbyOpt.value();
+
+        for (const auto& p : lobby.players) {
+            auto ps = player_sessions.find(p.userId);
+            if (ps != player_sessions.end() && state_subscribers.count(ps->second)) {
+                push_state_delta(ps->second, lobby, p.userId);
+            }
+        }
+        auto watchers = lobby_spectators.find(lobby.name);
+        if (watchers == lobby_spectators.end()) continue;
+        for (SessionId watcher : watchers->second) {
+            if (state_subscribers.count(watcher)) push_state_delta(watcher, lobby, 0);
+        }
+    }
+}
+
+void SessionEngine::push_state_delta(SessionId sid, const Lobby& lobby, int viewerId) {
+    auto sub = state_subscribers.find(sid);
+    if (sub == state_subscribers.end()) return;
+    StateSubscription& s = sub->second;
+
+    std::vector<StateField> fields;
+    if (viewerId > 0) fields.emplace_back("phase", phase_to_debug(lobby_phase(lobby)));
+    lobby_state_fields(lobby, viewerId, fields);
+
+    // A handful of fields, so a linear match by key is cheapest.
+    const bool same_lobby = s.lobbyId == lobby.lobbyId;
+    auto find = [](const std::vector<StateField>& in, const char* key) {
+        return std::find_if(in.begin(), in.end(), [key](const StateField& f) { return std::strcmp(f.first, key) == 0; });
+    };
+
+    std::string changed;
+    for (const auto& f : fields) {
+        if (same_lobby) {
+            auto old = find(s.fields, f.first);
+            if (old != s.fields.end() && old->second == f.second) continue;
+        }
+        changed += f.first;
+        changed += '=';
+        changed += f.second;
+        changed += ';';
+    }
+    if (same_lobby) {
+        for (const auto& old : s.fields) {
+            if (find(fields, old.first) != fields.end()) continue;
+            changed += old.first;
+            changed += "=;";
+        }
+    }
+
+    s.lobbyId = lobby.lobbyId;
+    s.fields = std::move(fields);
+    if (!changed.empty()) send_line(sid, Responses::state_delta(lobby.version, changed));
+}
+
+void SessionEngine::send_line(SessionId sid, const std::string& line) {
+    AllocScope scope(AllocSubsystem::Output);
+    UPS_PROBE(send__line, sid, line.size() + 1);
+    sink.deliver(sid, line + "\n");
+}
@@ -0,0 +1,353 @@
+#pragma once
+
+#include "Admission.hpp"
+#include "Clock.hpp"
+#include "Cluster.hpp"
+#include "Config.hpp"
+#include "Game.hpp"
+#include "Histogram.hpp"
+#include "History.hpp"
+#include "LineBuffer.hpp"
+#include "Matchmaking.hpp"
+#include "Protocol.hpp"
+#include "Ratings.hpp"
+#include "SharedBytes.hpp"
+#include "Snapshot.hpp"
+#include "Tournament.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <random>
+
+using SessionId = std::uint64_t;
+
+// One "key=value;" pair of a STATE line; keys are string literals.
+using StateField = std::pair<const char*, std::string>;
+
+// Round-trip time measured from PING nonces echoed back in PONGs.
+struct RttStats {
+    std::chrono::microseconds smoothed{0};   // EWMA, 1/8 gain like TCP's SRTT
+    std::chrono::microseconds min{0};
+    std::chrono::microseconds max{0};
+    uint32_t samples{0};
+
+    void add(std::chrono::microseconds sample);
+};
+
+// Everything needed to move a lobby-less session between engines.
+struct SessionTransfer {
+    bool logged_in{false};
+    Player player;
+    std::chrono::steady_clock::time_point last_ping;
+    std::chrono::steady_clock::time_point last_pong;
+    uint32_t nonce{0};
+    RttStats rtt;
+    std::string resume_token;
+    bool state_subscribed{false};
+};
+
+// One connection's engine-side state, for handing it to another process.
+struct SessionImage {
+    SessionId sid{0};
+    int userId{0};              // 0 = not logged in
+    std::string username;
+    std::string resumeToken;
+    std::string spectating;     // lobby name, empty = none
+    std::string pending;        // incomplete request line
+    bool subscribed{false};     // REQ_SUBSCRIBE state pushes
+    bool queued{false};         // REQ_QUEUE, waiting for a match
+};
+
+// Everything an engine needs to carry on in another process.
+struct EngineImage {
+    int lastUserId{0};
+    int lastLobbyId{0};
+    std::vector<LobbyImage> lobbies;
+    std::vector<SessionImage> sessions;
+};
+
+struct HeartbeatOptions {
+    bool enabled{true};
+    bool logs{false};
+
+    // Any valid request proves liveness; PINGs go out only after ping_idle without traffic.
+    bool piggyback{false};
+    std::chrono::milliseconds ping_idle{2000};
+};
+
+// Receives everything the engine emits. Implemented by transports (sockets, benchmarks).
+class SessionSink {
+public:
+    virtual ~SessionSink() = default;
+
+    virtual void deliver(SessionId sid, const std::string& bytes) = 0;
+
+    // Broadcast delivery: the same buffer goes to many sessions, so transports may queue
+    // the reference instead of copying. A transport may drop a session that cannot keep up.
+    virtual void deliver_shared(SessionId sid, const SharedBytes& bytes) { deliver(sid, *bytes); }
+
+    // The engine has dropped the session; the transport should flush and release it.
+    virtual void close(SessionId sid) = 0;
+
+    // A username is no longer held by any session on this engine.
+    virtual void user_offline(const std::string& /*username*/) {}
+
+    // A REQ_RESUME token now names this user, or no longer names anyone.
+    virtual void resume_token_issued(const std::string& /*token*/, const std::string& /*username*/) {}
+    virtual void resume_token_revoked(const std::string& /*token*/) {}
+};
+
+// Entry points a transport drives; implemented inline by SessionEngine or across worker threads.
+class SessionHost {
+public:
+    virtual ~SessionHost() = default;
+
+    virtual void open_session(SessionId sid) = 0;
+    virtual void on_data(SessionId sid, const char* data, size_t len) = 0;
+    virtual void on_transport_closed(SessionId sid) = 0;
+
+    // Heartbeats and reconnect deadlines; call periodically.
+    virtual void tick() = 0;
+
+    // Takes effect for every session from the next event on; nothing is reset.
+    virtual void configure(const RuntimeConfig& config) = 0;
+};
+
+// Session, protocol and game logic with no knowledge of sockets.
+// Consumes (session id, request bytes) and emits (session id, response bytes) through a SessionSink.
+class SessionEngine : public SessionHost {
+public:
+    explicit SessionEngine(SessionSink& sink, const HeartbeatOptions& heartbeat = {});
+    ~SessionEngine() override;
+
+    SessionEngine(const SessionEngine&) = delete;
+    SessionEngine& operator=(const SessionEngine&) = delete;
+
+    // Makes user and lobby ids unique across several engines (first, first + stride, ...).
+    void set_id_space(int first, int stride);
+
+    // Reseeds ping nonces and resume tokens, so a recorded run can be replayed exactly.
+    void seed_random(uint64_t seed);
+
+    // Timers read this clock (the steady clock by default); it must outlive the engine.
+    void set_clock(const Clock* source);
+
+    // Consulted before admitting new logins and lobbies; may be shared across engines.
+    void set_admission(const AdmissionController* controller);
+
+    // Completed rounds and matches are appended here; may be shared across engines.
+    void set_history(HistoryLog* log);
+
+    // Finished matches update Elo ratings here; may be shared across engines.
+    void set_ratings(RatingTable* table);
+
+    // Lobbies that changed are captured into the store every store->interval(); may be shared.
+    void set_snapshots(SnapshotStore* store);
+
+    // Reinstates snapshotted lobbies whose players may reconnect (LOGIN or RESUME) within
+    // the usual grace window. Ids in all images are reserved; only owned lobbies are restored.
+    void restore_snapshot(const std::vector<LobbyImage>& images,
+                          const std::function<bool(const Lobby&)>& owns = {});
+
+    // Process handoff. export_image fails (with the reason) while state it cannot carry,
+    // such as a running tournament, exists. import_image expects sids already renumbered
+    // for this process; the sessions carry on without noticing.
+    bool export_image(EngineImage& out, std::string& why_not);
+    void import_image(const EngineImage& image);
+
+    // Cluster mode: lobbies owned by another node are redirected there, and a username is
+    // claimed from its home node before LOGIN completes. Peer links are ordinary sessions;
+    // attach_peer marks one this process opened to node and introduces us on it.
+    void set_cluster(const ClusterMap* map);
+    void attach_peer(SessionId sid, int node);
+
+    void open_session(SessionId sid) override;
+    void on_data(SessionId sid, const char* data, size_t len) override;
+    void on_transport_closed(SessionId sid) override;
+    void tick() override;
+    void configure(const RuntimeConfig& runtime) override;
+
+    // Handles an already framed and parsed request.
+    void dispatch(SessionId sid, const Request& req);
+
+    // Removes a session that is not in a lobby without notifying the sink, for adopt_session elsewhere.
+    std::optional<SessionTransfer> detach_session(SessionId sid);
+    void adopt_session(SessionId sid, const SessionTransfer& t);
+
+    bool is_logged_in(SessionId sid) const;
+    size_t session_count() const;
+    size_t pending_line_buffers() const { return line_buffers.in_use(); }
+
+    // RTT samples from every engine in the process.
+    static const LatencyHistogram& rtt_histogram();
+
+private:
+    SessionSink& sink;
+    const AdmissionController* admission{nullptr};
+    HistoryLog* history{nullptr};
+    RatingTable* ratings{nullptr};
+    SnapshotStore* snapshots{nullptr};
+    std::chrono::steady_clock::time_point next_snapshot;
+
+    // Per-connection record, kept small because most sessions sit idle.
+    struct Session {
+        std::chrono::steady_clock::time_point last_ping;
+        std::chrono::steady_clock::time_point last_pong;   // last proof of life
+        uint32_t nonce{0};                 // outstanding PING, 0 once answered
+        RttStats rtt;
+        std::string* pending{nullptr};     // incomplete request line, from line_buffers
+    };
+
+    std::unordered_map<SessionId, Session> sessions;
+    LineBufferPool line_buffers;
+
+    std::unordered_map<SessionId, int> session_to_player;        // session -> userId
+    std::unordered_map<int, SessionId> player_sessions;          // userId -> session, for pushes
+
+    std::map<int, std::string> online_users;                     // userId -> username
+    std::set<std::string> active_lobbies;
+
+    Game game;
+    TournamentManager tournaments{game};
+
+    // --- Matchmaking ---
+    Matchmaker matchmaker;
+    int next_queue_lobby{1};                                     // "<POOL>#<n>" suffix
+
+    RuntimeConfig config;
+    const Clock* clock{&SteadyClock::instance()};
+
+    // --- Heartbeat ---
+    HeartbeatOptions heartbeat;
+
+    // Piggyback mode: sessions bucketed by the time their liveness must next be checked.
+    // Entries are revalidated when due, so traffic never has to touch this map.
+    std::map<std::chrono::steady_clock::time_point, std::vector<SessionId>> liveness_due;
+
+    std::mt19937 rng{std::random_device{}()};
+    std::uniform_int_distribution<uint32_t> nonce_dist{100000, 999999};
+
+    std::unordered_map<int, std::chrono::steady_clock::time_point> disconnected_players; // userId -> disconnect time
+
+    // --- Move deadlines ---
+    // Running games by the time their current round runs out. Entries are checked against
+    // round_clocks when due, so a round resolved in time never has to find its entry.
+    struct RoundClock {
+        std::chrono::steady_clock::time_point deadline;
+        uint8_t p1Missed{0};                                     // deadlines missed in a row
+        uint8_t p2Missed{0};
+    };
+    std::unordered_map<int, RoundClock> round_clocks;            // lobbyId -> current round
+    std::map<std::chrono::steady_clock::time_point, std::vector<int>> move_deadlines_due;   // -> lobbyIds
+
+    // --- Resume tokens ---
+    // Opaque per-login tokens that let REQ_RESUME find a suspended player by hash lookup.
+    std::unordered_map<std::string, int> resume_tokens;          // token -> userId
+    std::unordered_map<int, std::string> user_tokens;            // userId -> token
+    // Tokens are bearer credentials and come from getrandom(2); only a seeded engine (a
+    // recording, whose file holds every token anyway, or its replay) draws them from here.
+    std::mt19937_64 token_rng;
+    bool tokens_seeded{false};
+
+    // --- Spectators ---
+    // Read-only watchers of a lobby; every broadcast is serialized once and shared.
+    std::unordered_map<std::string, std::vector<SessionId>> lobby_spectators;   // lobby name -> watchers
+    std::unordered_map<SessionId, std::string> spectating;                      // session -> lobby name
+
+    // --- State pushes ---
+    // Subscribed sessions get RES_STATE_DELTA with the lobby fields that changed whenever
+    // their lobby's version moves. Each keeps the fields it was last sent to diff against.
+    struct StateSubscription {
+        int lobbyId{0};                   // lobby the fields describe, 0 = none yet
+        std::vector<StateField> fields;
+    };
+    std::unordered_map<SessionId, StateSubscription> state_subscribers;
+
+    // --- Cluster ---
+    const ClusterMap* cluster{nullptr};
+    std::unordered_map<SessionId, int> peer_nodes;               // peer link (either direction) -> node
+    std::unordered_map<int, SessionId> peer_links;               // node -> link we opened to it
+    std::unordered_map<std::string, int> name_claims;            // usernames homed here -> holding node
+    std::unordered_map<std::string, SessionId> pending_claims;   // username -> LOGIN awaiting its home
+
+    void handle_request(SessionId sid, const Request& req);
+
+    std::string describe_state(SessionId sid, SessionPhase ph);
+    void set_state_subscription(SessionId sid, bool on);
+    void push_state_deltas();
+    void push_state_delta(SessionId sid, const Lobby& lobby, int viewerId);
+    void handle_peer_request(SessionId sid, const Request& req);
+    bool redirect_if_remote(SessionId sid, const Request& req);
+
+    void login_player(SessionId sid, const std::string& username);
+    void claim_username(SessionId sid, const std::string& username);
+    void release_claim(const std::string& username);
+    void drop_peer(SessionId sid);
+
+    void send_line(SessionId sid, const std::string& line);
+    void erase_session(SessionId sid);
+
+    SessionPhase get_phase(SessionId sid) const;
+    bool is_request_allowed(SessionPhase phase, RequestType type) const;
+
+    void release_lobby_name(const std::string& lobbyName);
+    void release_username(int userId);
+
+    void notify_lobby_peers_player_left(int playerId, const std::string& reason);
+
+    void start_spectating(SessionId sid, const std::string& lobbyName);
+    void stop_spectating(SessionId sid);
+    void release_spectators(const std::string& lobbyName);
+    void notify_spectators(const std::string& lobbyName, const std::string& line);
+    void notify(const std::vector<SessionId>& targets, const std::string& line);
+
+    void send_to_player(int userId, const std::string& line);
+    void bind_player(SessionId sid, int userId);
+    void unbind_player(SessionId sid, int userId);
+
+    void finish_bracket_match(Lobby* lobby, int winnerUserId);
+    void apply_bracket_events(const std::vector<BracketEvent>& events);
+
+    int rating_of(int userId);
+    void enqueue_player(int userId);
+    void seat_pairings(std::vector<Pairing> pairings);
+
+    int move_deadline_seconds() const;
+    void arm_move_deadline(const Lobby& lobby, bool fresh);
+    void expire_move_deadlines();
+    void forfeit_round(Lobby* lobby);
+    void evict_player(int userId, const std::string& peerReason);
+
+    void announce_round(Lobby* lobby, int roundWinner, MoveType m1, MoveType m2, bool matchEnded);
+    void announce_match_end(Lobby* lobby, int matchWinner, int p1Wins, int p2Wins);
+
+    void record_history(const Lobby& lobby, HistoryRecord::Kind kind, MoveType m1, MoveType m2, int winner);
+
+    void capture_snapshot();
+    LobbyImage capture_lobby(const Lobby& lobby) const;
+    size_t restore_lobbies(const std::vector<LobbyImage>& images, const std::function<bool(const Lobby&)>& owns);
+
+    void check_disconnection_timeouts();
+
+    int find_disconnected_player_by_name(const std::string& name);
+    void resume_player(SessionId sid, int userId);
+
+    const std::string& issue_resume_token(int userId);
+    const std::string& resume_token_of(int userId);
+    void revoke_resume_token(int userId);
+
+    void disconnect_session(SessionId sid, const std::string& reason, bool allow_soft_disconnect = true);
+
+    void heartbeat_tick();
+    void piggyback_tick();
+    void schedule_liveness(SessionId sid, std::chrono::steady_clock::time_point when);
+};
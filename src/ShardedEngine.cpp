@@ -0,0 +1,436 @@
+#include "ShardedEngine.hpp"
+#include "AllocStats.hpp"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+
+namespace {
+    constexpr auto SHARD_TICK = std::chrono::milliseconds(100);
+
+    // Bounds LOGIN forwarding when the directory changes under a request in flight.
+    constexpr int MAX_HOPS = 8;
+
+    void signal_event_fd(int fd) {
+        uint64_t one = 1;
+        if (write(fd, &one, sizeof(one)) < 0) perror("write");
+    }
+}
+
+class ShardedEngine::Shard : private SessionSink {
+public:
+    Shard(ShardedEngine& owner, int index, int shard_count, const HeartbeatOptions& heartbeat,
+          const AdmissionController* admission, HistoryLog* history, SnapshotStore* snapshots,
+          RatingTable* ratings)
+        : owner(owner), index(index), engine(*this, heartbeat) {
+        engine.set_id_space(index + 1, shard_count);
+        engine.set_admission(admission);
+        engine.set_history(history);
+        engine.set_ratings(ratings);
+        engine.set_snapshots(snapshots);
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd < 0) {
+            perror("eventfd");
+            std::exit(1);
+        }
+    }
+
+    ~Shard() override {
+        if (event_fd >= 0) ::close(event_fd);
+    }
+
+    void start() {
+        thread = std::thread([this] { run(); });
+    }
+
+    // Before start(): takes the lobbies that hash here and publishes their players' names.
+    void restore(const std::vector<LobbyImage>& images) {
+        auto owns = [this](const Lobby& lobby) { return owner.shard_for_lobby(lobby.name) == index; };
+        engine.restore_snapshot(images, owns);
+
+        std::lock_guard<std::mutex> lock(owner.directory_mutex);
+        for (const auto& image : images) {
+            if (!owns(image.lobby)) continue;
+            for (const auto& p : image.lobby.players) owner.user_directory.emplace(p.username, index);
+        }
+    }
+
+    void stop() {
+        running.store(false, std::memory_order_release);
+        signal_event_fd(event_fd);
+        if (thread.joinable()) thread.join();
+    }
+
+    void push(ShardMessage msg) {
+        inbox.push(std::move(msg));
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_seq_cst)) signal_event_fd(event_fd);
+    }
+
+    std::chrono::microseconds lag() const {
+        return std::chrono::microseconds(lag_us.load(std::memory_order_relaxed));
+    }
+
+private:
+    ShardedEngine& owner;
+    const int index;
+    SessionEngine engine;
+
+    MpscQueue<ShardMessage> inbox;
+    int event_fd{-1};
+    std::atomic<bool> sleeping{false};
+    std::atomic<bool> running{true};
+    std::atomic<int64_t> lag_us{0};   // duration of the last busy iteration
+    std::thread thread;
+
+    void run() {
+        using namespace std::chrono;
+        auto next_tick = steady_clock::now() + SHARD_TICK;
+
+        while (running.load(std::memory_order_acquire)) {
+            const auto busy_start = steady_clock::now();
+            bool worked = false;
+            ShardMessage msg;
+            while (inbox.pop(msg)) {
+                process(msg);
+                worked = true;
+            }
+
+            auto now = steady_clock::now();
+            if (now >= next_tick) {
+                engine.tick();
+                next_tick = now + SHARD_TICK;
+                now = steady_clock::now();
+            }
+            lag_us.store(duration_cast<microseconds>(now - busy_start).count(), std::memory_order_relaxed);
+            if (worked) continue;
+
+            sleeping.store(true, std::memory_order_seq_cst);
+            if (inbox.empty() && running.load(std::memory_order_acquire)) {
+                const auto wait = duration_cast<milliseconds>(next_tick - now).count();
+                pollfd pfd{event_fd, POLLIN, 0};
+                if (::poll(&pfd, 1, static_cast<int>(wait) + 1) > 0) {
+                    uint64_t count = 0;
+                    if (read(event_fd, &count, sizeof(count)) < 0) {}
+                }
+            }
+            sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    void process(ShardMessage& msg) {
+        AllocScope scope(AllocSubsystem::Transport, msg.req.type);
+        switch (msg.kind) {
+            case ShardMessage::Kind::Open:
+                engine.open_session(msg.sid);
+                break;
+            case ShardMessage::Kind::Closed:
+                engine.on_transport_closed(msg.sid);
+                break;
+            case ShardMessage::Kind::Adopt:
+                engine.adopt_session(msg.sid, msg.transfer);
+                handle(msg);
+                break;
+            case ShardMessage::Kind::Request:
+                handle(msg);
+                break;
+            case ShardMessage::Kind::Configure:
+                engine.configure(*msg.config);
+                break;
+        }
+    }
+
+    void handle(ShardMessage& msg) {
+        int target = index;
+        bool reserved = false;
+        const Request& req = msg.req;
+
+        if (req.type == RequestType::LOGIN && req.params.size() == 1 && !engine.is_logged_in(msg.sid)) {
+            // Names are unique across shards: a LOGIN (or reconnect) is served where the name lives.
+            std::lock_guard<std::mutex> lock(owner.directory_mutex);
+            auto it = owner.user_directory.find(req.params[0]);
+            if (it != owner.user_directory.end()) {
+                target = it->second;
+            } else {
+                owner.user_directory[req.params[0]] = index;
+                reserved = true;
+            }
+        } else if (req.type == RequestType::RESUME && req.params.size() == 1 && !engine.is_logged_in(msg.sid)) {
+            // A token resumes on the shard holding the suspended player.
+            std::lock_guard<std::mutex> lock(owner.directory_mutex);
+            auto tok = owner.token_directory.find(req.params[0]);
+            if (tok != owner.token_directory.end()) {
+                auto it = owner.user_directory.find(tok->second);
+                if (it != owner.user_directory.end()) target = it->second;
+            }
+        } else if (msg.migrate_to >= 0) {
+            target = msg.migrate_to;
+        }
+
+        if (target != index && msg.hops < MAX_HOPS) {
+            auto transfer = engine.detach_session(msg.sid);
+            if (transfer.has_value()) {
+                ShardMessage fwd;
+                fwd.kind = ShardMessage::Kind::Adopt;
+                fwd.sid = msg.sid;
+                fwd.req = std::move(msg.req);
+                fwd.settle = msg.settle;
+                fwd.hops = msg.hops + 1;
+                fwd.transfer = *transfer;
+
+                // Enqueue before publishing the new location so a LOGIN routed by it lands after us.
+                owner.shards[static_cast<size_t>(target)]->push(std::move(fwd));
+                if (transfer->logged_in) {
+                    std::lock_guard<std::mutex> lock(owner.directory_mutex);
+                    owner.user_directory[transfer->player.username] = target;
+                }
+                return;
+            }
+        }
+
+        engine.dispatch(msg.sid, req);
+
+        if (reserved && !engine.is_logged_in(msg.sid)) {
+            // The LOGIN was refused (e.g. server busy); give the name back.
+            user_offline(req.params[0]);
+        }
+
+        if (msg.settle) {
+            ShardOutput settled;
+            settled.kind = ShardOutput::Kind::Settled;
+            settled.sid = msg.sid;
+            settled.shard = index;
+            owner.push_output(std::move(settled));
+        }
+    }
+
+    void deliver(SessionId sid, const std::string& bytes) override {
+        ShardOutput o;
+        o.kind = ShardOutput::Kind::Deliver;
+        o.sid = sid;
+        o.bytes = bytes;
+        owner.push_output(std::move(o));
+    }
+
+    void deliver_shared(SessionId sid, const SharedBytes& bytes) override {
+        ShardOutput o;
+        o.kind = ShardOutput::Kind::Deliver;
+        o.sid = sid;
+        o.shared = bytes;
+        owner.push_output(std::move(o));
+    }
+
+    void close(SessionId sid) override {
+        ShardOutput o;
+        o.kind = ShardOutput::Kind::Close;
+        o.sid = sid;
+        owner.push_output(std::move(o));
+    }
+
+    void resume_token_issued(const std::string& token, const std::string& username) override {
+        std::lock_guard<std::mutex> lock(owner.directory_mutex);
+        owner.token_directory[token] = username;
+    }
+
+    void resume_token_revoked(const std::string& token) override {
+        std::lock_guard<std::mutex> lock(owner.directory_mutex);
+        owner.token_directory.erase(token);
+    }
+
+    void user_offline(const std::string& username) override {
+        std::lock_guard<std::mutex> lock(owner.directory_mutex);
+        auto it = owner.user_directory.find(username);
+        if (it != owner.user_directory.end() && it->second == index) {
+            owner.user_directory.erase(it);
+        }
+    }
+};
+
+ShardedEngine::ShardedEngine(SessionSink& out, size_t workers, const HeartbeatOptions& heartbeat,
+                             const AdmissionController* admission, HistoryLog* history,
+                             SnapshotStore* snapshots, RatingTable* ratings)
+    : out(out) {
+    out_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (out_event_fd < 0) {
+        perror("eventfd");
+        std::exit(1);
+    }
+
+    const int count = static_cast<int>(workers);
+    for (int i = 0; i < count; i++) {
+        shards.push_back(std::make_unique<Shard>(*this, i, count, heartbeat, admission, history, snapshots,
+                                                 ratings));
+    }
+    if (snapshots) {
+        for (auto& shard : shards) shard->restore(snapshots->restored());
+    }
+    for (auto& shard : shards) shard->start();
+
+    std::cerr << "[SYS] Game workers: " << count << " shards\n";
+}
+
+ShardedEngine::~ShardedEngine() {
+    for (auto& shard : shards) shard->stop();
+    shards.clear();
+    for (auto& kv : routes) {
+        if (kv.second.partial) line_buffers.release(kv.second.partial);
+    }
+    if (out_event_fd >= 0) ::close(out_event_fd);
+}
+
+std::chrono::microseconds ShardedEngine::worker_lag() const {
+    std::chrono::microseconds worst{0};
+    for (const auto& shard : shards) worst = std::max(worst, shard->lag());
+    return worst;
+}
+
+int ShardedEngine::shard_for_lobby(const std::string& lobbyName) const {
+    // Bracket lobbies live with their tournament so one engine can seat every round.
+    const std::string key = TournamentManager::tournamentOfLobbyName(lobbyName);
+    return static_cast<int>(std::hash<std::string>{}(key) % shards.size());
+}
+
+void ShardedEngine::open_session(SessionId sid) {
+    Route& r = routes[sid];
+    r.shard = static_cast<int>(sid % shards.size());
+
+    ShardMessage msg;
+    msg.kind = ShardMessage::Kind::Open;
+    msg.sid = sid;
+    shards[static_cast<size_t>(r.shard)]->push(std::move(msg));
+}
+
+// Each shard switches over between two messages, so it never runs with a partial config.
+void ShardedEngine::configure(const RuntimeConfig& config) {
+    auto shared = std::make_shared<const RuntimeConfig>(config);
+    for (auto& shard : shards) {
+        ShardMessage msg;
+        msg.kind = ShardMessage::Kind::Configure;
+        msg.config = shared;
+        shard->push(std::move(msg));
+    }
+}
+
+void ShardedEngine::on_data(SessionId sid, const char* data, size_t len) {
+    auto it = routes.find(sid);
+    if (it == routes.end()) return;
+
+    AllocScope framing(AllocSubsystem::Framing);
+    frame_lines(line_buffers, it->second.partial, data, len, [&](std::string_view line) {
+        ShardMessage msg;
+        msg.kind = ShardMessage::Kind::Request;
+        msg.sid = sid;
+        {
+            AllocScope parse(AllocSubsystem::Parse);
+            msg.req = parse_request_line(line);
+            parse.set_request(msg.req.type);
+        }
+
+        AllocScope transport(AllocSubsystem::Transport, msg.req.type);
+        route(sid, std::move(msg));
+        return true;
+    });
+}
+
+void ShardedEngine::on_transport_closed(SessionId sid) {
+    ShardMessage msg;
+    msg.kind = ShardMessage::Kind::Closed;
+    msg.sid = sid;
+    route(sid, std::move(msg));
+}
+
+void ShardedEngine::route(SessionId sid, ShardMessage msg) {
+    auto it = routes.find(sid);
+    if (it == routes.end()) return;
+    Route& r = it->second;
+
+    // Hold everything behind a request that may move the session until it lands.
+    if (r.settling) {
+        r.pending.push_back(std::move(msg));
+        return;
+    }
+
+    if (msg.kind == ShardMessage::Kind::Request && msg.req.type == RequestType::QUEUE) {
+        // One shard holds the whole queue, so everyone waiting can be paired.
+        const int target = shard_for_lobby(Matchmaker::POOL);
+        if (target != r.shard) {
+            msg.migrate_to = target;
+            msg.settle = true;
+        }
+    } else if (msg.kind == ShardMessage::Kind::Request && !msg.req.params.empty()) {
+        const RequestType type = msg.req.type;
+        if (type == RequestType::LOGIN || type == RequestType::RESUME) {
+            msg.settle = true;
+        } else if (type == RequestType::CREATE_LOBBY || type == RequestType::JOIN_LOBBY ||
+                   type == RequestType::SPECTATE || type == RequestType::TOURNEY_CREATE ||
+                   type == RequestType::TOURNEY_JOIN || type == RequestType::TOURNEY_START) {
+            const int target = shard_for_lobby(msg.req.params[0]);
+            if (target != r.shard) {
+                msg.migrate_to = target;
+                msg.settle = true;
+            }
+        }
+    }
+
+    const bool closed = msg.kind == ShardMessage::Kind::Closed;
+    const bool settle = msg.settle;
+    shards[static_cast<size_t>(r.shard)]->push(std::move(msg));
+
+    if (settle) r.settling = true;
+    if (closed) erase_route(sid);
+}
+
+void ShardedEngine::erase_route(SessionId sid) {
+    auto it = routes.find(sid);
+    if (it == routes.end()) return;
+    if (it->second.partial) line_buffers.release(it->second.partial);
+    routes.erase(it);
+}
+
+void ShardedEngine::push_output(ShardOutput output) {
+    outputs.push(std::move(output));
+    if (!out_wake_pending.exchange(true, std::memory_order_acq_rel)) {
+        signal_event_fd(out_event_fd);
+    }
+}
+
+void ShardedEngine::drain() {
+    AllocScope scope(AllocSubsystem::Transport);
+    out_wake_pending.exchange(false, std::memory_order_acq_rel);
+
+    ShardOutput o;
+    while (outputs.pop(o)) {
+        switch (o.kind) {
+            case ShardOutput::Kind::Deliver:
+                if (o.shared) out.deliver_shared(o.sid, o.shared);
+                else out.deliver(o.sid, o.bytes);
+                break;
+
+            case ShardOutput::Kind::Close:
+                erase_route(o.sid);
+                out.close(o.sid);
+                break;
+
+            case ShardOutput::Kind::Settled: {
+                auto it = routes.find(o.sid);
+                if (it == routes.end()) break;
+                it->second.shard = o.shard;
+                it->second.settling = false;
+
+                std::deque<ShardMessage> pending;
+                pending.swap(it->second.pending);
+                for (auto& msg : pending) {
+                    route(o.sid, std::move(msg));
+                }
+                break;
+            }
+        }
+    }
+}
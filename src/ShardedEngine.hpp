@@ -0,0 +1,99 @@
+#pragma once
+
+#include "LineBuffer.hpp"
+#include "MpscQueue.hpp"
+#include "SessionEngine.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Splits network I/O from game logic. The I/O thread frames and parses requests and
+// hands them over lock-free MPSC queues to game-shard workers, each owning its own
+// SessionEngine. A lobby lives on the shard its name hashes to (a tournament and all
+// its bracket lobbies share one shard); a lobby-less session migrates to that shard on
+// CREATE_LOBBY/JOIN_LOBBY/SPECTATE/TOURNEY_*. Responses come back over one MPSC queue
+// drained by the I/O thread after a wakeup on wake_fd().
+class ShardedEngine : public SessionHost {
+public:
+    ShardedEngine(SessionSink& out, size_t workers, const HeartbeatOptions& heartbeat,
+                  const AdmissionController* admission = nullptr, HistoryLog* history = nullptr,
+                  SnapshotStore* snapshots = nullptr, RatingTable* ratings = nullptr);
+    ~ShardedEngine() override;
+
+    ShardedEngine(const ShardedEngine&) = delete;
+    ShardedEngine& operator=(const ShardedEngine&) = delete;
+
+    void open_session(SessionId sid) override;
+    void on_data(SessionId sid, const char* data, size_t len) override;
+    void on_transport_closed(SessionId sid) override;
+    void tick() override {}
+    void configure(const RuntimeConfig& config) override;
+
+    // eventfd signalled when responses are waiting; call drain() on the I/O thread.
+    int wake_fd() const { return out_event_fd; }
+    void drain();
+
+    // Longest recent busy iteration across the game workers.
+    std::chrono::microseconds worker_lag() const;
+
+private:
+    struct ShardMessage {
+        enum class Kind { Open, Request, Closed, Adopt, Configure };
+
+        Kind kind{Kind::Request};
+        SessionId sid{0};
+        Request req;
+        int migrate_to{-1};   // move the session to this shard before handling req
+        bool settle{false};   // report the session's final shard back to the router
+        int hops{0};
+        SessionTransfer transfer;
+        std::shared_ptr<const RuntimeConfig> config;   // Configure only
+    };
+
+    struct ShardOutput {
+        enum class Kind { Deliver, Close, Settled };
+
+        Kind kind{Kind::Deliver};
+        SessionId sid{0};
+        std::string bytes;
+        SharedBytes shared;   // set instead of bytes for broadcasts
+        int shard{-1};
+    };
+
+    class Shard;
+
+    // Router state, owned by the I/O thread.
+    struct Route {
+        int shard{0};
+        bool settling{false};
+        std::deque<ShardMessage> pending;
+        std::string* partial{nullptr};   // incomplete request line, from line_buffers
+    };
+
+    SessionSink& out;
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    std::unordered_map<SessionId, Route> routes;
+    LineBufferPool line_buffers;
+
+    MpscQueue<ShardOutput> outputs;
+    int out_event_fd{-1};
+    std::atomic<bool> out_wake_pending{false};
+
+    // username -> shard holding that user. Touched on LOGIN, RESUME, migration and logout only.
+    std::mutex directory_mutex;
+    std::unordered_map<std::string, int> user_directory;
+    std::unordered_map<std::string, std::string> token_directory;   // resume token -> username
+
+    void route(SessionId sid, ShardMessage msg);
+    void erase_route(SessionId sid);
+    void push_output(ShardOutput output);
+    int shard_for_lobby(const std::string& lobbyName) const;
+};
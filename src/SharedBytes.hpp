@@ -0,0 +1,8 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+// An immutable serialized message shared by every recipient of a broadcast.
+// Serialized once; each recipient only holds a reference until its copy is sent.
+using SharedBytes = std::shared_ptr<const std::string>;
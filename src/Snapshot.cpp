@@ -0,0 +1,274 @@
+#include "Snapshot.hpp"
+#include "ByteCodec.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+    constexpr char MAGIC[8] = {'U', 'P', 'S', 'S', 'N', 'A', 'P', '1'};
+
+    // File layout: header, then `count` records of [u32 length][encoded lobby].
+    struct Header {
+        char magic[8];
+        uint32_t count;
+        uint32_t payload_bytes;
+        int64_t written_unix_ms;
+        uint64_t checksum;      // FNV-1a over the payload
+    };
+
+    static_assert(sizeof(Header) == 32, "on-disk header layout changed");
+
+    uint64_t fnv1a(const char* data, size_t len) {
+        uint64_t h = 1469598103934665603ull;
+        for (size_t i = 0; i < len; i++) {
+            h ^= static_cast<unsigned char>(data[i]);
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    bool write_all(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    int64_t unix_ms_now() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    bool valid_move(uint8_t m) {
+        return m <= static_cast<uint8_t>(MoveType::SPOCK);
+    }
+}
+
+SnapshotStore::SnapshotStore(const std::string& path, std::chrono::milliseconds interval, bool load_existing)
+    : path(path), period(interval) {
+    if (load_existing) load();
+    else stale = true;
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        perror("eventfd");
+        std::exit(1);
+    }
+    writer = std::thread([this] { run(); });
+
+    std::cerr << "[SYS] Snapshots to " << path << " every " << period.count() << "ms\n";
+}
+
+SnapshotStore::~SnapshotStore() {
+    running.store(false, std::memory_order_release);
+    uint64_t one = 1;
+    if (::write(wake_fd, &one, sizeof(one)) < 0) perror("write");
+    if (writer.joinable()) writer.join();
+    if (wake_fd >= 0) ::close(wake_fd);
+}
+
+void SnapshotStore::update(int lobbyId, std::string bytes) {
+    queue.push(Delta{lobbyId, std::move(bytes)});
+}
+
+std::string SnapshotStore::encode(const LobbyImage& image) {
+    const Lobby& l = image.lobby;
+    std::string out;
+    out.reserve(64 + l.name.size() + l.players.size() * 64);
+
+    uint8_t flags = 0;
+    if (l.inGame) flags |= 1;
+    if (l.matchJustEnded) flags |= 2;
+    if (l.p1Rematch) flags |= 4;
+    if (l.p2Rematch) flags |= 8;
+
+    put<int32_t>(out, l.lobbyId);
+    put<uint8_t>(out, static_cast<uint8_t>(l.rules - RULESETS.data()));
+    put<uint8_t>(out, flags);
+    put<uint8_t>(out, static_cast<uint8_t>(l.p1Move));
+    put<uint8_t>(out, static_cast<uint8_t>(l.p2Move));
+    put<int32_t>(out, l.p1Wins);
+    put<int32_t>(out, l.p2Wins);
+    put<int32_t>(out, l.roundsPlayed);
+    put_string(out, l.name);
+
+    put<uint8_t>(out, static_cast<uint8_t>(l.players.size()));
+    for (size_t i = 0; i < l.players.size(); i++) {
+        const LobbyImage::Seat seat = i < image.seats.size() ? image.seats[i] : LobbyImage::Seat{};
+        put<int32_t>(out, l.players[i].userId);
+        put<int64_t>(out, seat.disconnectedUnixMs);
+        put_string(out, l.players[i].username);
+        put_string(out, seat.resumeToken);
+    }
+    put<uint64_t>(out, l.version);
+    return out;
+}
+
+bool SnapshotStore::decode(const char* data, size_t len, LobbyImage& out) {
+    ByteReader r{data, data + len};
+    Lobby& l = out.lobby;
+
+    l.lobbyId = r.get<int32_t>();
+    const uint8_t rules = r.get<uint8_t>();
+    const uint8_t flags = r.get<uint8_t>();
+    const uint8_t m1 = r.get<uint8_t>();
+    const uint8_t m2 = r.get<uint8_t>();
+    l.p1Wins = r.get<int32_t>();
+    l.p2Wins = r.get<int32_t>();
+    l.roundsPlayed = r.get<int32_t>();
+    l.name = r.get_string();
+    if (!r.ok || rules >= RULESETS.size() || !valid_move(m1) || !valid_move(m2)) return false;
+
+    l.rules = &RULESETS[rules];
+    l.inGame = flags & 1;
+    l.matchJustEnded = flags & 2;
+    l.p1Rematch = flags & 4;
+    l.p2Rematch = flags & 8;
+    l.p1Move = static_cast<MoveType>(m1);
+    l.p2Move = static_cast<MoveType>(m2);
+
+    const uint8_t count = r.get<uint8_t>();
+    if (!r.ok || count == 0 || count > 2) return false;
+    l.players.clear();
+    out.seats.clear();
+    for (uint8_t i = 0; i < count; i++) {
+        Player p;
+        LobbyImage::Seat seat;
+        p.userId = r.get<int32_t>();
+        seat.disconnectedUnixMs = r.get<int64_t>();
+        p.username = r.get_string();
+        seat.resumeToken = r.get_string();
+        if (!r.ok) return false;
+        l.players.push_back(std::move(p));
+        out.seats.push_back(std::move(seat));
+    }
+    // Records written before lobbies carried a version end here.
+    if (r.p != r.end) l.version = r.get<uint64_t>();
+    return r.ok && r.p == r.end;
+}
+
+// Maps the file read-only and decodes it; a missing, torn or foreign file starts empty.
+void SnapshotStore::load() {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) perror("open snapshot");
+        return;
+    }
+
+    struct stat st{};
+    const size_t len = ::fstat(fd, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+    if (len < sizeof(Header)) {
+        ::close(fd);
+        std::cerr << "[ERR] Snapshot " << path << " is truncated, ignoring it\n";
+        return;
+    }
+    void* base = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        perror("mmap snapshot");
+        return;
+    }
+
+    const char* bytes = static_cast<const char*>(base);
+    Header h;
+    std::memcpy(&h, bytes, sizeof(h));
+    const char* payload = bytes + sizeof(Header);
+
+    if (std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.payload_bytes != len - sizeof(Header) ||
+        fnv1a(payload, h.payload_bytes) != h.checksum) {
+        std::cerr << "[ERR] Snapshot " << path << " is corrupt, ignoring it\n";
+        ::munmap(base, len);
+        return;
+    }
+
+    ByteReader r{payload, payload + h.payload_bytes};
+    for (uint32_t i = 0; i < h.count && r.ok; i++) {
+        const uint32_t size = r.get<uint32_t>();
+        if (!r.ok || static_cast<size_t>(r.end - r.p) < size) break;
+
+        LobbyImage image;
+        if (decode(r.p, size, image)) {
+            records[image.lobby.lobbyId].assign(r.p, size);
+            loaded.push_back(std::move(image));
+        }
+        r.p += size;
+    }
+    ::munmap(base, len);
+
+    const int64_t age_s = (unix_ms_now() - h.written_unix_ms) / 1000;
+    std::cerr << "[SYS] Loaded snapshot " << path << ": " << loaded.size() << " lobbies, " << age_s << "s old\n";
+}
+
+void SnapshotStore::run() {
+    bool stopping = false;
+
+    while (!stopping) {
+        stopping = !running.load(std::memory_order_acquire);
+        if (!stopping) {
+            pollfd pfd{wake_fd, POLLIN, 0};
+            if (::poll(&pfd, 1, static_cast<int>(period.count())) > 0) {
+                uint64_t count = 0;
+                if (::read(wake_fd, &count, sizeof(count)) < 0) {}
+            }
+        }
+
+        bool changed = stale;
+        stale = false;
+        Delta delta;
+        while (queue.pop(delta)) {
+            if (delta.bytes.empty()) records.erase(delta.lobbyId);
+            else records[delta.lobbyId] = std::move(delta.bytes);
+            changed = true;
+        }
+        if (changed && !write_file()) perror("write snapshot");
+    }
+}
+
+bool SnapshotStore::write_file() const {
+    std::string buf(sizeof(Header), '\0');
+    for (const auto& kv : records) {
+        put<uint32_t>(buf, static_cast<uint32_t>(kv.second.size()));
+        buf += kv.second;
+    }
+
+    Header h{};
+    std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.count = static_cast<uint32_t>(records.size());
+    h.payload_bytes = static_cast<uint32_t>(buf.size() - sizeof(Header));
+    h.written_unix_ms = unix_ms_now();
+    h.checksum = fnv1a(buf.data() + sizeof(Header), h.payload_bytes);
+    std::memcpy(&buf[0], &h, sizeof(h));
+
+    const std::string tmp = path + ".tmp";
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    const bool ok = write_all(fd, buf.data(), buf.size()) && ::fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || ::rename(tmp.c_str(), path.c_str()) < 0) return false;
+
+    // Make the rename itself durable.
+    const size_t slash = path.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    const int dfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) {
+        ::fsync(dfd);
+        ::close(dfd);
+    }
+    return true;
+}
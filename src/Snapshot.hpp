@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Game.hpp"
+#include "MpscQueue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A lobby as captured for a snapshot, with what the engine keeps about each seat.
+struct LobbyImage {
+    struct Seat {
+        std::string resumeToken;
+        int64_t disconnectedUnixMs{0};   // 0 = connected when captured
+    };
+
+    Lobby lobby;
+    std::vector<Seat> seats;   // parallel to lobby.players
+};
+
+// Crash-safe snapshot of every lobby, kept in one file. Engines capture only the lobbies
+// that changed since their last capture and hand the encoded bytes over a lock-free
+// queue; a background thread folds them into its image and rewrites the file (temp file,
+// fsync, rename), so a crash leaves either the previous snapshot or the new one.
+class SnapshotStore {
+public:
+    // With load_existing false the file on disk is ignored and overwritten on the first write.
+    SnapshotStore(const std::string& path, std::chrono::milliseconds interval, bool load_existing = true);
+    ~SnapshotStore();
+
+    SnapshotStore(const SnapshotStore&) = delete;
+    SnapshotStore& operator=(const SnapshotStore&) = delete;
+
+    // Lobbies read (through a read-only mapping) from the snapshot found at startup.
+    const std::vector<LobbyImage>& restored() const { return loaded; }
+
+    // May be called from any game thread. Empty bytes mean the lobby is gone.
+    void update(int lobbyId, std::string bytes);
+
+    std::chrono::milliseconds interval() const { return period; }
+
+    static std::string encode(const LobbyImage& image);
+    static bool decode(const char* data, size_t len, LobbyImage& out);
+
+private:
+    struct Delta {
+        int lobbyId{0};
+        std::string bytes;
+    };
+
+    std::string path;
+    std::chrono::milliseconds period;
+    std::vector<LobbyImage> loaded;
+
+    MpscQueue<Delta> queue;
+    std::atomic<bool> running{true};
+    int wake_fd{-1};
+    std::thread writer;
+
+    std::map<int, std::string> records;   // writer-owned: lobbyId -> encoded lobby
+    bool stale{false};                    // file on disk predates this image
+
+    void load();
+    void run();
+    bool write_file() const;
+};
@@ -0,0 +1,415 @@
+#include "Tournament.hpp"
+
+#include <algorithm>
+#include <utility>
+
+bool string_to_format(const std::string& s, BracketFormat& out) {
+    if (s == "single") { out = BracketFormat::SingleElimination; return true; }
+    if (s == "swiss")  { out = BracketFormat::Swiss; return true; }
+    return false;
+}
+
+// Swiss pairing looks this many waiting players ahead for one not met yet.
+static constexpr size_t SWISS_LOOKAHEAD = 4;
+
+static uint64_t pair_key(int a, int b) {
+    if (a > b) std::swap(a, b);
+    return (static_cast<uint64_t>(static_cast<uint32_t>(a)) << 32) | static_cast<uint32_t>(b);
+}
+
+static std::string match_lobby_name(const Tournament& t, size_t index) {
+    return t.name + "#r" + std::to_string(t.round) + "m" + std::to_string(index + 1);
+}
+
+static int rounds_for(size_t entrants) {
+    int rounds = 0;
+    while ((size_t{1} << rounds) < entrants) rounds++;
+    return std::max(rounds, 1);
+}
+
+TournamentManager::TournamentManager(Game& game) : game(game) {}
+
+bool TournamentManager::isBracketLobbyName(const std::string& lobbyName) {
+    return lobbyName.find('#') != std::string::npos;
+}
+
+std::string TournamentManager::tournamentOfLobbyName(const std::string& lobbyName) {
+    return lobbyName.substr(0, lobbyName.find('#'));
+}
+
+bool TournamentManager::create(const std::string& name, int organizerId, BracketFormat format, int rounds) {
+    if (name.empty() || isBracketLobbyName(name)) return false;
+    if (tournaments.find(name) != tournaments.end()) return false;
+
+    Tournament t;
+    t.name = name;
+    t.organizerId = organizerId;
+    t.format = format;
+    t.rounds = rounds;
+    tournaments.emplace(name, std::move(t));
+    return true;
+}
+
+bool TournamentManager::enter(const std::string& name, int userId) {
+    auto it = tournaments.find(name);
+    if (it == tournaments.end()) return false;
+    Tournament& t = it->second;
+    if (t.round != 0) return false;
+    if (byPlayer.find(userId) != byPlayer.end()) return false;
+
+    t.entrants.push_back(userId);
+    byPlayer[userId] = name;
+    return true;
+}
+
+bool TournamentManager::start(const std::string& name, int userId, std::vector<BracketEvent>& outEvents) {
+    auto it = tournaments.find(name);
+    if (it == tournaments.end()) return false;
+    Tournament& t = it->second;
+    if (t.round != 0 || t.organizerId != userId || t.entrants.size() < 2) return false;
+
+    if (t.format == BracketFormat::Swiss) {
+        if (t.rounds <= 0) t.rounds = rounds_for(t.entrants.size());
+        for (int p : t.entrants) t.points[p] = 0;
+    }
+    t.standing = t.entrants;
+    advance(t, outEvents);
+    return true;
+}
+
+bool TournamentManager::isBracketLobby(int lobbyId) const {
+    return byLobby.find(lobbyId) != byLobby.end();
+}
+
+const Tournament* TournamentManager::find(const std::string& name) const {
+    auto it = tournaments.find(name);
+    return it == tournaments.end() ? nullptr : &it->second;
+}
+
+const Tournament* TournamentManager::tournamentOf(int userId) const {
+    auto it = byPlayer.find(userId);
+    return it == byPlayer.end() ? nullptr : find(it->second);
+}
+
+void TournamentManager::matchEnded(int lobbyId, int winnerUserId, std::vector<BracketEvent>& outEvents) {
+    auto ref = byLobby.find(lobbyId);
+    if (ref == byLobby.end()) return;
+    auto it = tournaments.find(ref->second.tournament);
+    const size_t index = ref->second.match;
+    byLobby.erase(ref);
+    if (it == tournaments.end()) return;
+
+    Tournament& t = it->second;
+    const TournamentMatch& m = t.matches[index];
+    int winner = winnerUserId;
+    if (winner == 0) {
+        // Drawn match: Swiss scores it as a draw, an elimination bracket advances the higher seed.
+        winner = t.format == BracketFormat::Swiss ? -1 : m.p1;
+    }
+    settle(t, index, winner, outEvents);
+}
+
+void TournamentManager::forfeit(int lobbyId, int userId, std::vector<BracketEvent>& outEvents) {
+    auto ref = byLobby.find(lobbyId);
+    if (ref == byLobby.end()) return;
+    auto it = tournaments.find(ref->second.tournament);
+    const size_t index = ref->second.match;
+    byLobby.erase(ref);
+    if (it == tournaments.end()) return;
+
+    Tournament& t = it->second;
+    const TournamentMatch& m = t.matches[index];
+    t.withdrawn.insert(userId);
+    byPlayer.erase(userId);
+    settle(t, index, m.p1 == userId ? m.p2 : m.p1, outEvents);
+}
+
+void TournamentManager::withdraw(int userId, std::vector<BracketEvent>& outEvents) {
+    auto where = byPlayer.find(userId);
+    if (where == byPlayer.end()) return;
+    auto it = tournaments.find(where->second);
+    byPlayer.erase(where);
+    if (it == tournaments.end()) return;
+
+    Tournament& t = it->second;
+    if (t.round == 0) {
+        t.entrants.erase(std::remove(t.entrants.begin(), t.entrants.end(), userId), t.entrants.end());
+        // Nobody is left who could start it.
+        if (userId == t.organizerId) finish(t, -1, outEvents);
+        return;
+    }
+    t.withdrawn.insert(userId);
+
+    // Gone without leaving the lobby first: settle as forfeit() would, or the round never
+    // closes. The lobby is vacated before that, so the opponent is free for the next round.
+    auto seat = t.seats.find(userId);
+    if (seat == t.seats.end()) return;
+    const size_t index = seat->second;
+    const TournamentMatch& m = t.matches[index];
+    if (m.decided || m.lobbyId == -1) return;
+    const int other = m.p1 == userId ? m.p2 : m.p1;
+
+    BracketEvent ev;
+    ev.kind = BracketEvent::Kind::MatchAbandoned;
+    ev.tournament = t.name;
+    ev.round = t.round;
+    ev.p1 = other;
+    ev.p2 = userId;
+    ev.lobbyName = match_lobby_name(t, index);
+    outEvents.push_back(std::move(ev));
+
+    byLobby.erase(m.lobbyId);
+    game.leaveLobby(m.p1);
+    game.leaveLobby(m.p2);
+    settle(t, index, other, outEvents);
+}
+
+void TournamentManager::record(Tournament& t, size_t index, int winner, std::vector<BracketEvent>& outEvents) {
+    TournamentMatch& m = t.matches[index];
+    m.decided = true;
+    m.winner = winner;
+    m.lobbyId = -1;
+
+    if (t.format == BracketFormat::Swiss) {
+        t.played.insert(pair_key(m.p1, m.p2));
+        if (winner == -1) {
+            t.points[m.p1] += 1;
+            t.points[m.p2] += 1;
+        } else {
+            t.points[winner] += 2;
+        }
+    }
+
+    BracketEvent ev;
+    ev.kind = BracketEvent::Kind::MatchDecided;
+    ev.tournament = t.name;
+    ev.round = t.round;
+    ev.p1 = m.p1;
+    ev.p2 = m.p2;
+    ev.winner = winner;
+    outEvents.push_back(std::move(ev));
+}
+
+void TournamentManager::settle(Tournament& t, size_t index, int winner, std::vector<BracketEvent>& outEvents) {
+    record(t, index, winner, outEvents);
+    if (--t.pending == 0) advance(t, outEvents);
+}
+
+void TournamentManager::advance(Tournament& t, std::vector<BracketEvent>& outEvents) {
+    while (true) {
+        std::vector<std::pair<int, int>> pairs;
+
+        if (t.format == BracketFormat::SingleElimination) {
+            if (t.round > 0) {
+                std::vector<int> next;
+                next.reserve(t.matches.size());
+                for (const auto& m : t.matches) {
+                    if (m.winner != -1 && t.withdrawn.find(m.winner) == t.withdrawn.end()) next.push_back(m.winner);
+                }
+                t.standing = std::move(next);
+            }
+            if (t.standing.size() <= 1) {
+                finish(t, t.standing.empty() ? -1 : t.standing.front(), outEvents);
+                return;
+            }
+            t.round++;
+            pairs = pairSingleElimination(t);
+        } else {
+            const size_t active = t.entrants.size() - t.withdrawn.size();
+            if (t.round >= t.rounds || active < 2) {
+                finish(t, swissLeader(t), outEvents);
+                return;
+            }
+            t.round++;
+            pairs = pairSwiss(t);
+        }
+
+        openRound(t, std::move(pairs), outEvents);
+        if (t.pending > 0) return;
+        // Every match of the round was a bye or a walkover; go straight on.
+    }
+}
+
+void TournamentManager::openRound(Tournament& t, std::vector<std::pair<int, int>> pairs,
+                                  std::vector<BracketEvent>& outEvents) {
+    t.matches.clear();
+    t.matches.reserve(pairs.size());
+    t.seats.clear();
+    t.pending = 0;
+
+    auto available = [&](int userId) {
+        return game.hasPlayer(userId) && !game.getLobbyOf(userId).has_value() &&
+               t.withdrawn.find(userId) == t.withdrawn.end();
+    };
+
+    for (const auto& [p1, p2] : pairs) {
+        const size_t index = t.matches.size();
+        TournamentMatch m;
+        m.p1 = p1;
+        m.p2 = p2;
+        t.matches.push_back(m);
+
+        if (p2 == -1) {
+            TournamentMatch& bye = t.matches[index];
+            bye.decided = true;
+            bye.winner = p1;
+            if (t.format == BracketFormat::Swiss) t.points[p1] += 2;
+            t.hadBye.insert(p1);
+
+            BracketEvent ev;
+            ev.kind = BracketEvent::Kind::Bye;
+            ev.tournament = t.name;
+            ev.round = t.round;
+            ev.p1 = p1;
+            ev.winner = p1;
+            outEvents.push_back(std::move(ev));
+            continue;
+        }
+
+        const bool ok1 = available(p1);
+        const bool ok2 = available(p2);
+        if (!ok1 || !ok2) {
+            // Whoever is busy elsewhere or gone loses by walkover.
+            record(t, index, ok1 ? p1 : (ok2 ? p2 : -1), outEvents);
+            continue;
+        }
+
+        const std::string lobbyName = match_lobby_name(t, index);
+        auto lobbyId = game.createLobby(p1, lobbyName, *rules);
+        if (!lobbyId.has_value() || !game.joinLobby(p2, lobbyName)) {
+            if (lobbyId.has_value()) game.leaveLobby(p1);
+            record(t, index, p1, outEvents);
+            continue;
+        }
+        game.startGame(game.getLobbyOf(p1).value());
+
+        t.matches[index].lobbyId = *lobbyId;
+        byLobby[*lobbyId] = MatchRef{t.name, index};
+        t.seats[p1] = index;
+        t.seats[p2] = index;
+        t.pending++;
+
+        BracketEvent ev;
+        ev.kind = BracketEvent::Kind::MatchStarted;
+        ev.tournament = t.name;
+        ev.round = t.round;
+        ev.p1 = p1;
+        ev.p2 = p2;
+        ev.lobbyName = lobbyName;
+        outEvents.push_back(std::move(ev));
+    }
+}
+
+void TournamentManager::finish(Tournament& t, int winner, std::vector<BracketEvent>& outEvents) {
+    BracketEvent ev;
+    ev.kind = BracketEvent::Kind::Finished;
+    ev.tournament = t.name;
+    ev.round = t.round;
+    ev.winner = winner;
+    ev.audience = t.entrants;
+    outEvents.push_back(std::move(ev));
+
+    for (int p : t.entrants) {
+        auto where = byPlayer.find(p);
+        if (where != byPlayer.end() && where->second == t.name) byPlayer.erase(where);
+    }
+    for (const auto& m : t.matches) {
+        if (m.lobbyId != -1) byLobby.erase(m.lobbyId);
+    }
+    const std::string name = t.name;
+    tournaments.erase(name);
+}
+
+std::vector<std::pair<int, int>> TournamentManager::pairSingleElimination(const Tournament& t) const {
+    std::vector<std::pair<int, int>> pairs;
+    pairs.reserve((t.standing.size() + 1) / 2);
+    for (size_t i = 0; i + 1 < t.standing.size(); i += 2) {
+        pairs.emplace_back(t.standing[i], t.standing[i + 1]);
+    }
+    if (t.standing.size() % 2 == 1) pairs.emplace_back(t.standing.back(), -1);
+    return pairs;
+}
+
+// Players are ranked by bucketing on points (bounded by 2 * rounds), so ranking is
+// linear. The ranking is then walked once, score group by score group: each player is
+// paired with the best ranked of the few still waiting whom they have not met, or waits
+// and floats down into the next group. A rematch the walk cannot avoid trades partners
+// with one of the last few pairs if that clears it. Pairing costs O(players * SWISS_LOOKAHEAD).
+std::vector<std::pair<int, int>> TournamentManager::pairSwiss(const Tournament& t) const {
+    std::vector<std::vector<int>> buckets(static_cast<size_t>(2 * t.round + 1));
+    for (int p : t.entrants) {
+        if (t.withdrawn.find(p) != t.withdrawn.end()) continue;
+        auto it = t.points.find(p);
+        const int raw = it == t.points.end() ? 0 : it->second;
+        const size_t pts = static_cast<size_t>(std::min(raw, 2 * t.round));
+        buckets[pts].push_back(p);
+    }
+
+    std::vector<int> ranked;
+    for (size_t i = buckets.size(); i-- > 0;) {
+        ranked.insert(ranked.end(), buckets[i].begin(), buckets[i].end());
+    }
+
+    std::vector<std::pair<int, int>> pairs;
+    int byePlayer = -1;
+    if (ranked.size() % 2 == 1) {
+        // The bye goes to the lowest ranked player who has not had one yet.
+        size_t pick = ranked.size() - 1;
+        for (size_t i = ranked.size(); i-- > 0;) {
+            if (t.hadBye.find(ranked[i]) == t.hadBye.end()) { pick = i; break; }
+        }
+        byePlayer = ranked[pick];
+        ranked.erase(ranked.begin() + static_cast<long>(pick));
+    }
+
+    auto unmet = [&](int a, int b) { return t.played.find(pair_key(a, b)) == t.played.end(); };
+    auto rematch = [&](int a, int b) {
+        pairs.emplace_back(a, b);
+        auto& [x, y] = pairs.back();
+        const size_t last = pairs.size() - 1;
+        for (size_t i = last; i-- > last - std::min(last, SWISS_LOOKAHEAD);) {
+            auto& [p, q] = pairs[i];
+            if (unmet(p, x) && unmet(q, y)) { std::swap(q, x); return; }
+            if (unmet(p, y) && unmet(q, x)) { std::swap(q, y); return; }
+        }
+    };
+
+    pairs.reserve(ranked.size() / 2 + 1);
+    std::vector<int> waiting;   // unpaired so far, best ranked first
+    waiting.reserve(SWISS_LOOKAHEAD);
+    for (int p : ranked) {
+        auto fresh = std::find_if(waiting.begin(), waiting.end(), [&](int q) { return unmet(p, q); });
+        if (fresh != waiting.end()) {
+            pairs.emplace_back(*fresh, p);
+            waiting.erase(fresh);
+        } else if (waiting.size() == SWISS_LOOKAHEAD) {
+            // Everyone in reach has met p: the longest waiter takes it.
+            rematch(waiting.front(), p);
+            waiting.erase(waiting.begin());
+        } else {
+            waiting.push_back(p);
+        }
+    }
+    // Whoever is still waiting has met all the others.
+    for (size_t i = 0; i + 1 < waiting.size(); i += 2) {
+        rematch(waiting[i], waiting[i + 1]);
+    }
+
+    if (byePlayer != -1) pairs.emplace_back(byePlayer, -1);
+    return pairs;
+}
+
+int TournamentManager::swissLeader(const Tournament& t) const {
+    int leader = -1;
+    int best = -1;
+    for (int p : t.entrants) {
+        if (t.withdrawn.find(p) != t.withdrawn.end()) continue;
+        auto it = t.points.find(p);
+        const int pts = it == t.points.end() ? 0 : it->second;
+        if (pts > best) {
+            best = pts;
+            leader = p;
+        }
+    }
+    return leader;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Game.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+enum class BracketFormat {
+    SingleElimination,
+    Swiss
+};
+
+bool string_to_format(const std::string& s, BracketFormat& out);
+
+// Something that happened to a bracket; the session layer turns these into pushes.
+struct BracketEvent {
+    enum class Kind {
+        MatchStarted,   // lobby created, both players seated and playing
+        MatchAbandoned, // p2 withdrew mid-match; lobbyName was emptied under p1
+        Bye,            // p1 advances without playing this round
+        MatchDecided,   // winner is -1 for a Swiss draw
+        Finished        // winner is -1 when nobody is left
+    };
+
+    Kind kind{Kind::MatchStarted};
+    std::string tournament;
+    int round{0};
+    int p1{-1};
+    int p2{-1};
+    int winner{-1};
+    std::string lobbyName;
+    std::vector<int> audience;   // Finished: every entrant
+};
+
+struct TournamentMatch {
+    int p1{-1};
+    int p2{-1};         // -1 = bye
+    int lobbyId{-1};    // -1 once decided or when never seated
+    int winner{-1};
+    bool decided{false};
+};
+
+struct Tournament {
+    std::string name;
+    int organizerId{-1};
+    BracketFormat format{BracketFormat::SingleElimination};
+    int rounds{0};       // Swiss round count; 0 = ceil(log2(entrants)) at start
+    int round{0};        // 0 while registering
+
+    std::vector<int> entrants;                  // seed order
+    std::vector<int> standing;                  // single elimination: still in, bracket order
+    std::unordered_map<int, int> points;        // Swiss: 2 per win or bye, 1 per draw
+    std::unordered_set<uint64_t> played;        // Swiss: pairs already met, see pair_key()
+    std::unordered_set<int> hadBye;
+    std::unordered_set<int> withdrawn;
+
+    std::vector<TournamentMatch> matches;       // current round only
+    std::unordered_map<int, size_t> seats;      // userId -> seated match of the current round
+    size_t pending{0};                          // undecided matches in the current round
+};
+
+// Runs single-elimination and Swiss brackets on top of Game: pairs each round, seats
+// the pairs in auto-created lobbies and advances when the last match of a round ends.
+// Every lookup on the match path is a hash hit; a round transition touches only the
+// matches of the round it closes and opens.
+class TournamentManager {
+public:
+    explicit TournamentManager(Game& game);
+
+    bool create(const std::string& name, int organizerId, BracketFormat format, int rounds);
+    bool enter(const std::string& name, int userId);
+    bool start(const std::string& name, int userId, std::vector<BracketEvent>& outEvents);
+
+    // Lobby names of the form "<tournament>#r<round>m<match>" belong to a bracket.
+    static bool isBracketLobbyName(const std::string& lobbyName);
+    static std::string tournamentOfLobbyName(const std::string& lobbyName);
+
+    bool isBracketLobby(int lobbyId) const;
+
+    // winnerUserId is 0 for a drawn match.
+    void matchEnded(int lobbyId, int winnerUserId, std::vector<BracketEvent>& outEvents);
+
+    // The player walked out of a bracket match; the opponent wins by forfeit.
+    void forfeit(int lobbyId, int userId, std::vector<BracketEvent>& outEvents);
+
+    // The player is gone for good (logout, timeout, moved away); never paired again.
+    // A match still being played is forfeited to the opponent, whose lobby is vacated.
+    void withdraw(int userId, std::vector<BracketEvent>& outEvents);
+
+    // Rules for the lobbies of every round opened from now on.
+    void setRules(const RuleSet& ruleSet) { rules = &ruleSet; }
+
+    const Tournament* find(const std::string& name) const;
+    const Tournament* tournamentOf(int userId) const;
+
+    size_t count() const { return tournaments.size(); }
+
+private:
+    struct MatchRef {
+        std::string tournament;
+        size_t match;
+    };
+
+    Game& game;
+    const RuleSet* rules{&DEFAULT_RULES};
+    std::unordered_map<std::string, Tournament> tournaments;
+    std::unordered_map<int, MatchRef> byLobby;                 // lobbyId -> match
+    std::unordered_map<int, std::string> byPlayer;             // userId -> tournament
+
+    void record(Tournament& t, size_t index, int winner, std::vector<BracketEvent>& outEvents);
+    void settle(Tournament& t, size_t index, int winner, std::vector<BracketEvent>& outEvents);
+    void advance(Tournament& t, std::vector<BracketEvent>& outEvents);
+    void openRound(Tournament& t, std::vector<std::pair<int, int>> pairs, std::vector<BracketEvent>& outEvents);
+    void finish(Tournament& t, int winner, std::vector<BracketEvent>& outEvents);
+
+    std::vector<std::pair<int, int>> pairSingleElimination(const Tournament& t) const;
+    std::vector<std::pair<int, int>> pairSwiss(const Tournament& t) const;
+    int swissLeader(const Tournament& t) const;
+};
@@ -0,0 +1,279 @@
+#include "Upgrade.hpp"
+#include "ByteCodec.hpp"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+    constexpr uint32_t HANDOFF_MAGIC = 0x55505352;   // "UPSR"
+    constexpr char CONFIRM = 'K';
+
+    // Below the kernel's per-message SCM_RIGHTS limit (253).
+    constexpr size_t FDS_PER_MESSAGE = 250;
+
+    constexpr int HANDOFF_TIMEOUT_S = 5;
+
+    bool make_address(const std::string& path, sockaddr_un& addr, std::string& error) {
+        addr = sockaddr_un{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            error = "socket path too long";
+            return false;
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    void set_timeouts(int fd) {
+        timeval tv{HANDOFF_TIMEOUT_S, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    bool write_all(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::send(fd, data, len, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool read_all(int fd, char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::recv(fd, data, len, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // One marker byte per message keeps each batch of descriptors attached to its own read.
+    bool send_fds(int conn, const int* fds, size_t count) {
+        char marker = 'F';
+        iovec iov{&marker, 1};
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * count));
+
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+        while (true) {
+            if (::sendmsg(conn, &msg, MSG_NOSIGNAL) == 1) return true;
+            if (errno != EINTR) return false;
+        }
+    }
+
+    bool recv_fds(int conn, std::vector<int>& out) {
+        char marker = 0;
+        iovec iov{&marker, 1};
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * FDS_PER_MESSAGE));
+
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        ssize_t n;
+        do {
+            n = ::recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+        } while (n < 0 && errno == EINTR);
+        if (n != 1 || (msg.msg_flags & MSG_CTRUNC)) return false;
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+            const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const size_t at = out.size();
+            out.resize(at + count);
+            std::memcpy(out.data() + at, CMSG_DATA(cmsg), sizeof(int) * count);
+        }
+        return true;
+    }
+
+    std::string encode(const Handoff& h) {
+        const EngineImage& e = h.engine;
+        std::string out;
+        put<int32_t>(out, e.lastUserId);
+        put<int32_t>(out, e.lastLobbyId);
+
+        put<uint32_t>(out, static_cast<uint32_t>(e.lobbies.size()));
+        for (const auto& lobby : e.lobbies) put_blob(out, SnapshotStore::encode(lobby));
+
+        put<uint32_t>(out, static_cast<uint32_t>(e.sessions.size()));
+        for (size_t i = 0; i < e.sessions.size(); i++) {
+            const SessionImage& s = e.sessions[i];
+            put<uint64_t>(out, s.sid);
+            put<int32_t>(out, s.userId);
+            put_string(out, s.username);
+            put_string(out, s.resumeToken);
+            put_string(out, s.spectating);
+            put_blob(out, s.pending);
+            put<uint8_t>(out, s.subscribed ? 1 : 0);
+            put<uint8_t>(out, s.queued ? 1 : 0);
+            put_blob(out, h.outputs[i]);
+        }
+        return out;
+    }
+
+    bool decode(const std::string& bytes, Handoff& h) {
+        ByteReader r{bytes.data(), bytes.data() + bytes.size()};
+        EngineImage& e = h.engine;
+        e.lastUserId = r.get<int32_t>();
+        e.lastLobbyId = r.get<int32_t>();
+
+        const uint32_t lobbies = r.get<uint32_t>();
+        for (uint32_t i = 0; i < lobbies && r.ok; i++) {
+            const std::string blob = r.get_blob();
+            LobbyImage image;
+            if (!r.ok || !SnapshotStore::decode(blob.data(), blob.size(), image)) return false;
+            e.lobbies.push_back(std::move(image));
+        }
+
+        const uint32_t sessions = r.get<uint32_t>();
+        for (uint32_t i = 0; i < sessions && r.ok; i++) {
+            SessionImage s;
+            s.sid = r.get<uint64_t>();
+            s.userId = r.get<int32_t>();
+            s.username = r.get_string();
+            s.resumeToken = r.get_string();
+            s.spectating = r.get_string();
+            s.pending = r.get_blob();
+            s.subscribed = r.get<uint8_t>() != 0;
+            s.queued = r.get<uint8_t>() != 0;
+            h.outputs.push_back(r.get_blob());
+            e.sessions.push_back(std::move(s));
+        }
+        return r.ok && r.p == r.end;
+    }
+}
+
+int open_upgrade_socket(const std::string& path) {
+    sockaddr_un addr;
+    std::string error;
+    if (!make_address(path, addr, error)) {
+        std::cerr << "[ERR] Upgrade socket " << path << ": " << error << "\n";
+        std::exit(1);
+    }
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        std::exit(1);
+    }
+    ::unlink(path.c_str());
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(fd, 1) < 0) {
+        perror("bind upgrade socket");
+        std::exit(1);
+    }
+    return fd;
+}
+
+int accept_upgrade(int upgrade_fd) {
+    const int conn = ::accept4(upgrade_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn >= 0) set_timeouts(conn);
+    return conn;
+}
+
+bool send_handoff(int conn, const Handoff& handoff, std::string& error) {
+    const std::string state = encode(handoff);
+
+    std::string header;
+    put<uint32_t>(header, HANDOFF_MAGIC);
+    put<uint32_t>(header, static_cast<uint32_t>(handoff.fds.size()));
+    put<uint64_t>(header, state.size());
+    if (!write_all(conn, header.data(), header.size()) || !write_all(conn, state.data(), state.size())) {
+        error = std::string("sending state: ") + std::strerror(errno);
+        return false;
+    }
+
+    std::vector<int> fds;
+    fds.reserve(handoff.fds.size() + 1);
+    fds.push_back(handoff.listen_fd);
+    fds.insert(fds.end(), handoff.fds.begin(), handoff.fds.end());
+    for (size_t at = 0; at < fds.size(); at += FDS_PER_MESSAGE) {
+        if (!send_fds(conn, fds.data() + at, std::min(FDS_PER_MESSAGE, fds.size() - at))) {
+            error = std::string("sending sockets: ") + std::strerror(errno);
+            return false;
+        }
+    }
+
+    char reply = 0;
+    if (!read_all(conn, &reply, 1) || reply != CONFIRM) {
+        error = "new process did not confirm";
+        return false;
+    }
+    return true;
+}
+
+bool receive_handoff(const std::string& path, Handoff& out, int& conn, std::string& error) {
+    sockaddr_un addr;
+    if (!make_address(path, addr, error)) return false;
+
+    conn = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn < 0 || ::connect(conn, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        error = std::string("connect: ") + std::strerror(errno);
+        return false;
+    }
+    set_timeouts(conn);
+
+    char header[16];
+    if (!read_all(conn, header, sizeof(header))) {
+        error = "no handoff received";
+        return false;
+    }
+    ByteReader r{header, header + sizeof(header)};
+    const uint32_t magic = r.get<uint32_t>();
+    const uint32_t sessions = r.get<uint32_t>();
+    const uint64_t length = r.get<uint64_t>();
+    if (magic != HANDOFF_MAGIC) {
+        error = "not a handoff";
+        return false;
+    }
+
+    std::string state(length, '\0');
+    if (!read_all(conn, &state[0], state.size()) || !decode(state, out) || out.engine.sessions.size() != sessions) {
+        error = "malformed state";
+        return false;
+    }
+
+    std::vector<int> fds;
+    while (fds.size() < static_cast<size_t>(sessions) + 1) {
+        if (!recv_fds(conn, fds)) {
+            error = "sockets not received";
+            for (int fd : fds) ::close(fd);
+            return false;
+        }
+    }
+    out.listen_fd = fds[0];
+    out.fds.assign(fds.begin() + 1, fds.end());
+    return true;
+}
+
+void confirm_handoff(int conn) {
+    if (!write_all(conn, &CONFIRM, 1)) perror("confirm handoff");
+    ::close(conn);
+}
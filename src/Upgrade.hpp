@@ -0,0 +1,30 @@
+#pragma once
+
+#include "SessionEngine.hpp"
+
+#include <string>
+#include <vector>
+
+// Zero-downtime binary upgrade. The running server listens on a Unix domain socket; a
+// newly started process connects to it and receives the listening socket, every client
+// socket (SCM_RIGHTS) and the engine state, then confirms once it is serving. Clients
+// keep their TCP connections throughout; bytes they send meanwhile wait in the kernel.
+struct Handoff {
+    int listen_fd{-1};
+    EngineImage engine;
+    std::vector<int> fds;               // parallel to engine.sessions
+    std::vector<std::string> outputs;   // unsent bytes, parallel to engine.sessions
+};
+
+// Running process: a non-blocking listener at path, and a poll for upgrade requests
+// (returns -1 when none is waiting).
+int open_upgrade_socket(const std::string& path);
+int accept_upgrade(int upgrade_fd);
+
+// Sends the handoff and waits for confirm_handoff. On failure the caller still owns
+// everything and can carry on serving.
+bool send_handoff(int conn, const Handoff& handoff, std::string& error);
+
+// New process: connects to path and takes the handoff.
+bool receive_handoff(const std::string& path, Handoff& out, int& conn, std::string& error);
+void confirm_handoff(int conn);
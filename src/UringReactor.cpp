@@ -0,0 +1,605 @@
+#include "UringReactor.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+    constexpr unsigned SQ_ENTRIES = 1024;
+    constexpr unsigned CQ_ENTRIES = SQ_ENTRIES * 4;
+
+    constexpr unsigned BUF_COUNT = 1024;   // must be a power of two
+    constexpr size_t BUF_SIZE = 4096;
+    constexpr uint16_t BUF_GROUP = 0;
+
+    enum : uint64_t {
+        OP_ACCEPT = 1,
+        OP_RECV   = 2,
+        OP_SEND   = 3,
+        OP_CANCEL = 4,
+        OP_WAKEUP = 5,
+        OP_WRITABLE = 6
+    };
+
+    constexpr uint32_t GEN_MASK = 0xffffff;
+
+    // Broadcast output a connection may have queued before it is considered too slow.
+    constexpr size_t MAX_SHARED_BACKLOG = 256 * 1024;
+
+    // Direct responses are never dropped, so a peer that lets this much pile up is cut off
+    // instead; its recv then reports the hangup like any other.
+    constexpr size_t MAX_BACKLOG = 4 * 1024 * 1024;
+
+    // Chunks gathered into one SENDMSG; the rest follow once it completes.
+    constexpr size_t MAX_SEND_IOV = 64;
+
+    uint64_t pack_user_data(uint64_t op, uint32_t gen, int fd) {
+        return (op << 56) | (static_cast<uint64_t>(gen & GEN_MASK) << 32) | static_cast<uint32_t>(fd);
+    }
+
+    bool kernel_at_least(int major, int minor) {
+        utsname u{};
+        if (uname(&u) != 0) return false;
+        int kmajor = 0, kminor = 0;
+        if (std::sscanf(u.release, "%d.%d", &kmajor, &kminor) != 2) return false;
+        return kmajor > major || (kmajor == major && kminor >= minor);
+    }
+}
+
+std::unique_ptr<UringReactor> UringReactor::create(std::string& why_not) {
+    std::unique_ptr<UringReactor> r(new UringReactor());
+    if (!r->setup(why_not)) return nullptr;
+    return r;
+}
+
+bool UringReactor::setup(std::string& why_not) {
+    // Multishot recv with provided buffer rings landed in 6.0.
+    if (!kernel_at_least(6, 0)) {
+        why_not = "kernel older than 6.0";
+        return false;
+    }
+
+    io_uring_params p{};
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = CQ_ENTRIES;
+
+    ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, SQ_ENTRIES, &p));
+    if (ring_fd < 0) {
+        why_not = std::string("io_uring_setup: ") + std::strerror(errno);
+        return false;
+    }
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        why_not = "missing IORING_FEAT_EXT_ARG";
+        return false;
+    }
+
+    sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_map_size > sq_map_size) sq_map_size = cq_map_size;
+        cq_map_size = sq_map_size;
+    }
+
+    sq_ptr = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        sq_ptr = nullptr;
+        why_not = "mmap sq ring failed";
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr = sq_ptr;
+    } else {
+        cq_ptr = mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            cq_ptr = nullptr;
+            why_not = "mmap cq ring failed";
+            return false;
+        }
+    }
+
+    sqes_map_size = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes_ptr = mmap(nullptr, sqes_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ring_fd, IORING_OFF_SQES);
+    if (sqes_ptr == MAP_FAILED) {
+        why_not = "mmap sqes failed";
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(sqes_ptr);
+
+    char* sq = static_cast<char*>(sq_ptr);
+    sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_entries = p.sq_entries;
+
+    char* cq = static_cast<char*>(cq_ptr);
+    cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+
+    // Make sure every opcode we rely on is implemented.
+    std::vector<char> probe_mem(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    auto* probe = reinterpret_cast<io_uring_probe*>(probe_mem.data());
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        why_not = std::string("probe: ") + std::strerror(errno);
+        return false;
+    }
+    for (unsigned op : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_ASYNC_CANCEL,
+                        IORING_OP_POLL_ADD}) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            why_not = "opcode " + std::to_string(op) + " not supported";
+            return false;
+        }
+    }
+
+    buf_count = BUF_COUNT;
+    buf_ring_map_size = buf_count * sizeof(io_uring_buf);
+    void* br = mmap(nullptr, buf_ring_map_size, PROT_READ | PROT_WRITE,
+                    MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (br == MAP_FAILED) {
+        why_not = "mmap buffer ring failed";
+        return false;
+    }
+    buf_ring = static_cast<io_uring_buf_ring*>(br);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring);
+    reg.ring_entries = buf_count;
+    reg.bgid = BUF_GROUP;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        why_not = std::string("register buffer ring: ") + std::strerror(errno);
+        return false;
+    }
+
+    buf_pool.resize(static_cast<size_t>(buf_count) * BUF_SIZE);
+    for (unsigned i = 0; i < buf_count; i++) {
+        recycle_buffer(static_cast<uint16_t>(i));
+    }
+    publish_buffers();
+
+    return true;
+}
+
+UringReactor::~UringReactor() {
+    if (buf_ring) munmap(buf_ring, buf_ring_map_size);
+    if (sqes) munmap(sqes, sqes_map_size);
+    if (cq_ptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_map_size);
+    if (sq_ptr) munmap(sq_ptr, sq_map_size);
+    if (ring_fd >= 0) ::close(ring_fd);
+}
+
+io_uring_sqe* UringReactor::get_sqe() {
+    unsigned tail = *sq_tail;
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= sq_entries) {
+        // Ring full: push what we have to the kernel first.
+        int ret = enter(to_submit, 0, -1);
+        if (ret > 0) to_submit -= static_cast<unsigned>(ret);
+        head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= sq_entries) return nullptr;
+    }
+
+    const unsigned idx = tail & sq_mask;
+    io_uring_sqe* sqe = &sqes[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[idx] = idx;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    to_submit++;
+    return sqe;
+}
+
+int UringReactor::enter(unsigned submit, unsigned min_complete, int timeout_ms) {
+    unsigned flags = 0;
+    if (min_complete > 0) flags |= IORING_ENTER_GETEVENTS;
+
+    if (min_complete > 0 && timeout_ms >= 0) {
+        __kernel_timespec ts{};
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+
+        io_uring_getevents_arg arg{};
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        flags |= IORING_ENTER_EXT_ARG;
+        return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, submit, min_complete,
+                                        flags, &arg, sizeof(arg)));
+    }
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, submit, min_complete,
+                                    flags, nullptr, 0));
+}
+
+UringReactor::Conn& UringReactor::conn_of(int fd) {
+    if (static_cast<size_t>(fd) >= conns.size()) {
+        conns.resize(static_cast<size_t>(fd) + 1);
+    }
+    return conns[static_cast<size_t>(fd)];
+}
+
+void UringReactor::open_conn(int fd) {
+    Conn& c = conn_of(fd);
+    c.open = true;
+    c.closing = false;
+    c.send_inflight = false;
+    c.wait_writable = false;
+    c.pending.clear();
+    c.out.clear();
+    c.out_off = 0;
+    c.out_bytes = 0;
+    arm_recv(fd);
+}
+
+void UringReactor::arm_accept() {
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = pack_user_data(OP_ACCEPT, 0, listen_fd);
+}
+
+void UringReactor::arm_wakeup() {
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wakeup_fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = pack_user_data(OP_WAKEUP, 0, wakeup_fd);
+}
+
+void UringReactor::arm_recv(int fd) {
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = pack_user_data(OP_RECV, conn_of(fd).gen, fd);
+}
+
+// One-shot: the completion resubmits the send the kernel could not take.
+void UringReactor::arm_writable(int fd) {
+    Conn& c = conn_of(fd);
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) return;
+    c.wait_writable = true;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = pack_user_data(OP_WRITABLE, c.gen, fd);
+}
+
+void UringReactor::mark_dirty(int fd) {
+    Conn& c = conn_of(fd);
+    if (c.dirty) return;
+    c.dirty = true;
+    dirty_fds.push_back(fd);
+}
+
+// Turns the direct sends coalesced so far into a chunk, in order with the broadcasts.
+void UringReactor::seal_pending(Conn& c) {
+    if (c.pending.empty()) return;
+    c.out_bytes += c.pending.size();
+    c.out.push_back(std::make_shared<const std::string>(std::move(c.pending)));
+    c.pending.clear();
+}
+
+// Gathers the queued chunks straight from their (possibly shared) buffers.
+void UringReactor::submit_send(int fd) {
+    Conn& c = conn_of(fd);
+    seal_pending(c);
+    if (c.out.empty()) return;
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) return;
+
+    if (!c.msg) c.msg = std::make_unique<SendMsg>();
+    std::vector<iovec>& iov = c.msg->iov;
+    iov.clear();
+    for (size_t i = 0; i < c.out.size() && i < MAX_SEND_IOV; i++) {
+        const std::string& chunk = *c.out[i];
+        const size_t skip = i == 0 ? c.out_off : 0;
+        iov.push_back(iovec{const_cast<char*>(chunk.data() + skip), chunk.size() - skip});
+    }
+    c.msg->hdr = msghdr{};
+    c.msg->hdr.msg_iov = iov.data();
+    c.msg->hdr.msg_iovlen = iov.size();
+    c.send_inflight = true;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&c.msg->hdr);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+    sqe->user_data = pack_user_data(OP_SEND, c.gen, fd);
+}
+
+void UringReactor::flush_sends() {
+    for (int fd : dirty_fds) {
+        Conn& c = conn_of(fd);
+        c.dirty = false;
+        if (c.open && !c.send_inflight && !c.wait_writable) {
+            submit_send(fd);
+        }
+    }
+    dirty_fds.clear();
+}
+
+// Never called with a send in flight: the kernel may still be reading its buffers.
+void UringReactor::finish_close(int fd) {
+    Conn& c = conn_of(fd);
+
+    io_uring_sqe* sqe = get_sqe();
+    if (sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = pack_user_data(OP_RECV, c.gen, fd);
+        sqe->user_data = pack_user_data(OP_CANCEL, c.gen, fd);
+    }
+    if (c.wait_writable && (sqe = get_sqe()) != nullptr) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = pack_user_data(OP_WRITABLE, c.gen, fd);
+        sqe->user_data = pack_user_data(OP_CANCEL, c.gen, fd);
+    }
+
+    ::close(fd);
+    c.open = false;
+    c.closing = false;
+    c.send_inflight = false;
+    c.wait_writable = false;
+    c.gen = (c.gen + 1) & GEN_MASK;
+    c.pending.clear();
+    c.out.clear();
+    c.out_off = 0;
+    c.out_bytes = 0;
+}
+
+// A closing connection whose peer is still not reading after CLOSE_LINGER is dropped with
+// its output; one with a send in flight is settled by that send's completion.
+void UringReactor::expire_lingering() {
+    const auto now = std::chrono::steady_clock::now();
+    auto done = [&](const std::pair<int, uint32_t>& entry) {
+        Conn& c = conn_of(entry.first);
+        if (c.gen != entry.second || !c.open || !c.closing) return true;   // drained
+        if (now < c.linger_until || c.send_inflight) return false;
+        finish_close(entry.first);
+        return true;
+    };
+    lingering.erase(std::remove_if(lingering.begin(), lingering.end(), done), lingering.end());
+}
+
+void UringReactor::recycle_buffer(uint16_t bid) {
+    // Index the ring as a plain io_uring_buf array: in C++ the header's flex-array
+    // wrapper shifts bufs[] by 8 bytes. Writes are field-wise because bufs[0].resv
+    // overlaps the ring tail.
+    io_uring_buf* bufs = reinterpret_cast<io_uring_buf*>(buf_ring);
+    io_uring_buf& b = bufs[buf_tail & (buf_count - 1)];
+    b.addr = reinterpret_cast<uint64_t>(buf_pool.data() + static_cast<size_t>(bid) * BUF_SIZE);
+    b.len = static_cast<uint32_t>(BUF_SIZE);
+    b.bid = bid;
+    buf_tail++;
+}
+
+void UringReactor::publish_buffers() {
+    __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}
+
+void UringReactor::listen(int fd) {
+    listen_fd = fd;
+    arm_accept();
+}
+
+void UringReactor::add_wakeup(int event_fd) {
+    wakeup_fd = event_fd;
+    arm_wakeup();
+}
+
+// Accepted sockets come non-blocking from the ring; adopted ones are switched here.
+void UringReactor::adopt(int fd) {
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0 && !(flags & O_NONBLOCK)) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    open_conn(fd);
+}
+
+std::string UringReactor::pending_output(int fd) const {
+    std::string out;
+    if (fd < 0 || static_cast<size_t>(fd) >= conns.size()) return out;
+    const Conn& c = conns[static_cast<size_t>(fd)];
+    for (size_t i = 0; i < c.out.size(); i++) {
+        out.append(*c.out[i], i == 0 ? c.out_off : 0, std::string::npos);
+    }
+    return out + c.pending;
+}
+
+void UringReactor::send(int fd, const char* data, size_t len) {
+    Conn& c = conn_of(fd);
+    if (!c.open || c.closing) return;
+    c.pending.append(data, len);
+    mark_dirty(fd);
+    if (c.out_bytes + c.pending.size() > MAX_BACKLOG) ::shutdown(fd, SHUT_RDWR);
+}
+
+// Queued by reference: every recipient's SENDMSG points into the one shared buffer.
+bool UringReactor::send_shared(int fd, const SharedBytes& bytes) {
+    Conn& c = conn_of(fd);
+    if (!c.open || c.closing) return true;
+    if (c.out_bytes + c.pending.size() > MAX_SHARED_BACKLOG) return false;
+    seal_pending(c);
+    c.out.push_back(bytes);
+    c.out_bytes += bytes->size();
+    mark_dirty(fd);
+    return true;
+}
+
+void UringReactor::close(int fd) {
+    Conn& c = conn_of(fd);
+    if (!c.open || c.closing) return;
+    if (c.send_inflight || c.wait_writable || c.out_bytes > 0 || !c.pending.empty()) {
+        // Let queued responses (e.g. RES_LOGOUT_OK) reach the peer first.
+        c.closing = true;
+        c.linger_until = std::chrono::steady_clock::now() + CLOSE_LINGER;
+        lingering.emplace_back(fd, c.gen);
+        return;
+    }
+    finish_close(fd);
+}
+
+void UringReactor::handle_cqe(ReactorHandler& handler, const io_uring_cqe& cqe) {
+    const uint64_t op = cqe.user_data >> 56;
+    const uint32_t gen = static_cast<uint32_t>(cqe.user_data >> 32) & GEN_MASK;
+    const int fd = static_cast<int>(cqe.user_data & 0xffffffffu);
+    const bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+
+    switch (op) {
+        case OP_ACCEPT: {
+            if (cqe.res >= 0) {
+                const int client_fd = cqe.res;
+                open_conn(client_fd);
+                handler.on_accept(client_fd);
+            } else if (cqe.res != -ECANCELED) {
+                std::cerr << "[ERR] accept: " << std::strerror(-cqe.res) << "\n";
+            }
+            if (!more) arm_accept();
+            break;
+        }
+
+        case OP_RECV: {
+            const bool has_buf = (cqe.flags & IORING_CQE_F_BUFFER) != 0;
+            const uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+
+            const bool live = static_cast<size_t>(fd) < conns.size() &&
+                              conns[fd].open && !conns[fd].closing && conns[fd].gen == gen;
+            if (!live) {
+                if (has_buf) recycle_buffer(bid);
+                break;
+            }
+
+            if (cqe.res > 0) {
+                const char* data = buf_pool.data() + static_cast<size_t>(bid) * BUF_SIZE;
+                handler.on_data(fd, data, static_cast<size_t>(cqe.res));
+                recycle_buffer(bid);
+
+                const Conn& c = conn_of(fd);
+                if (!more && c.open && !c.closing && c.gen == gen) arm_recv(fd);
+            } else if (cqe.res == -ENOBUFS) {
+                // All provided buffers are in use; they come back as soon as this batch is processed.
+                if (!more) arm_recv(fd);
+            } else {
+                if (has_buf) recycle_buffer(bid);
+                handler.on_hangup(fd);
+            }
+            break;
+        }
+
+        case OP_SEND: {
+            Conn& c = conn_of(fd);
+            if (c.gen != gen || !c.send_inflight) break;
+            c.send_inflight = false;
+
+            if (cqe.res == -EAGAIN) {
+                // The peer is not reading; wait for room rather than spin on the send.
+                if (c.closing && std::chrono::steady_clock::now() >= c.linger_until) {
+                    finish_close(fd);
+                } else {
+                    arm_writable(fd);
+                }
+                break;
+            }
+            if (cqe.res < 0) {
+                if (cqe.res != -EPIPE && cqe.res != -ECONNRESET) {
+                    std::cerr << "[ERR] send: " << std::strerror(-cqe.res) << "\n";
+                }
+                c.pending.clear();
+                c.out.clear();
+                c.out_off = 0;
+                c.out_bytes = 0;
+            } else {
+                size_t sent = static_cast<size_t>(cqe.res);
+                c.out_bytes -= sent;
+                while (sent > 0) {
+                    const size_t left = c.out.front()->size() - c.out_off;
+                    if (sent < left) {
+                        c.out_off += sent;
+                        break;
+                    }
+                    sent -= left;
+                    c.out.pop_front();
+                    c.out_off = 0;
+                }
+            }
+
+            if (c.out_bytes > 0 || !c.pending.empty()) {
+                submit_send(fd);
+            } else if (c.closing) {
+                finish_close(fd);
+            }
+            break;
+        }
+
+        case OP_WRITABLE: {
+            Conn& c = conn_of(fd);
+            if (c.gen != gen || !c.open || !c.wait_writable) break;
+            c.wait_writable = false;
+            submit_send(fd);   // a dead peer shows up as the send's error
+            break;
+        }
+
+        case OP_WAKEUP: {
+            if (cqe.res >= 0) {
+                uint64_t count = 0;
+                if (read(wakeup_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("read");
+                handler.on_wakeup();
+            }
+            if (!more) arm_wakeup();
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+bool UringReactor::poll(ReactorHandler& handler, int timeout_ms) {
+    flush_sends();
+
+    // One syscall both submits the batch and waits for completions.
+    const bool have_cqes = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) != *cq_head;
+    if (to_submit > 0 || !have_cqes) {
+        int ret = enter(to_submit, have_cqes ? 0 : 1, timeout_ms);
+        if (ret < 0) {
+            if (errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                perror("io_uring_enter");
+                return false;
+            }
+        } else {
+            to_submit -= static_cast<unsigned>(ret);
+        }
+    }
+
+    unsigned head = *cq_head;
+    const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    if (head != tail) handler.on_batch_begin();
+    while (head != tail) {
+        const io_uring_cqe cqe = cqes[head & cq_mask];
+        head++;
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        handle_cqe(handler, cqe);
+    }
+
+    if (!lingering.empty()) expire_lingering();
+    publish_buffers();
+    return true;
+}
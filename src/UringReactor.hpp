@@ -0,0 +1,115 @@
+#pragma once
+
+#include "Reactor.hpp"
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// io_uring backend: multishot accept, multishot recv into a registered
+// provided-buffer ring, and per-fd gathered sends submitted in one batch per poll().
+// Sockets are non-blocking; a send the kernel cannot take waits on a POLLOUT poll.
+class UringReactor : public Reactor {
+public:
+    // Returns nullptr (and the reason) when the running kernel cannot support this backend.
+    static std::unique_ptr<UringReactor> create(std::string& why_not);
+    ~UringReactor() override;
+
+    const char* name() const override { return "io_uring"; }
+
+    void listen(int listen_fd) override;
+    void add_wakeup(int event_fd) override;
+    void adopt(int fd) override;
+    std::string pending_output(int fd) const override;
+    bool set_recv_buffer(size_t) override { return false; }   // registered with the kernel
+    void send(int fd, const char* data, size_t len) override;
+    void close(int fd) override;
+    bool send_shared(int fd, const SharedBytes& bytes) override;
+    bool poll(ReactorHandler& handler, int timeout_ms) override;
+
+private:
+    UringReactor() = default;
+
+    // Handed to the kernel by address, so it lives on the heap, clear of conns resizing.
+    struct SendMsg {
+        msghdr hdr{};
+        std::vector<iovec> iov;
+    };
+
+    struct Conn {
+        uint32_t gen{0};
+        bool open{false};
+        bool closing{false};
+        bool dirty{false};           // listed in dirty_fds
+        bool send_inflight{false};
+        bool wait_writable{false};   // a POLLOUT poll is armed after -EAGAIN
+        std::string pending;         // direct sends coalesced since the last submission
+        std::deque<SharedBytes> out; // sealed chunks, broadcasts shared with other conns
+        size_t out_off{0};           // bytes of out.front() already sent
+        size_t out_bytes{0};         // unsent bytes in out
+        std::unique_ptr<SendMsg> msg;
+        std::chrono::steady_clock::time_point linger_until;
+    };
+
+    int ring_fd{-1};
+
+    void* sq_ptr{nullptr};
+    size_t sq_map_size{0};
+    void* cq_ptr{nullptr};
+    size_t cq_map_size{0};
+    io_uring_sqe* sqes{nullptr};
+    size_t sqes_map_size{0};
+
+    unsigned* sq_head{nullptr};
+    unsigned* sq_tail{nullptr};
+    unsigned* sq_array{nullptr};
+    unsigned sq_mask{0};
+    unsigned sq_entries{0};
+    unsigned to_submit{0};
+
+    unsigned* cq_head{nullptr};
+    unsigned* cq_tail{nullptr};
+    io_uring_cqe* cqes{nullptr};
+    unsigned cq_mask{0};
+
+    io_uring_buf_ring* buf_ring{nullptr};
+    size_t buf_ring_map_size{0};
+    std::vector<char> buf_pool;
+    unsigned buf_count{0};
+    uint16_t buf_tail{0};
+
+    int listen_fd{-1};
+    int wakeup_fd{-1};
+    std::vector<Conn> conns;     // indexed by fd
+    std::vector<int> dirty_fds;  // fds with queued output
+    std::vector<std::pair<int, uint32_t>> lingering;   // (fd, gen) closed with output left
+
+    bool setup(std::string& why_not);
+
+    io_uring_sqe* get_sqe();
+    int enter(unsigned submit, unsigned min_complete, int timeout_ms);
+
+    Conn& conn_of(int fd);
+    void open_conn(int fd);
+    void arm_accept();
+    void arm_wakeup();
+    void arm_recv(int fd);
+    void arm_writable(int fd);
+    void mark_dirty(int fd);
+    void seal_pending(Conn& c);
+    void submit_send(int fd);
+    void flush_sends();
+    void finish_close(int fd);
+    void expire_lingering();
+    void recycle_buffer(uint16_t bid);
+    void publish_buffers();
+
+    void handle_cqe(ReactorHandler& handler, const io_uring_cqe& cqe);
+};
@@ -1,5 +1,9 @@
+#include "Bench.hpp"
+#include "Replay.hpp"
 #include "Server.hpp"
 
+#include <sched.h>
+
 #include <iostream>
 #include <cstring>
 #include <string>
@@ -11,6 +15,9 @@ namespace {
     constexpr int MIN_PORT = 1024;
     constexpr int MAX_PORT = 65535;
 
+    // Long enough to catch a reply within the same request/response exchange.
+    constexpr int DEFAULT_SPIN_US = 200;
+
     int parse_port_or_throw(const std::string& s) {
         size_t idx = 0;
         int p = 0;
@@ -27,29 +34,90 @@ namespace {
         }
         return p;
     }
+
+    size_t parse_count_or_throw(const std::string& s) {
+        size_t idx = 0;
+        unsigned long v = 0;
+        try {
+            v = std::stoul(s, &idx);
+        } catch (const std::exception&) {
+            throw std::runtime_error("Count must be a number");
+        }
+        if (idx != s.size() || v == 0) {
+            throw std::runtime_error("Count must be a positive number");
+        }
+        return static_cast<size_t>(v);
+    }
+
+    int parse_cpu_or_throw(const std::string& s) {
+        size_t idx = 0;
+        int v = -1;
+        try {
+            v = std::stoi(s, &idx);
+        } catch (const std::exception&) {
+            throw std::runtime_error("CPU must be a number");
+        }
+        if (idx != s.size() || v < 0 || v >= CPU_SETSIZE) {
+            throw std::runtime_error("CPU must be in range 0.." + std::to_string(CPU_SETSIZE - 1));
+        }
+        return v;
+    }
 }
 
 void print_usage(const char* prog_name) {
     std::cerr << "Usage: " << prog_name << " [options]\n"
               << "Options:\n"
-              << "  --ip <address>       IP address to bind (default: 0.0.0.0)\n"
-              << "  --port <number>      Port to listen on (default: 10000)\n"
-              << "  --no-heartbeat       Disable heartbeat mechanism\n"
-              << "  --with-hb-logs       Enable verbose heartbeat logs\n";
+              << "  --ip <address>             IP address to bind (default: 0.0.0.0)\n"
+              << "  --port <number>            Port to listen on (default: 10000)\n"
+              << "  --no-heartbeat             Disable heartbeat mechanism\n"
+              << "  --with-hb-logs             Enable verbose heartbeat logs\n"
+              << "  --liveness <mode>          ping (PING every 2s) or traffic (PING only when idle)\n"
+              << "  --ping-idle <ms>           Idle time before a PING in traffic mode (default: 2000)\n"
+              << "  --io-backend <name>        I/O backend: epoll or uring (default: epoll)\n"
+              << "  --game-workers <n>         Run game logic on n shard threads (default: inline)\n"
+              << "  --shed-login-lag <ms>      Refuse new logins above this loop lag (default: 25)\n"
+              << "  --shed-lobby-lag <ms>      Also refuse new lobbies above this loop lag (default: 100)\n"
+              << "  --shed-login-sessions <n>  Refuse new logins above n connections (default: off)\n"
+              << "  --shed-lobby-sessions <n>  Also refuse new lobbies above n connections (default: off)\n"
+              << "  --max-connections <n>      Close new connections beyond n (default: off)\n"
+              << "  --stats-interval <s>       Print [STATS] metrics every s seconds (default: off)\n"
+              << "  --history-dir <path>       Record match history in this directory (default: off)\n"
+              << "  --ratings <path>           Keep Elo ratings in this file (default: memory only)\n"
+              << "  --snapshot <path>          Snapshot lobbies to this file and restore them on start (default: off)\n"
+              << "  --snapshot-interval <ms>   Time between snapshot captures (default: 1000)\n"
+              << "  --upgrade-socket <path>    Let a newer process take over via this Unix socket (default: off)\n"
+              << "  --upgrade-from <path>      Take over sockets and sessions from the running server\n"
+              << "  --config <path>            Runtime tunables file, reloaded on SIGHUP (default: built-in)\n"
+              << "  --low-latency              TCP_NODELAY/TCP_QUICKACK on clients and spin " << DEFAULT_SPIN_US << "us before blocking\n"
+              << "  --spin-us <us>             Poll without blocking this long while traffic flows (default: 0)\n"
+              << "  --busy-poll <us>           SO_BUSY_POLL on client sockets (default: off)\n"
+              << "  --cpu <n>                  Pin the I/O thread to CPU n (default: off)\n"
+              << "  --cluster <list>           Share lobbies with these nodes: host:port,host:port,... (default: off)\n"
+              << "  --cluster-self <host:port> This node's entry in --cluster\n"
+              << "  --cluster-secret <s>       Shared by every --cluster node to authenticate peer links\n"
+              << "  --record <path>            Capture engine traffic to this file for --replay (default: off)\n"
+              << "  --replay <path>            Replay a --record capture in-process, check outputs and exit\n"
+              << "  --replay-realtime          Keep the recorded timing in --replay (default: as fast as possible)\n"
+              << "  --bench                    Run the in-process engine benchmark and exit\n"
+              << "  --bench-pairs <n>          Player pairs for --bench (default: 100)\n"
+              << "  --bench-matches <n>        Matches per pair for --bench (default: 100)\n"
+              << "  --bench-idle <n>           Idle sessions for the --bench memory check (default: 10000)\n"
+              << "  --bench-soak <n>           Sessions for an hour of heartbeats on virtual time in --bench (default: off)\n"
+              << "  --bench-queue <n>          Players through the matchmaking queue in --bench (default: off)\n";
 }
 
 int main(int argc, char** argv) {
-    std::string ip_address = "0.0.0.0";
-    int port = 10000;
-    bool enable_heartbeat = true;
-    bool heartbeat_logs = false;
+    ServerOptions options;
+    bool bench = false;
+    BenchOptions bench_opts;
+    ReplayOptions replay_opts;
 
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
 
         if (arg == "--ip") {
             if (i + 1 < argc) {
-                ip_address = argv[++i];
+                options.host = argv[++i];
             } else {
                 std::cerr << "[ERR] Missing value for --ip\n";
                 return 1;
@@ -57,7 +125,7 @@ int main(int argc, char** argv) {
         } else if (arg == "--port") {
             if (i + 1 < argc) {
                 try {
-                    port = parse_port_or_throw(argv[++i]);
+                    options.port = parse_port_or_throw(argv[++i]);
                 } catch (const std::exception& e) {
                     std::cerr << "[ERR] " << e.what() << "\n";
                     return 1;
@@ -67,15 +135,212 @@ int main(int argc, char** argv) {
                 return 1;
             }
         } else if (arg == "--no-heartbeat") {
-            enable_heartbeat = false;
+            options.heartbeat.enabled = false;
         } else if (arg == "--with-hb-logs") {
-            heartbeat_logs = true;
+            options.heartbeat.logs = true;
+        } else if (arg == "--liveness") {
+            if (i + 1 < argc) {
+                const std::string mode = argv[++i];
+                if (mode == "ping") {
+                    options.heartbeat.piggyback = false;
+                } else if (mode == "traffic") {
+                    options.heartbeat.piggyback = true;
+                } else {
+                    std::cerr << "[ERR] Unknown liveness mode: " << mode << "\n";
+                    return 1;
+                }
+            } else {
+                std::cerr << "[ERR] Missing value for --liveness\n";
+                return 1;
+            }
+        } else if (arg == "--ping-idle") {
+            if (i + 1 < argc) {
+                try {
+                    options.heartbeat.ping_idle = std::chrono::milliseconds(parse_count_or_throw(argv[++i]));
+                } catch (const std::exception& e) {
+                    std::cerr << "[ERR] " << e.what() << "\n";
+                    return 1;
+                }
+            } else {
+                std::cerr << "[ERR] Missing value for --ping-idle\n";
+                return 1;
+            }
+        } else if (arg == "--io-backend") {
+            if (i + 1 < argc) {
+                if (!parse_io_backend(argv[++i], options.io_backend)) {
+                    std::cerr << "[ERR] Unknown I/O backend: " << argv[i] << "\n";
+                    return 1;
+                }
+            } else {
+                std::cerr << "[ERR] Missing value for --io-backend\n";
+                return 1;
+            }
+        } else if (arg == "--game-workers") {
+            if (i + 1 < argc) {
+                try {
+                    options.game_workers = parse_count_or_throw(argv[++i]);
+                } catch (const std::exception& e) {
+                    std::cerr << "[ERR] " << e.what() << "\n";
+                    return 1;
+                }
+            } else {
+                std::cerr << "[ERR] Missing value for --game-workers\n";
+                return 1;
+            }
+        } else if (arg == "--shed-login-lag" || arg == "--shed-lobby-lag" ||
+                   arg == "--shed-login-sessions" || arg == "--shed-lobby-sessions" ||
+                   arg == "--max-connections") {
+            if (i + 1 < argc) {
+                try {
+                    size_t v = parse_count_or_throw(argv[++i]);
+                    AdmissionOptions& a = options.admission;
+                    if (arg == "--shed-login-lag") a.login_lag = std::chrono::milliseconds(v);
+                    else if (arg == "--shed-lobby-lag") a.lobby_lag = std::chrono::milliseconds(v);
+                    else if (arg == "--shed-login-sessions") a.login_sessions = v;
+                    else if (arg == "--shed-lobby-sessions") a.lobby_sessions = v;
+                    else a.max_connections = v;
+                } catch (const std::exception& e) {
+                    std::cerr << "[ERR] " << e.what() << "\n";
+                    return 1;
+                }
+            } else {
+                std::cerr << "[ERR] Missing value for " << arg << "\n";
+                return 1;
+            }
+        } else if (arg == "--stats-interval") {
+            if (i + 1 < argc) {
+                try {
+                    options.stats_interval_s = static_cast<int>(parse_count_or_throw(argv[++i]));
+                } catch (const std::exception& e) {
+                    std::cerr << "[ERR] " << e.what() << "\n";
+                    return 1;
+                }
+            } else {
+                std::cerr << "[ERR] Missing value for --stats-interval\n";
+                return 1;
+            }
+        } else if (arg == "--history-dir") {
+            if (i + 1 < argc) {
+                options.history_dir = argv[++i];
+            } else {
+                std::cerr << "[ERR] Missing value for --history-dir\n";
+                return 1;
+            }
+        } else if (arg == "--snapshot") {
+            if (i + 1 < argc) {
+                options.snapshot_path = argv[++i];
+            } else {
+                std::cerr << "[ERR] Missing value for --snapshot\n";
+                return 1;
+            }
+        } else if (arg == "--snapshot-interval") {
+            if (i + 1 < argc) {
+                try {
+                    options.snapshot_interval = std::chrono::milliseconds(parse_count_or_throw(argv[++i]));
+                } catch (const std::exception& e) {
+                    std::cerr << "[ERR] " << e.what() << "\n";
+                    return 1;
+                }
+            } else {
+                std::cerr << "[ERR] Missing value for --snapshot-interval\n";
+                return 1;
+            }
+        } else if (arg == "--upgrade-socket" || arg == "--upgrade-from") {
+            if (i + 1 < argc) {
+                if (arg == "--upgrade-socket") options.upgrade_socket = argv[++i];
+                else options.upgrade_from = argv[++i];
+            } else {
+                std::cerr << "[ERR] Missing value for " << arg << "\n";
+                return 1;
+            }
+        } else if (arg == "--low-latency") {
+            options.latency.tcp = true;
+            if (options.latency.spin.count() == 0) options.latency.spin = std::chrono::microseconds(DEFAULT_SPIN_US);
+        } else if (arg == "--spin-us" || arg == "--busy-poll") {
+            if (i + 1 < argc) {
+                try {
+                    const size_t v = parse_count_or_throw(argv[++i]);
+                    if (arg == "--spin-us") options.latency.spin = std::chrono::microseconds(v);
+                    else options.latency.busy_poll_us = static_cast<int>(v);
+                } catch (const std::exception& e) {
+                    std::cerr << "[ERR] " << e.what() << "\n";
+                    return 1;
+                }
+            } else {
+                std::cerr << "[ERR] Missing value for " << arg << "\n";
+                return 1;
+            }
+        } else if (arg == "--cpu") {
+            if (i + 1 < argc) {
+                try {
+                    options.latency.cpu = parse_cpu_or_throw(argv[++i]);
+                } catch (const std::exception& e) {
+                    std::cerr << "[ERR] " << e.what() << "\n";
+                    return 1;
+                }
+            } else {
+                std::cerr << "[ERR] Missing value for --cpu\n";
+                return 1;
+            }
+        } else if (arg == "--ratings") {
+            if (i + 1 < argc) {
+                options.ratings_path = argv[++i];
+            } else {
+                std::cerr << "[ERR] Missing value for --ratings\n";
+                return 1;
+            }
+        } else if (arg == "--config") {
+            if (i + 1 < argc) {
+                options.config_path = argv[++i];
+            } else {
+                std::cerr << "[ERR] Missing value for --config\n";
+                return 1;
+            }
+        } else if (arg == "--cluster" || arg == "--cluster-self" || arg == "--cluster-secret") {
+            if (i + 1 < argc) {
+                if (arg == "--cluster") options.cluster_nodes = argv[++i];
+                else if (arg == "--cluster-self") options.cluster_self = argv[++i];
+                else options.cluster_secret = argv[++i];
+            } else {
+                std::cerr << "[ERR] Missing value for " << arg << "\n";
+                return 1;
+            }
+        } else if (arg == "--record" || arg == "--replay") {
+            if (i + 1 < argc) {
+                if (arg == "--record") options.record_path = argv[++i];
+                else replay_opts.path = argv[++i];
+            } else {
+                std::cerr << "[ERR] Missing value for " << arg << "\n";
+                return 1;
+            }
+        } else if (arg == "--replay-realtime") {
+            replay_opts.realtime = true;
+        } else if (arg == "--bench") {
+            bench = true;
+        } else if (arg == "--bench-pairs" || arg == "--bench-matches" || arg == "--bench-idle" ||
+                   arg == "--bench-soak" || arg == "--bench-queue") {
+            if (i + 1 < argc) {
+                try {
+                    size_t v = parse_count_or_throw(argv[++i]);
+                    if (arg == "--bench-pairs") bench_opts.pairs = v;
+                    else if (arg == "--bench-matches") bench_opts.matches = v;
+                    else if (arg == "--bench-idle") bench_opts.idle = v;
+                    else if (arg == "--bench-soak") bench_opts.soak = v;
+                    else bench_opts.queue = v;
+                } catch (const std::exception& e) {
+                    std::cerr << "[ERR] " << e.what() << "\n";
+                    return 1;
+                }
+            } else {
+                std::cerr << "[ERR] Missing value for " << arg << "\n";
+                return 1;
+            }
         } else if (arg == "--help" || arg == "-h") {
             print_usage(argv[0]);
             return 0;
         } else {
             try {
-                port = parse_port_or_throw(arg);
+                options.port = parse_port_or_throw(arg);
             } catch (...) {
                 std::cerr << "[ERR] Unknown argument: " << arg << "\n";
                 print_usage(argv[0]);
@@ -84,8 +349,53 @@ int main(int argc, char** argv) {
         }
     }
 
+    if (bench) {
+        return run_engine_benchmark(bench_opts);
+    }
+    if (!replay_opts.path.empty()) {
+        return run_replay(replay_opts);
+    }
+
+    // A replay drives one engine from an empty start, like the one recorded.
+    if (!options.record_path.empty() &&
+        (options.game_workers > 0 || !options.cluster_nodes.empty() || !options.upgrade_from.empty())) {
+        std::cerr << "[ERR] --record needs an inline engine starting empty "
+                     "(no --game-workers, --cluster or --upgrade-from)\n";
+        return 1;
+    }
+
+    // Sessions are handed over from one inline engine, and only the epoll backend can
+    // stop reading at a batch boundary with nothing in flight.
+    if ((!options.upgrade_socket.empty() || !options.upgrade_from.empty()) && options.game_workers > 0) {
+        std::cerr << "[ERR] Hot upgrade is not supported with --game-workers\n";
+        return 1;
+    }
+    if (!options.upgrade_socket.empty() && options.io_backend != IoBackend::Epoll) {
+        std::cerr << "[ERR] --upgrade-socket needs --io-backend epoll\n";
+        return 1;
+    }
+
+    // The name directory and peer links live in the inline engine.
+    if (!options.cluster_nodes.empty() && options.game_workers > 0) {
+        std::cerr << "[ERR] Cluster mode is not supported with --game-workers\n";
+        return 1;
+    }
+    if (options.cluster_nodes.empty() != options.cluster_self.empty()) {
+        std::cerr << "[ERR] --cluster and --cluster-self go together\n";
+        return 1;
+    }
+    // Peers connect to the client port, so without a secret anyone could pose as one.
+    if (!options.cluster_nodes.empty() && options.cluster_secret.empty()) {
+        std::cerr << "[ERR] --cluster needs --cluster-secret\n";
+        return 1;
+    }
+    if (options.cluster_secret.find_first_of("|\r\n") != std::string::npos) {
+        std::cerr << "[ERR] --cluster-secret cannot contain '|' or line breaks\n";
+        return 1;
+    }
+
     try {
-        Server server(ip_address, port, enable_heartbeat, heartbeat_logs);
+        Server server(options);
         server.run();
     } catch (const std::exception& e) {
         std::cerr << "[ERR] " << e.what() << "\n";
@@ -1,67 +1,147 @@
 #include "Server.hpp"
+#include "AllocStats.hpp"
+#include "ProcStats.hpp"
+#include "ShardedEngine.hpp"
+#include "Upgrade.hpp"
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
-#include <cerrno>
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <iostream>
-#include <sstream>
-#include <chrono>
-#include <optional>
 #include <random>
-#include <ctime>
-#include <map>
-#include <set>
-
-static std::string phase_to_debug(SessionPhase ph) {
-    switch (ph) {
-        case SessionPhase::NotLoggedIn:      return "NotLoggedIn";
-        case SessionPhase::LoggedInNoLobby:  return "LoggedInNoLobby";
-        case SessionPhase::InLobby:          return "InLobby";
-        case SessionPhase::InGame:           return "InGame";
-        case SessionPhase::AFTER_GAME:       return "AfterGame";
-        case SessionPhase::INVALID:          return "Invalid";
-    }
-    return "Unknown";
-}
 
-static std::map<int, std::string> g_online_users;
-static std::set<std::string> g_active_lobbies;
+namespace {
+    // How often changed ratings are rewritten to --ratings.
+    constexpr std::chrono::milliseconds RATINGS_WRITE_INTERVAL{2000};
 
-struct LobbySnapshot {
-    std::string name;
-    size_t size;
-};
+    volatile std::sig_atomic_t reload_requested = 0;
 
-static std::optional<LobbySnapshot> snapshot_lobby_of(Game& game, int userId) {
-    auto lobbyOpt = game.getLobbyOf(userId);
-    if (!lobbyOpt.has_value()) return std::nullopt;
-    Lobby* lobby = lobbyOpt.value();
-    if (!lobby) return std::nullopt;
-    return LobbySnapshot{lobby->name, lobby->players.size()};
+    void request_reload(int) {
+        reload_requested = 1;
+    }
 }
 
-static void release_lobby_name(const std::string& lobbyName) {
-    auto it = g_active_lobbies.find(lobbyName);
-    if (it != g_active_lobbies.end()) {
-        g_active_lobbies.erase(it);
-        std::cerr << "[SYS] Lobby '" << lobbyName << "' destroyed. Name released.\n";
+Server::Server(const ServerOptions& options)
+    : reactor(make_reactor(options.io_backend)), admission(options.admission),
+      config_path(options.config_path), latency(options.latency), stats_interval(options.stats_interval_s) {
+
+    if (!config_path.empty()) {
+        std::string error;
+        if (!load_config(config_path, RuntimeConfig{}, config, error)) {
+            std::cerr << "[ERR] Config " << config_path << ": " << error << "\n";
+            std::exit(1);
+        }
+        struct sigaction sa{};
+        sa.sa_handler = request_reload;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGHUP, &sa, nullptr);
+    }
+
+    if (!options.history_dir.empty()) history = std::make_unique<HistoryLog>(options.history_dir);
+    ratings = std::make_unique<RatingTable>(options.ratings_path, RATINGS_WRITE_INTERVAL);
+    if (!options.snapshot_path.empty()) {
+        // After a handoff the engine state comes from the old process, not from the file.
+        snapshots = std::make_unique<SnapshotStore>(options.snapshot_path, options.snapshot_interval,
+                                                    options.upgrade_from.empty());
+    }
+
+    if (!options.cluster_nodes.empty()) {
+        cluster = std::make_unique<ClusterMap>();
+        std::string error;
+        if (!ClusterMap::parse(options.cluster_nodes, options.cluster_self, *cluster, error)) {
+            std::cerr << "[ERR] Invalid cluster: " << error << "\n";
+            std::exit(1);
+        }
+        cluster->set_secret(options.cluster_secret);
+        peer_links.assign(cluster->size(), 0);
+    }
+
+    SessionSink& sink = *this;
+    if (options.game_workers > 0) {
+        auto engine = std::make_unique<ShardedEngine>(sink, options.game_workers, options.heartbeat, &admission,
+                                                      history.get(), snapshots.get(), ratings.get());
+        sharded = engine.get();
+        reactor->add_wakeup(sharded->wake_fd());
+        host = std::move(engine);
+    } else {
+        auto inline_engine = std::make_unique<SessionEngine>(sink, options.heartbeat);
+        inline_engine->set_admission(&admission);
+        inline_engine->set_history(history.get());
+        inline_engine->set_ratings(ratings.get());
+        inline_engine->set_snapshots(snapshots.get());
+        if (cluster) inline_engine->set_id_space(cluster->self() + 1, static_cast<int>(cluster->size()));
+        if (snapshots) inline_engine->restore_snapshot(snapshots->restored());
+        if (cluster) inline_engine->set_cluster(cluster.get());
+        engine = inline_engine.get();
+        host = std::move(inline_engine);
+
+        if (!options.record_path.empty()) {
+            RecordingHeader header;
+            header.seed = (static_cast<uint64_t>(std::random_device{}()) << 32) | std::random_device{}();
+            header.heartbeat = options.heartbeat;
+            engine->seed_random(header.seed);
+            recorder = std::make_unique<TrafficRecorder>(options.record_path, header);
+        }
     }
-}
 
-Server::Server(const std::string& host, int port, bool enable_heartbeat, bool hb_logs)
-    : heartbeat_enabled(enable_heartbeat), heartbeat_logs(hb_logs) {
+    apply_config();
+    if (options.upgrade_from.empty()) init_socket(options.host, options.port);
+    else take_over(options.upgrade_from);
 
-    init_socket(host, port);
+    if (!options.upgrade_socket.empty()) {
+        upgrade_fd = open_upgrade_socket(options.upgrade_socket);
+        std::cerr << "[SYS] Accepting upgrades on " << options.upgrade_socket << "\n";
+    }
+    std::cerr << "[SYS] I/O backend: " << reactor->name() << "\n";
+    std::cerr << "[SYS] Config: ";
+    report_config(std::cerr, config);
+    std::cerr << (config_path.empty() ? " (built-in)" : " (SIGHUP reloads " + config_path + ")") << "\n";
+    if (cluster) {
+        std::cerr << "[SYS] Cluster node " << cluster->self() << " of " << cluster->size() << " ("
+                  << cluster->node(cluster->self()).address() << ")\n";
+    }
 
     std::srand(static_cast<unsigned>(std::time(nullptr)));
 
-    if (heartbeat_enabled) {
-        std::cerr << "[SYS] Heartbeat enabled (2s ping, 5s timeout)\n";
-        if (heartbeat_logs) {
+    // Threads started above (game workers, history writer) keep their own placement.
+    if (latency.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(latency.cpu, &set);
+        const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) std::cerr << "[ERR] Cannot pin I/O thread to CPU " << latency.cpu << ": " << std::strerror(err) << "\n";
+        else std::cerr << "[SYS] I/O thread pinned to CPU " << latency.cpu << "\n";
+    }
+    if (latency.tcp || latency.spin.count() > 0 || latency.busy_poll_us > 0) {
+        std::cerr << "[SYS] Low latency: nodelay/quickack " << (latency.tcp ? "on" : "off")
+                  << ", spin " << latency.spin.count() << "us, busy poll " << latency.busy_poll_us << "us\n";
+    }
+
+    if (stats_interval.count() > 0) {
+        next_stats = std::chrono::steady_clock::now() + stats_interval;
+        std::cerr << "[SYS] Stats report every " << stats_interval.count() << "s\n";
+    }
+
+    if (options.heartbeat.enabled) {
+        if (options.heartbeat.piggyback) {
+            std::cerr << "[SYS] Heartbeat enabled (traffic counts as liveness, PING after "
+                      << options.heartbeat.ping_idle.count() << "ms idle)\n";
+        } else {
+            std::cerr << "[SYS] Heartbeat enabled (" << config.ping_interval.count() << "ms ping, "
+                      << config.pong_timeout.count() << "ms timeout)\n";
+        }
+        if (options.heartbeat.logs) {
             std::cerr << "[SYS] Heartbeat debug logs enabled\n";
         }
     } else {
@@ -69,6 +149,9 @@ Server::Server(const std::string& host, int port, bool enable_heartbeat, bool hb
     }
 }
 
+// Out of line so ShardedEngine is complete where unique_ptr<SessionHost> destroys it.
+Server::~Server() = default;
+
 void Server::init_socket(const std::string& host, int port) {
     listen_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (listen_fd < 0) {
@@ -93,651 +176,311 @@ void Server::init_socket(const std::string& host, int port) {
         std::exit(1);
     }
 
-    if (listen(listen_fd, 16) < 0) {
+    if (listen(listen_fd, config.listen_backlog) < 0) {
         perror("listen");
         std::exit(1);
     }
 
-    FD_ZERO(&master_set);
-    FD_SET(listen_fd, &master_set);
-    max_fd = listen_fd;
+    reactor->listen(listen_fd);
 
     std::cerr << "[SYS] Listening on " << host << ":" << port << "\n";
 }
 
-void Server::accept_client() {
-    sockaddr_in client_addr{};
-    socklen_t len = sizeof(client_addr);
-    int client_fd = accept(listen_fd, (sockaddr*)&client_addr, &len);
-    if (client_fd < 0) return;
-
-    FD_SET(client_fd, &master_set);
-    if (client_fd > max_fd) max_fd = client_fd;
-
-    client_buffers[client_fd] = "";
-
-    Heartbeat hb;
-    auto now = std::chrono::steady_clock::now();
-    hb.last_pong = now;
-    hb.last_ping = now;
-    hb.last_nonce = "";
+// Adopts the old process's sockets and sessions; the old process exits once confirmed.
+void Server::take_over(const std::string& upgrade_path) {
+    Handoff handoff;
+    int conn = -1;
+    std::string error;
+    if (!receive_handoff(upgrade_path, handoff, conn, error)) {
+        std::cerr << "[ERR] Upgrade from " << upgrade_path << " failed: " << error << "\n";
+        std::exit(1);
+    }
 
-    heartbeats[client_fd] = hb;
-    std::cerr << "[SYS] Client connected fd=" << client_fd << "\n";
-}
+    listen_fd = handoff.listen_fd;
+    reactor->listen(listen_fd);
 
-void Server::remove_client(int fd) {
-    close(fd);
-    FD_CLR(fd, &master_set);
-    client_buffers.erase(fd);
-    heartbeats.erase(fd);
-}
-
-SessionPhase Server::get_phase(int fd) const {
-    auto it = fd_to_player.find(fd);
-    if (it == fd_to_player.end()) {
-        return SessionPhase::NotLoggedIn;
+    EngineImage& image = handoff.engine;
+    for (size_t i = 0; i < image.sessions.size(); i++) {
+        const int fd = handoff.fds[i];
+        image.sessions[i].sid = add_session(fd);
+        tune_client_socket(fd);
+        reactor->adopt(fd);
     }
-    int playerId = it->second;
-
-    auto lobbyOpt = const_cast<Game&>(game).getLobbyOf(playerId);
-    if (!lobbyOpt.has_value()) {
-        return SessionPhase::LoggedInNoLobby;
+    engine->import_image(image);
+    for (size_t i = 0; i < handoff.fds.size(); i++) {
+        const std::string& out = handoff.outputs[i];
+        if (!out.empty()) reactor->send(handoff.fds[i], out.data(), out.size());
     }
-    Lobby* lobby = lobbyOpt.value();
-    if (!lobby) return SessionPhase::LoggedInNoLobby;
-
-    if (lobby->matchJustEnded) return SessionPhase::AFTER_GAME;
 
-    if (lobby->inGame) return SessionPhase::InGame;
-    return SessionPhase::InLobby;
+    confirm_handoff(conn);
+    std::cerr << "[SYS] Took over " << image.sessions.size() << " sessions and " << image.lobbies.size()
+              << " lobbies via " << upgrade_path << "\n";
 }
 
-bool Server::is_request_allowed(SessionPhase phase, RequestType type) const {
-    switch (phase) {
-        case SessionPhase::NotLoggedIn:
-            return (type == RequestType::LOGIN  ||
-                    type == RequestType::LOGOUT ||
-                    type == RequestType::PONG   ||
-                    type == RequestType::STATE);
-
-        case SessionPhase::LoggedInNoLobby:
-            return (type == RequestType::LOGOUT       ||
-                    type == RequestType::CREATE_LOBBY ||
-                    type == RequestType::JOIN_LOBBY   ||
-                    type == RequestType::PONG         ||
-                    type == RequestType::STATE);
-
-        case SessionPhase::InLobby:
-            return (type == RequestType::LOGOUT      ||
-                    type == RequestType::LEAVE_LOBBY ||
-                    type == RequestType::PONG        ||
-                    type == RequestType::STATE);
-
-        case SessionPhase::InGame:
-            return (type == RequestType::LOGOUT      ||
-                    type == RequestType::LEAVE_LOBBY ||
-                    type == RequestType::MOVE        ||
-                    type == RequestType::PONG        ||
-                    type == RequestType::STATE);
-
-        case SessionPhase::AFTER_GAME:
-            return (type == RequestType::LOGOUT      ||
-                    type == RequestType::LEAVE_LOBBY ||
-                    type == RequestType::REMATCH     ||
-                    type == RequestType::PONG        ||
-                    type == RequestType::STATE);
-
-        case SessionPhase::INVALID:
-            return false;
-    }
-    return false;
-}
-
-void Server::notify_lobby_peers_player_left(int playerId, const std::string& reason) {
-    auto lobbyOpt = game.getLobbyOf(playerId);
-    if (!lobbyOpt.has_value()) return;
-    Lobby* lobby = lobbyOpt.value();
-    if (!lobby) return;
-
-    std::vector<int> peerIds;
-    for (auto& p : lobby->players) {
-        if (p.userId == playerId) continue;
-        peerIds.push_back(p.userId);
+// Called between batches, so no request is half-handled. Returns true once the new
+// process has confirmed; the caller must then stop without touching the sockets.
+bool Server::hand_over() {
+    const int conn = accept_upgrade(upgrade_fd);
+    if (conn < 0) return false;
+
+    Handoff handoff;
+    handoff.listen_fd = listen_fd;
+    std::string error;
+    bool ok = engine->export_image(handoff.engine, error);
+    if (ok) {
+        auto& sessions = handoff.engine.sessions;
+        sessions.erase(std::remove_if(sessions.begin(), sessions.end(),
+                                      [this](const SessionImage& s) { return fd_of(s.sid) < 0; }),
+                       sessions.end());
+        for (const auto& s : sessions) {
+            const int fd = fd_of(s.sid);
+            handoff.fds.push_back(fd);
+            handoff.outputs.push_back(reactor->pending_output(fd));
+        }
+        ok = send_handoff(conn, handoff, error);
     }
+    ::close(conn);
 
-    for (int peerId : peerIds) {
-        for (auto& kv : fd_to_player) {
-            if (kv.second == peerId) {
-                send_line(kv.first, Responses::game_cannot_continue(reason));
-                send_line(kv.first, Responses::lobby_left());
-            }
-        }
-        game.leaveLobby(peerId);
+    if (!ok) {
+        std::cerr << "[ERR] Upgrade refused: " << error << ". Still serving.\n";
+        return false;
     }
+    std::cerr << "[SYS] Handed " << handoff.fds.size() << " sessions to the new process. Exiting.\n";
+    return true;
 }
 
-void Server::disconnect_fd(int fd, const std::string& reason) {
-    auto it = fd_to_player.find(fd);
-    if (it != fd_to_player.end()) {
-        int userId = it->second;
-        auto lobbySnap = snapshot_lobby_of(game, userId);
-        auto lobbyOpt = game.getLobbyOf(userId);
-        SessionPhase phase = get_phase(fd);
-
-        if (lobbyOpt.has_value() && phase == SessionPhase::InGame) {
-            disconnected_players[userId] = std::chrono::steady_clock::now();
-            std::cerr << "[SYS] User " << userId << " lost connection (Soft). Waiting 15s.\n";
-
-            Lobby* lobby = lobbyOpt.value();
-            for (auto& p : lobby->players) {
-                if (p.userId == userId) continue;
-                for (auto& kv : fd_to_player) {
-                    if (kv.second == p.userId) {
-                        send_line(kv.first, Responses::opponent_disconnected(15));
-                    }
-                }
-            }
-        } else if (lobbyOpt.has_value() && phase == SessionPhase::AFTER_GAME) {
-            notify_lobby_peers_player_left(userId, "Opponent left after match");
-
-            std::cerr << "[SYS] User " << userId << " disconnected in AFTER_GAME. Cleaning up immediately.\n";
-            game.leaveLobby(userId);
-
-            if (lobbySnap.has_value()) {
-                release_lobby_name(lobbySnap->name);
-            }
-
-            g_online_users.erase(userId);
-            game.removePlayer(userId);
-        } else {
-            if (phase == SessionPhase::AFTER_GAME || phase == SessionPhase::InLobby) {
-                notify_lobby_peers_player_left(userId, "Opponent left the session");
-            }
-
-            std::cerr << "[SYS] User " << userId << " hard disconnected. Reason: " << reason << ".\n";
-            game.leaveLobby(userId);
-
-            if (lobbySnap.has_value() && (phase == SessionPhase::AFTER_GAME || phase == SessionPhase::InLobby)) {
-                release_lobby_name(lobbySnap->name);
-            } else if (lobbySnap.has_value() && lobbySnap->size <= 1) {
-                release_lobby_name(lobbySnap->name);
-            }
-
-            g_online_users.erase(userId);
-            game.removePlayer(userId);
-        }
-        fd_to_player.erase(it);
+// Responses are single small writes, so Nagle only ever adds a round trip.
+void Server::tune_client_socket(int fd) {
+    const int on = 1;
+    if (latency.tcp) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+    }
+    if (latency.busy_poll_us > 0 && !busy_poll_refused &&
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &latency.busy_poll_us, sizeof(latency.busy_poll_us)) < 0) {
+        // Above net.core.busy_read this needs CAP_NET_ADMIN; say so once, not per client.
+        perror("setsockopt SO_BUSY_POLL");
+        busy_poll_refused = true;
     }
-
-    close(fd);
-    FD_CLR(fd, &master_set);
-    client_buffers.erase(fd);
-    heartbeats.erase(fd);
 }
 
-void Server::check_disconnection_timeouts() {
+// While traffic flows, non-blocking polls for up to latency.spin catch the next request
+// without a sleep/wake-up; an idle loop goes straight to the blocking wait.
+bool Server::wait_for_events(bool spin) {
     using namespace std::chrono;
-    auto now = steady_clock::now();
-    std::vector<int> timed_out_users;
-
-    for (auto& kv : disconnected_players) {
-        int userId = kv.first;
-        auto disconnect_time = kv.second;
-
-        if (duration_cast<seconds>(now - disconnect_time).count() > 15) {
-            std::cerr << "[SYS] Reconnect timeout for user " << userId << ". Ending match.\n";
-
-            auto lobbySnap = snapshot_lobby_of(game, userId);
-            notify_lobby_peers_player_left(userId, "Opponent timed out");
-
-            game.leaveLobby(userId);
-            game.removePlayer(userId);
-
-            if (lobbySnap.has_value()) {
-                release_lobby_name(lobbySnap->name);
-            }
-
-            g_online_users.erase(userId);
-            timed_out_users.push_back(userId);
-        }
+    if (spin && latency.spin.count() > 0) {
+        const auto until = steady_clock::now() + latency.spin;
+        do {
+            if (!reactor->poll(*this, 0)) return false;
+            if (batch_begin != steady_clock::time_point{}) return true;
+        } while (steady_clock::now() < until);
     }
+    return reactor->poll(*this, config.poll_timeout_ms);
+}
 
-    for (int uid : timed_out_users) {
-        disconnected_players.erase(uid);
+// Safe between two polls: nothing here touches a connection.
+void Server::apply_config() {
+    if (!reactor->set_recv_buffer(config.recv_buffer_bytes) &&
+        config.recv_buffer_bytes != RuntimeConfig{}.recv_buffer_bytes) {
+        std::cerr << "[SYS] recv_buffer_bytes is fixed with " << reactor->name() << ", keeping its buffers\n";
     }
+    host->configure(config);
+    if (recorder) recorder->configure(config);
 }
 
-int Server::find_disconnected_player_by_name(const std::string& name) {
-    for (auto& kv : disconnected_players) {
-        int uid = kv.first;
-        auto lobbyOpt = game.getLobbyOf(uid);
-        if (lobbyOpt.has_value()) {
-            Lobby* lobby = lobbyOpt.value();
-            for (auto& p : lobby->players) {
-                if (p.userId == uid && p.username == name) {
-                    return uid;
-                }
-            }
-        }
+// All or nothing: a file that does not parse leaves every current value in place.
+void Server::reload_config() {
+    RuntimeConfig next;
+    std::string error;
+    if (!load_config(config_path, RuntimeConfig{}, next, error)) {
+        std::cerr << "[ERR] Config reload failed: " << error << ". Keeping current values.\n";
+        return;
     }
-    return -1;
-}
 
-void Server::heartbeat_tick() {
-    using namespace std::chrono;
-    const auto now = steady_clock::now();
+    // Listening again on a listening socket only resizes its accept queue.
+    if (next.listen_backlog != config.listen_backlog && ::listen(listen_fd, next.listen_backlog) < 0) {
+        perror("listen");
+    }
+    config = next;
+    apply_config();
+    std::cerr << "[SYS] Config reloaded: ";
+    report_config(std::cerr, config);
+    std::cerr << "\n";
+}
 
-    constexpr auto PING_INTERVAL = seconds(2);
-    constexpr auto PONG_TIMEOUT  = seconds(5);
+// Peers that are down are retried about once a second; a short connect timeout keeps an
+// unreachable node from stalling the loop.
+void Server::connect_peers() {
+    const auto now = std::chrono::steady_clock::now();
+    if (now < next_peer_attempt) return;
+    next_peer_attempt = now + std::chrono::seconds(1);
 
-    std::vector<int> to_disconnect;
+    for (int node = 0; node < static_cast<int>(cluster->size()); node++) {
+        SessionId& link = peer_links[static_cast<size_t>(node)];
+        if (node == cluster->self() || (link != 0 && fd_of(link) >= 0)) continue;
 
-    for (auto& [fd, hb] : heartbeats) {
-        if (now - hb.last_pong > PONG_TIMEOUT) {
-            std::cerr << "[SYS] Heartbeat timeout fd=" << fd << "\n";
-            to_disconnect.push_back(fd);
+        const int fd = connect_node(cluster->node(node), std::chrono::milliseconds(50));
+        if (fd < 0) {
+            link = 0;
             continue;
         }
-
-        if (now - hb.last_ping >= PING_INTERVAL) {
-            hb.last_ping = now;
-            hb.last_nonce = std::to_string(nonce_dist(rng));
-            std::string data = Responses::ping(hb.last_nonce) + "\n";
-            if (send(fd, data.data(), data.size(), 0) < 0) {
-                 to_disconnect.push_back(fd);
-            }
-        }
+        link = add_session(fd);
+        tune_client_socket(fd);
+        reactor->adopt(fd);
+        host->open_session(link);
+        engine->attach_peer(link, node);
     }
+}
 
-    for (int fd : to_disconnect) {
-        disconnect_fd(fd, "TIMEOUT");
+SessionId Server::add_session(int fd) {
+    const SessionId sid = (static_cast<SessionId>(next_serial++) << 32) | static_cast<uint32_t>(fd);
+    if (static_cast<size_t>(fd) >= fd_sessions.size()) {
+        fd_sessions.resize(static_cast<size_t>(fd) + 1, 0);
     }
+    fd_sessions[static_cast<size_t>(fd)] = sid;
+    open_sessions++;
+    return sid;
+}
+
+SessionId Server::session_of(int fd) const {
+    if (fd < 0 || static_cast<size_t>(fd) >= fd_sessions.size()) return 0;
+    return fd_sessions[static_cast<size_t>(fd)];
 }
 
-void Server::handle_client_data(int fd) {
-    char buf[4096];
-    ssize_t n = recv(fd, buf, sizeof(buf), 0);
-    if (n <= 0) {
-        disconnect_fd(fd, "DISCONNECTED");
+int Server::fd_of(SessionId sid) const {
+    const int fd = static_cast<int>(sid & 0xffffffffu);
+    return session_of(fd) == sid ? fd : -1;
+}
+
+void Server::on_accept(int client_fd) {
+    AllocScope scope(AllocSubsystem::Transport);
+    if (!admission.accept_connection(open_sessions)) {
+        std::cerr << "[SYS] Connection refused fd=" << client_fd << " (server full)\n";
+        // Framed like send_line; close() holds the fd open until the line is written.
+        const std::string busy = Responses::error_server_busy() + "\n";
+        reactor->send(client_fd, busy.data(), busy.size());
+        reactor->close(client_fd);
         return;
     }
 
-    std::string& buffer = client_buffers[fd];
-    buffer.append(buf, buf + n);
+    const SessionId sid = add_session(client_fd);
+    tune_client_socket(client_fd);
 
-    while (true) {
-        size_t pos = buffer.find('\n');
-        if (pos == std::string::npos) break;
+    std::cerr << "[SYS] Client connected fd=" << client_fd << " session=" << sid << "\n";
+    if (recorder) recorder->open(sid);
+    host->open_session(sid);
+}
 
-        std::string line = buffer.substr(0, pos);
-        buffer.erase(0, pos + 1);
+void Server::on_data(int fd, const char* data, size_t len) {
+    const SessionId sid = session_of(fd);
+    if (sid == 0) return;
+    if (recorder) recorder->data(sid, data, len);
 
-        Request req = parse_request_line(line);
-        if (!req.valid_magic) {
-            send_line(fd, Responses::error_invalid_magic());
-            disconnect_fd(fd, "INVALID_MAGIC");
-            return;
-        }
-        handle_request(fd, req);
+    // The kernel drops back to delayed ACKs on its own, so quick ACKs are re-armed per read.
+    if (latency.tcp) {
+        const int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
     }
+    host->on_data(sid, data, len);
 }
 
-void Server::handle_request(int fd, const Request& req) {
-    SessionPhase ph = get_phase(fd);
-
-    if (!is_request_allowed(ph, req.type)) {
-        if (req.type == RequestType::REMATCH && ph == SessionPhase::InGame) {
-             send_line(fd, Responses::error("Game already started"));
-             return;
-        }
-        send_line(fd, Responses::error_unexpected_state());
+void Server::on_hangup(int fd) {
+    const SessionId sid = session_of(fd);
+    if (sid == 0) {
+        reactor->close(fd);
         return;
     }
+    if (recorder) recorder->closed(sid);
+    host->on_transport_closed(sid);
+}
 
-    switch (req.type) {
-        case RequestType::LOGIN: {
-            if (req.params.size() != 1) {
-                send_line(fd, Responses::error_malformed_request());
-                break;
-            }
-            const std::string username = req.params[0];
-
-            int oldUserId = find_disconnected_player_by_name(username);
-            if (oldUserId != -1) {
-                std::cerr << "[SYS] User " << username << " reconnected (ID: " << oldUserId << ")\n";
-
-                fd_to_player[fd] = oldUserId;
-                disconnected_players.erase(oldUserId);
-
-                auto now = std::chrono::steady_clock::now();
-                heartbeats[fd].last_pong = now;
-                heartbeats[fd].last_ping = now;
-
-                send_line(fd, Responses::login_ok(oldUserId));
-
-                auto lobbyOpt = game.getLobbyOf(oldUserId);
-                if (lobbyOpt.has_value()) {
-                    Lobby* lobby = lobbyOpt.value();
-                    send_line(fd, Responses::lobby_joined(lobby->name));
-
-                    if (lobby->inGame) {
-                        send_line(fd, Responses::game_started());
-
-                        for (auto& p : lobby->players) {
-                            if (p.userId == oldUserId) continue;
-                            for (auto& kv : fd_to_player) {
-                                if (kv.second == p.userId) send_line(kv.first, Responses::game_resumed());
-                            }
-                        }
-
-                        std::ostringstream oss;
-                        oss << "score=" << lobby->p1Wins << ":" << lobby->p2Wins << ";";
-
-                        if (lobby->players.size() >= 1) {
-                            oss << "p1Id=" << lobby->players[0].userId << ";";
-                            oss << "p1Name=" << lobby->players[0].username << ";";
-                        }
-                        if (lobby->players.size() >= 2) {
-                            oss << "p2Id=" << lobby->players[1].userId << ";";
-                            oss << "p2Name=" << lobby->players[1].username << ";";
-                        }
-
-                        bool hasMoved = false;
-                        MoveType myMove = MoveType::NONE;
-
-                        if (!lobby->players.empty()) {
-                            if (lobby->players[0].userId == oldUserId) {
-                                myMove = lobby->p1Move;
-                                hasMoved = (lobby->p1Move != MoveType::NONE);
-                            } else if (lobby->players.size() > 1 && lobby->players[1].userId == oldUserId) {
-                                myMove = lobby->p2Move;
-                                hasMoved = (lobby->p2Move != MoveType::NONE);
-                            }
-                        }
-
-                        oss << "hasMoved=" << (hasMoved ? "true" : "false") << ";";
-                        if (hasMoved) {
-                            const std::string mv = move_to_string(myMove);
-                            oss << "lastMove=" << (mv.empty() ? "?" : mv) << ";";
-                        }
-                        send_line(fd, Responses::state(oss.str()));
-                    }
-                } else {
-                    std::cerr << "[SYS] User " << username << " reconnected but lobby is gone. Redirecting to menu.\n";
-                    send_line(fd, Responses::lobby_left());
-                }
-                break;
-            }
-
-            bool nameTaken = false;
-            for (const auto& kv : g_online_users) {
-                if (kv.second == username) {
-                    nameTaken = true;
-                    break;
-                }
-            }
-
-            if (nameTaken) {
-                send_line(fd, Responses::error("Name already in use"));
-                break;
-            }
-
-            if (fd_to_player.find(fd) != fd_to_player.end()) {
-                send_line(fd, Responses::error_unexpected_state());
-                break;
-            }
-
-            int userId = game.addPlayer(username);
-            fd_to_player[fd] = userId;
-            g_online_users[userId] = username;
-            send_line(fd, Responses::login_ok(userId));
-            break;
-        }
-
-        case RequestType::LOGOUT: {
-            auto it = fd_to_player.find(fd);
-            if (it != fd_to_player.end()) {
-                int userId = it->second;
-                auto snap = snapshot_lobby_of(game, userId);
-                game.leaveLobby(userId);
-                if (snap.has_value() && snap->size <= 1) {
-                    release_lobby_name(snap->name);
-                }
-                g_online_users.erase(userId);
-                game.removePlayer(userId);
-            }
-            send_line(fd, Responses::logout_ok());
-            disconnect_fd(fd, "LOGOUT");
-            break;
-        }
-
-        case RequestType::CREATE_LOBBY: {
-            if (req.params.size() != 1) {
-                send_line(fd, Responses::error_malformed_request());
-                break;
-            }
-            int userId = fd_to_player[fd];
-            std::string lobbyName = req.params[0];
-
-            if (g_active_lobbies.find(lobbyName) != g_active_lobbies.end()) {
-                send_line(fd, Responses::error("Lobby name already taken"));
-                break;
-            }
-
-            auto lobbyIdOpt = game.createLobby(userId, lobbyName);
-            if (!lobbyIdOpt.has_value()) {
-                send_line(fd, Responses::error("Cannot create lobby"));
-                break;
-            }
-            g_active_lobbies.insert(lobbyName);
-            send_line(fd, Responses::lobby_created(*lobbyIdOpt));
-            break;
-        }
-
-        case RequestType::JOIN_LOBBY: {
-            if (req.params.size() != 1) {
-                send_line(fd, Responses::error_malformed_request());
-                break;
-            }
-            int userId = fd_to_player[fd];
-            std::string lobbyName = req.params[0];
-
-            if (!game.joinLobby(userId, lobbyName)) {
-                send_line(fd, Responses::error("Join failed"));
-                break;
-            }
-            send_line(fd, Responses::lobby_joined(lobbyName));
-
-            auto lobbyOpt = game.getLobbyOf(userId);
-            if (lobbyOpt.has_value() && game.canStartGame(lobbyOpt.value())) {
-                Lobby* lobby = lobbyOpt.value();
-                game.startGame(lobby);
-                for (auto& p : lobby->players) {
-                    for (auto& kv : fd_to_player) {
-                        if (kv.second == p.userId) send_line(kv.first, Responses::game_started());
-                    }
-                }
-            }
-            break;
-        }
-
-        case RequestType::LEAVE_LOBBY: {
-            int userId = fd_to_player[fd];
-            auto snap = snapshot_lobby_of(game, userId);
-            notify_lobby_peers_player_left(userId, "Opponent left the lobby");
-            game.leaveLobby(userId);
-            if (snap.has_value() && snap->size <= 1) {
-                release_lobby_name(snap->name);
-            }
-            send_line(fd, Responses::lobby_left());
-            break;
-        }
-
-        case RequestType::MOVE: {
-            if (req.params.size() != 1) {
-                send_line(fd, Responses::error_malformed_request());
-                break;
-            }
-            int userId = fd_to_player[fd];
-            MoveType mv;
-            if (!string_to_move(req.params[0], mv)) {
-                send_line(fd, Responses::error_invalid_move());
-                break;
-            }
-
-            int rw = 0, mw = 0, p1w = 0, p2w = 0;
-            MoveType m1 = MoveType::NONE;
-            MoveType m2 = MoveType::NONE;
-            bool me = false;
-
-            if (!game.submitMove(userId, mv, rw, m1, m2, me, mw, p1w, p2w)) {
-                send_line(fd, Responses::error("Move rejected (already moved or not your turn)"));
-                break;
-            }
-            send_line(fd, Responses::move_accepted(move_to_string(mv)));
-
-            auto lobbyOpt = game.getLobbyOf(userId);
-            if (lobbyOpt.has_value()) {
-                Lobby* lobby = lobbyOpt.value();
-                if (m1 != MoveType::NONE && m2 != MoveType::NONE) {
-                    for (auto& p : lobby->players) {
-                        for (auto& kv : fd_to_player) {
-                            if (kv.second == p.userId) {
-                                send_line(kv.first,
-                                    Responses::round_result(rw, move_to_string(m1), move_to_string(m2), lobby->p1Wins, lobby->p2Wins)
-                                );
-                            }
-                        }
-                    }
-                }
-                if (me) {
-                    for (auto& p : lobby->players) {
-                        for (auto& kv : fd_to_player) {
-                            if (kv.second == p.userId)
-                                send_line(kv.first, Responses::match_result(mw, p1w, p2w));
-                        }
-                    }
-                }
-            }
-            break;
-        }
+void Server::on_wakeup() {
+    if (sharded) sharded->drain();
+}
 
-        case RequestType::REMATCH: {
-            int userId = fd_to_player[fd];
-            auto lobbyOpt = game.getLobbyOf(userId);
-            if (!lobbyOpt.has_value()) {
-                send_line(fd, Responses::error_not_in_lobby());
-                break;
-            }
-            Lobby* lobby = lobbyOpt.value();
-            if (!game.requestRematch(userId, lobby)) {
-                send_line(fd, Responses::error_rematch_not_allowed());
-                break;
-            }
-            send_line(fd, Responses::rematch_ready());
-
-            if (game.canStartRematch(lobby)) {
-                game.startRematch(lobby);
-                for (auto& p : lobby->players) {
-                    for (auto& kv : fd_to_player) {
-                        if (kv.second == p.userId) send_line(kv.first, Responses::game_started());
-                    }
-                }
-            }
-            break;
-        }
+void Server::on_batch_begin() {
+    batch_begin = std::chrono::steady_clock::now();
+}
 
-        case RequestType::STATE: {
-            int userId = -1;
-            auto it = fd_to_player.find(fd);
-            if (it != fd_to_player.end()) userId = it->second;
-
-            std::ostringstream oss;
-            oss << "phase=" << phase_to_debug(ph) << ";";
-
-            auto lobbyOpt = game.getLobbyOf(userId);
-            if (lobbyOpt.has_value()) {
-                Lobby* lobby = lobbyOpt.value();
-                oss << "score=" << lobby->p1Wins << ":" << lobby->p2Wins << ";";
-
-                if (lobby->players.size() >= 1) {
-                    oss << "p1Id=" << lobby->players[0].userId << ";";
-                    oss << "p1Name=" << lobby->players[0].username << ";";
-                }
-                if (lobby->players.size() >= 2) {
-                    oss << "p2Id=" << lobby->players[1].userId << ";";
-                    oss << "p2Name=" << lobby->players[1].username << ";";
-                }
-
-                if (lobby->inGame) {
-                    bool hasMoved = false;
-                    MoveType myMove = MoveType::NONE;
-
-                    if (!lobby->players.empty() && lobby->players[0].userId == userId) {
-                        myMove = lobby->p1Move;
-                        hasMoved = (lobby->p1Move != MoveType::NONE);
-                    } else if (lobby->players.size() > 1 && lobby->players[1].userId == userId) {
-                        myMove = lobby->p2Move;
-                        hasMoved = (lobby->p2Move != MoveType::NONE);
-                    }
-
-                    oss << "hasMoved=" << (hasMoved ? "true" : "false") << ";";
-                    if (hasMoved) {
-                        const std::string mv = move_to_string(myMove);
-                        oss << "lastMove=" << (mv.empty() ? "?" : mv) << ";";
-                    }
-                }
-            }
-
-            if (userId >= 0) oss << "playerId=" << userId << ";";
-            send_line(fd, Responses::state(oss.str()));
-            break;
-        }
+void Server::deliver(SessionId sid, const std::string& bytes) {
+    AllocScope scope(AllocSubsystem::Transport);
+    const int fd = fd_of(sid);
+    if (fd < 0) return;
+    if (recorder) recorder->output(sid, bytes);
+    reactor->send(fd, bytes.data(), bytes.size());
+}
 
-        case RequestType::PONG: {
-            auto it = heartbeats.find(fd);
-            if (it != heartbeats.end()) {
-                it->second.last_pong = std::chrono::steady_clock::now();
-            }
-            break;
-        }
+void Server::deliver_shared(SessionId sid, const SharedBytes& bytes) {
+    const int fd = fd_of(sid);
+    if (fd < 0) return;
+    if (recorder) recorder->output(sid, *bytes);
+    if (!reactor->send_shared(fd, bytes)) slow_sessions.push_back(sid);
+}
 
-        default:
-            send_line(fd, Responses::error_unknown_request());
-            break;
+// Not done inside deliver_shared: the engine is still in the middle of its broadcast.
+void Server::drop_slow_sessions() {
+    std::vector<SessionId> slow;
+    slow.swap(slow_sessions);
+    for (SessionId sid : slow) {
+        if (fd_of(sid) < 0) continue;
+        std::cerr << "[SYS] Session " << sid << " too slow, disconnecting\n";
+        if (recorder) recorder->closed(sid);
+        host->on_transport_closed(sid);
     }
 }
 
-void Server::send_line(int fd, const std::string& line) {
-    std::string data = line + "\n";
-    if (send(fd, data.data(), data.size(), 0) < 0) {
-        perror("send");
-    }
+void Server::close(SessionId sid) {
+    const int fd = fd_of(sid);
+    if (fd < 0) return;
+    if (recorder) recorder->drop(sid);
+    fd_sessions[static_cast<size_t>(fd)] = 0;
+    open_sessions--;
+    reactor->close(fd);
 }
 
 void Server::run() {
+    using namespace std::chrono;
+
+    bool busy = false;
     while (true) {
-        if (heartbeat_enabled) heartbeat_tick();
-        check_disconnection_timeouts();
-
-        fd_set read_fds = master_set;
-        timeval tv{};
-        tv.tv_sec = 0;
-        tv.tv_usec = 500000;
-
-        int ready = select(max_fd + 1, &read_fds, nullptr, nullptr, &tv);
-        if (ready < 0) {
-            if (errno == EINTR) continue;
-            perror("select");
-            break;
+        const auto tick_start = steady_clock::now();
+        if (cluster) connect_peers();
+        if (recorder) recorder->tick();
+        host->tick();
+        auto lag = duration_cast<microseconds>(steady_clock::now() - tick_start);
+
+        if (reload_requested) {
+            reload_requested = 0;
+            reload_config();
+        }
+
+        batch_begin = {};
+        if (!wait_for_events(busy)) break;
+        busy = batch_begin != steady_clock::time_point{};
+        if (!slow_sessions.empty()) drop_slow_sessions();
+        if (recorder) recorder->flush();
+        if (upgrade_fd >= 0 && hand_over()) break;
+
+        // Loop lag: how long a newly ready event waited behind this iteration's work.
+        if (batch_begin != steady_clock::time_point{}) {
+            lag += duration_cast<microseconds>(steady_clock::now() - batch_begin);
         }
+        if (sharded) lag = std::max(lag, sharded->worker_lag());
+        admission.observe(lag, open_sessions);
 
-        for (int fd = 0; fd <= max_fd; fd++) {
-            if (FD_ISSET(fd, &read_fds)) {
-                if (fd == listen_fd) accept_client();
-                else handle_client_data(fd);
-            }
+        if (stats_interval.count() > 0 && steady_clock::now() >= next_stats) {
+            report_stats();
+            next_stats = steady_clock::now() + stats_interval;
         }
     }
 }
+
+void Server::report_stats() {
+    std::cerr << "[STATS] sessions=" << open_sessions
+              << " admission=" << shed_level_name(admission.level())
+              << " loop_lag_us=" << admission.lag().count()
+              << " rss_kb=" << resident_set_bytes() / 1024 << "\n";
+    SessionEngine::rtt_histogram().report(std::cerr, "[STATS] ", "rtt");
+    Matchmaker::stats().report(std::cerr, "[STATS] ");
+    if (alloc_stats_enabled()) alloc_stats_report(std::cerr, "[STATS] ");
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "SessionEngine.hpp"
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Minimal checks for the engine tests: a failed CHECK is reported and the test exits non-zero.
+inline int check_failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #cond "\n"; \
+            check_failures++;                                                        \
+        }                                                                            \
+    } while (0)
+
+// Keeps every line the engine sends, per session, until a test takes them.
+class RecordingSink : public SessionSink {
+public:
+    std::unordered_map<SessionId, std::vector<std::string>> lines;
+
+    void deliver(SessionId sid, const std::string& data) override {
+        size_t start = 0;
+        for (size_t nl = data.find('\n'); nl != std::string::npos; nl = data.find('\n', start)) {
+            lines[sid].push_back(data.substr(start, nl - start));
+            start = nl + 1;
+        }
+    }
+    void close(SessionId) override {}
+};
+
+// A socket-free engine with heartbeats off, fed protocol lines like the --bench driver.
+class EngineHarness {
+public:
+    RecordingSink sink;
+    SessionEngine engine{sink, no_heartbeat()};
+
+    // Opens a session and logs it in; the login answer is discarded.
+    SessionId login(const std::string& username) {
+        const SessionId sid = next_sid++;
+        engine.open_session(sid);
+        send(sid, "REQ_LOGIN|" + username);
+        take(sid);
+        return sid;
+    }
+
+    void send(SessionId sid, const std::string& payload) {
+        const std::string line = std::string(PROTOCOL_MAGIC) + "|" + payload + "|\n";
+        engine.on_data(sid, line.data(), line.size());
+    }
+
+    // Lines sent to sid since the last take().
+    std::vector<std::string> take(SessionId sid) {
+        std::vector<std::string> out;
+        out.swap(sink.lines[sid]);
+        return out;
+    }
+
+    static bool has(const std::vector<std::string>& lines, const std::string& fragment) {
+        for (const auto& line : lines) {
+            if (line.find(fragment) != std::string::npos) return true;
+        }
+        return false;
+    }
+
+private:
+    SessionId next_sid{1};
+
+    static HeartbeatOptions no_heartbeat() {
+        HeartbeatOptions heartbeat;
+        heartbeat.enabled = false;
+        return heartbeat;
+    }
+};
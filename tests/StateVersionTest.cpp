@@ -0,0 +1,57 @@
+#include "EngineHarness.hpp"
+
+#include <cctype>
+#include <string>
+#include <vector>
+
+namespace {
+    // The version field of the first full RES_STATE in lines, or empty.
+    std::string state_version(const std::vector<std::string>& lines) {
+        for (const auto& line : lines) {
+            if (line.find("RES_STATE|") == std::string::npos) continue;
+            const size_t at = line.find("version");
+            if (at == std::string::npos) return "";
+            size_t begin = at + 7;
+            while (begin < line.size() && !std::isdigit(static_cast<unsigned char>(line[begin]))) begin++;
+            size_t end = begin;
+            while (end < line.size() && std::isdigit(static_cast<unsigned char>(line[end]))) end++;
+            return line.substr(begin, end - begin);
+        }
+        return "";
+    }
+
+    // x and y go through the same changes, so per-lobby counters would give them equal
+    // versions; a client moving from x to y must still get y's full state.
+    void switching_lobbies_does_not_reuse_a_version() {
+        EngineHarness h;
+        const SessionId a = h.login("a");
+        const SessionId b = h.login("b");
+        const SessionId c = h.login("c");
+
+        h.send(a, "REQ_CREATE_LOBBY|x");
+        h.send(c, "REQ_JOIN_LOBBY|x");
+        h.take(a);
+        h.send(a, "REQ_STATE");
+        const std::string known = state_version(h.take(a));
+        CHECK(!known.empty());
+
+        h.send(a, "REQ_STATE|" + known);
+        CHECK(EngineHarness::has(h.take(a), "RES_STATE_UNCHANGED|" + known));
+
+        h.send(a, "REQ_LEAVE_LOBBY");
+        h.send(c, "REQ_LEAVE_LOBBY");
+        h.send(b, "REQ_CREATE_LOBBY|y");
+        h.send(a, "REQ_JOIN_LOBBY|y");
+        h.take(a);
+
+        h.send(a, "REQ_STATE|" + known);
+        const auto reply = h.take(a);
+        CHECK(!EngineHarness::has(reply, "RES_STATE_UNCHANGED"));
+        CHECK(!state_version(reply).empty() && state_version(reply) != known);
+    }
+}
+
+int main() {
+    switching_lobbies_does_not_reuse_a_version();
+    return check_failures == 0 ? 0 : 1;
+}
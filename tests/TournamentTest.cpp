@@ -0,0 +1,119 @@
+#include "EngineHarness.hpp"
+#include "Tournament.hpp"
+
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace {
+    // a and b meet in round 1 match 1, c and d in match 2; a logs out mid-match.
+    void logout_mid_round_advances_bracket() {
+        EngineHarness h;
+        const SessionId a = h.login("a");
+        const SessionId b = h.login("b");
+        const SessionId c = h.login("c");
+        const SessionId d = h.login("d");
+
+        h.send(a, "REQ_TOURNEY_CREATE|cup|single");
+        for (SessionId sid : {a, b, c, d}) h.send(sid, "REQ_TOURNEY_JOIN|cup");
+        h.send(a, "REQ_TOURNEY_START|cup");
+        CHECK(EngineHarness::has(h.take(b), "RES_TOURNEY_MATCH|cup|1|cup#r1m1|a"));
+        CHECK(EngineHarness::has(h.take(c), "RES_TOURNEY_MATCH|cup|1|cup#r1m2|d"));
+        h.take(a);
+        h.take(d);
+
+        h.send(a, "REQ_MOVE|R");
+        h.send(a, "REQ_LOGOUT");
+        CHECK(EngineHarness::has(h.take(a), "RES_LOGOUT_OK"));
+        const auto toB = h.take(b);
+        CHECK(EngineHarness::has(toB, "RES_GAME_CANNOT_CONTINUE"));
+        CHECK(EngineHarness::has(toB, "RES_LOBBY_LEFT"));
+        CHECK(EngineHarness::has(toB, "RES_TOURNEY_RESULT|cup|1|2"));
+
+        // Once the other match ends, b and c meet in the final.
+        for (int round = 0; round < 3; round++) {
+            h.send(c, "REQ_MOVE|R");
+            h.send(d, "REQ_MOVE|S");
+        }
+        CHECK(EngineHarness::has(h.take(b), "RES_TOURNEY_MATCH|cup|2|cup#r2m1|c"));
+        CHECK(EngineHarness::has(h.take(c), "RES_TOURNEY_MATCH|cup|2|cup#r2m1|b"));
+    }
+
+    // A player withdrawn while still seated forfeits; the opponent is freed for the next round.
+    void withdraw_settles_a_live_match() {
+        Game game;
+        TournamentManager tournaments(game);
+        const int a = game.addPlayer("a");
+        const int b = game.addPlayer("b");
+        const int c = game.addPlayer("c");
+        const int d = game.addPlayer("d");
+
+        std::vector<BracketEvent> events;
+        CHECK(tournaments.create("cup", a, BracketFormat::SingleElimination, 0));
+        for (int p : {a, b, c, d}) CHECK(tournaments.enter("cup", p));
+        CHECK(tournaments.start("cup", a, events));
+        const auto secondLobby = game.getLobbyOf(c);
+        CHECK(secondLobby.has_value());
+
+        events.clear();
+        tournaments.withdraw(a, events);
+        CHECK(events.size() == 2);
+        if (events.size() != 2) return;
+        CHECK(events[0].kind == BracketEvent::Kind::MatchAbandoned && events[0].p1 == b &&
+              events[0].lobbyName == "cup#r1m1");
+        CHECK(events[1].kind == BracketEvent::Kind::MatchDecided && events[1].winner == b);
+        CHECK(!game.getLobbyOf(b).has_value());
+
+        events.clear();
+        const int lobbyId = secondLobby.value()->lobbyId;
+        game.leaveLobby(c);
+        game.leaveLobby(d);
+        tournaments.matchEnded(lobbyId, c, events);
+        bool final_started = false;
+        for (const auto& ev : events) {
+            if (ev.kind == BracketEvent::Kind::MatchStarted && ev.round == 2 && ev.p1 == b && ev.p2 == c) {
+                final_started = true;
+            }
+        }
+        CHECK(final_started);
+    }
+
+    // Six players over three rounds can always avoid a rematch; the pairing walk must find one.
+    void swiss_pairs_without_rematches() {
+        Game game;
+        TournamentManager tournaments(game);
+        std::vector<int> players;
+        for (const char* name : {"a", "b", "c", "d", "e", "f"}) players.push_back(game.addPlayer(name));
+
+        std::vector<BracketEvent> events;
+        CHECK(tournaments.create("open", players[0], BracketFormat::Swiss, 3));
+        for (int p : players) CHECK(tournaments.enter("open", p));
+        CHECK(tournaments.start("open", players[0], events));
+
+        std::set<std::pair<int, int>> met;
+        for (int round = 1; round <= 3; round++) {
+            std::vector<BracketEvent> started;
+            for (const auto& ev : events) {
+                if (ev.kind == BracketEvent::Kind::MatchStarted && ev.round == round) started.push_back(ev);
+            }
+            CHECK(started.size() == 3);
+            events.clear();
+            for (const auto& ev : started) {
+                CHECK(met.emplace(std::min(ev.p1, ev.p2), std::max(ev.p1, ev.p2)).second);
+                const int lobbyId = game.getLobbyOf(ev.p1).value()->lobbyId;
+                game.leaveLobby(ev.p1);
+                game.leaveLobby(ev.p2);
+                tournaments.matchEnded(lobbyId, ev.p1, events);
+            }
+        }
+        CHECK(!events.empty() && events.back().kind == BracketEvent::Kind::Finished);
+    }
+}
+
+int main() {
+    logout_mid_round_advances_bracket();
+    withdraw_settles_a_live_match();
+    swiss_pairs_without_rematches();
+    return check_failures == 0 ? 0 : 1;
+}